@@ -25,6 +25,16 @@ typedef void (*ds_destroy_fn)(
 	struct ds_context *ctx
 );
 
+// Heights at count points on face f, given as separate arrays of u and v
+typedef void (*ds_sample_batch_fn)(
+	void *usr,
+	const double *u,
+	const double *v,
+	uint8_t f,
+	size_t count,
+	float *out
+);
+
 struct ds_vtbl
 {
 	ds_destroy_fn 	destroy;
@@ -33,6 +43,8 @@ struct ds_vtbl
 	ds_find_fn		find;
 
 	float (*sample)(void *usr, double u, double v, uint8_t f);
+	// Optional, see ds_sample_batch
+	ds_sample_batch_fn sample_batch;
 	float (*max)(void *usr);
 	float (*min)(void *usr);
 };
@@ -62,4 +74,15 @@ struct ds_context
 
 void ds_context_destroy(ds_context *ctx);
 
+/// @brief Heights at count points on face f.  Calls sample for each point 
+/// if the source has no sample_batch.
+void ds_sample_batch(
+	const ds_context *ctx, 
+	const double *u, 
+	const double *v, 
+	uint8_t f, 
+	size_t count, 
+	float *out
+);
+
 #endif
@@ -11,6 +11,23 @@ struct GlobeStats
 {
 	size_t new_loads;
 	size_t loaded;
+	// Memory held by terrain tiles on the CPU
+	size_t tile_bytes;
+	size_t tile_budget;
+	// Tiles read from the disk cache instead of being loaded
+	size_t disk_hits;
+	size_t disk_misses;
+	// Temporary memory used by the last update, and how many times the arena
+	// it comes from has gone to the heap.  The count stops growing once the
+	// arena fits a typical frame.
+	size_t frame_bytes;
+	size_t frame_heap_allocs;
+};
+
+enum GlobeMemoryPressure
+{
+	GLOBE_MEMORY_PRESSURE_MODERATE,
+	GLOBE_MEMORY_PRESSURE_CRITICAL,
 };
 
 struct GlobeUpdateInfo
@@ -23,8 +40,46 @@ void globe_destroy(Globe *globe);
 
 void globe_imgui(Globe *globe);
 
+/// @brief Sets how much memory terrain tiles may take on the CPU, up to the
+/// size the globe was created with
+void globe_set_memory_budget(Globe *globe, size_t bytes);
+
+/// @brief Shrinks the tile caches when the system is low on memory
+void globe_memory_pressure(Globe *globe, GlobeMemoryPressure level);
+
+struct GlobeElevation
+{
+	float height;
+	// How far height may be from the finest terrain there is at the point.
+	// Exact when that terrain was used, and an estimate otherwise.
+	float error;
+	// Zoom of the tile it was interpolated from
+	uint8_t zoom;
+	// Whether that was the finest tile
+	bool exact;
+};
+
+/// @brief Elevation interpolated from the finest terrain tile loaded at p, 
+/// or a coarser one with a wider error bound.  With load set, the finest 
+/// tile is loaded in the background if it is missing.
+GlobeElevation globe_query_elevation(const Globe *globe, const glm::dvec3& p, bool load);
+
+/// @brief Height of globe_query_elevation, without loading anything
 float globe_sample_elevation(const Globe *globe, const glm::dvec3& p);
 
+/// @brief Elevation at count points, given as separate arrays of their 
+/// coordinates.  Points are sorted by face and tile, and each tile loaded is
+/// looked up once, which costs much less per point than 
+/// globe_sample_elevation.
+void globe_sample_elevation_batch(
+	const Globe *globe, 
+	size_t count,
+	const double *x, 
+	const double *y, 
+	const double *z, 
+	float *out
+);
+
 ev2::Result globe_update(Globe *globe, GlobeUpdateInfo *info);
 void globe_draw(const Globe *globe, const ev2::PassCtx& pass);
 
@@ -0,0 +1,11 @@
+#ifndef PYRAMID_DATA_SOURCE_H
+#define PYRAMID_DATA_SOURCE_H
+
+#include <ev2/globe/data_source.h>
+
+// @brief Data source reading tiles from a tile pyramid file, see 
+// globe/tile_pyramid.h.  The file is mapped, so a tile costs a copy from
+// the page cache, or a read of 256 KB on a cold one.
+extern int pyramid_data_source_init(struct ds_context **p_ctx, const char *path);
+
+#endif //PYRAMID_DATA_SOURCE_H
@@ -143,6 +143,15 @@ static inline tile_code_t tile_code_pack2(uint8_t face, uint8_t zoom, uint64_t i
 	return u64;
 }
 
+/// @brief Ancestor of the tile at a zoom level at or above its own
+static inline constexpr tile_code_t tile_code_ancestor(tile_code_t u64, uint8_t zoom)
+{
+	TileCode code = tile_code_unpack(u64);
+	code.idx >>= 2*(code.zoom - zoom);
+	code.zoom = zoom;
+	return tile_code_pack(code);
+}
+
 static constexpr tile_code_t TILE_CODE_NONE_U = UINT64_MAX;
 static constexpr TileCode TILE_CODE_NONE = tile_code_unpack(TILE_CODE_NONE_U);
 
@@ -335,16 +344,85 @@ static inline TileCode tile_encode(uint8_t zoom, glm::dvec3 p)
 	return code; 
 }
 
-// very rough approximation used to estimate screen error for 
-// a tile. Improve this.
+/// @brief Tile at the same level offset by (dx,dy) tiles.  Offsets past the
+/// edge of the face wrap onto the adjacent face.
+static inline TileCode tile_code_neighbor(TileCode code, int dx, int dy)
+{
+	aabb2_t rect = morton_u64_to_rect_f64(code.idx, code.zoom);
+	glm::dvec2 mid = 0.5*(rect.ll() + rect.ur()) + 
+		glm::dvec2((double)dx, (double)dy)*(rect.ur() - rect.ll());
+
+	// Points on the plane of the face past its edge project onto the 
+	// face next to it
+	glm::dvec3 p = face_to_world(glm::dvec3(2.0*mid - glm::dvec2(1.0), 1.0), code.face);
+
+	return tile_encode(code.zoom, p);
+}
+
+/// @brief Mean fraction of a cube face covered by a tile at level lvl.
+/// Tiles near the face corners cover less of the sphere, see 
+/// tile_factor(TileCode) for the exact value.
 static inline constexpr double tile_factor(uint8_t lvl)
 {
-	// TODO : Compute the actual surface integral (or approximate with
-	// a series to an acceptable order).
-	//
-	// This is fully incorrect
 	return 1.0/(double)(1LU << 2*lvl);
 }
 
+// Below this level the closed form loses too much to cancellation
+static constexpr uint8_t TILE_SOLID_ANGLE_CLOSED_FORM_MAX_ZOOM = 8;
+
+/// @brief Solid angle of the rectangle [0,x] x [0,y] on the gnomonic plane 
+/// z = 1.  Signed, so rectangles can be built by inclusion-exclusion.
+static inline double gnomonic_solid_angle(double x, double y)
+{
+	return atan(x*y/sqrt(1.0 + x*x + y*y));
+}
+
+/// @brief Solid angle subtended by a tile, in steradians.  
+///
+/// The integrand on the gnomonic plane is (1 + x^2 + y^2)^(-3/2), which has
+/// the closed form antiderivative gnomonic_solid_angle.  Deep tiles are tiny
+/// compared to the values being differenced, so they use 2x2 Gauss-Legendre
+/// quadrature instead, which is exact to well below double precision there.
+static inline double tile_solid_angle(TileCode code)
+{
+	aabb2_t rect = morton_u64_to_rect_f64(code.idx, code.zoom);
+
+	double x0 = 2.0*rect.min.x - 1.0;
+	double x1 = 2.0*rect.max.x - 1.0;
+	double y0 = 2.0*rect.min.y - 1.0;
+	double y1 = 2.0*rect.max.y - 1.0;
+
+	if (code.zoom <= TILE_SOLID_ANGLE_CLOSED_FORM_MAX_ZOOM) {
+		return gnomonic_solid_angle(x1, y1) - gnomonic_solid_angle(x0, y1) 
+			- gnomonic_solid_angle(x1, y0) + gnomonic_solid_angle(x0, y0);
+	}
+
+	double hx = 0.5*(x1 - x0);
+	double hy = 0.5*(y1 - y0);
+	double cx = x0 + hx;
+	double cy = y0 + hy;
+
+	constexpr double g = 0.57735026918962576; // 1/sqrt(3)
+
+	double sum = 0;
+	for (int i = 0; i < 4; ++i) {
+		double x = cx + ((i & 1) ? g : -g)*hx;
+		double y = cy + ((i & 2) ? g : -g)*hy;
+		double r_sq = 1.0 + x*x + y*y;
+		sum += 1.0/(r_sq*sqrt(r_sq));
+	}
+
+	return sum*hx*hy;
+}
+
+/// @brief Exact fraction of the sphere covered by a tile, scaled so the 
+/// average over a level matches tile_factor(zoom).
+static inline double tile_factor(TileCode code)
+{
+	// solid angle of one cube face
+	constexpr double face = 4.0*3.14159265358979323846/(double)CUBE_FACES;
+	return tile_solid_angle(code)/face;
+}
+
 #endif // GLOBE_TILING_H
 
@@ -5,8 +5,10 @@
 #include <glm/vec3.hpp>
 
 #include <atomic>
+#include <random>
 
 #include <cstddef>
+#include <cstdint>
 #include <cmath>
 
 #ifndef TWOPI
@@ -36,37 +38,61 @@ static inline double smooth_max_zero(double x)
 	return -(1.0/(b*b))*log(1/(1.0 + exp((b*b)*x)));
 }
 
-static inline double weierstrass(double x, double y, double phase = 0)
+static constexpr double 
+	WEIERSTRASS_L = 1.2, 
+	WEIERSTRASS_D = 2.3,
+	WEIERSTRASS_G = 4, 
+	WEIERSTRASS_GAMMA = 2.4;
+static constexpr size_t WEIERSTRASS_M = 11, WEIERSTRASS_N = 9;
+// The phases come from their own generator, so that the terrain is the same
+// every run whatever else calls rand() first.  Tiles in the disk cache rely
+// on it.
+static constexpr uint64_t WEIERSTRASS_SEED = 0x5eed0f7e22a1ULL;
+
+/// @brief Random phases and per-octave weights of weierstrass, shared with 
+/// batched versions of it.  Filled in on first use.
+struct weierstrass_table
 {
-	static constexpr double 
-	L = 1.2, 
-	D = 2.3,
-	G = 4, 
-	gamma =	2.4;
-	static constexpr size_t M = 11, N = 9;
+	double A;
+
+	double phi[WEIERSTRASS_M][WEIERSTRASS_N];
+	double cos_phi[WEIERSTRASS_M][WEIERSTRASS_N];
+
+	double gammaD3n[WEIERSTRASS_N];
+	double gamman[WEIERSTRASS_N];
+};
 
-	double A = L*pow(G/D,D-2.0)*sqrt(log(gamma)/(double)M); 
+static inline const weierstrass_table &weierstrass_get_table()
+{
+	static constexpr double 
+	L = WEIERSTRASS_L, 
+	D = WEIERSTRASS_D,
+	G = WEIERSTRASS_G, 
+	gamma =	WEIERSTRASS_GAMMA;
+	static constexpr size_t M = WEIERSTRASS_M, N = WEIERSTRASS_N;
 
 	static std::atomic_int init = 0;
 	static std::atomic_bool done = false;
 
-	static double phi[M][N];
-	static double cos_phi[M][N];
-
-	static double gammaD3n[N];
-	static double gamman[N];
+	static weierstrass_table t;
 
 	if (!init++) {
+		t.A = L*pow(G/D,D-2.0)*sqrt(log(gamma)/(double)M); 
+
+		// The engine's output is fixed by the standard, unlike the 
+		// distributions
+		std::mt19937_64 rng (WEIERSTRASS_SEED);
+
 		for (size_t m = 0; m < M; ++m) {
 			for (size_t n = 0; n < N; ++n) {
-				phi[m][n] = TWOPI*urandf1();
-				cos_phi[m][n] = cos(phi[m][n]);
+				t.phi[m][n] = TWOPI*(double)(rng() >> 11)*0x1p-53;
+				t.cos_phi[m][n] = cos(t.phi[m][n]);
 			}
 		}
 
 		for (size_t n = 0; n < N; ++n) {
-			gammaD3n[n] = pow(gamma, (D - 3.0)*(double)n);
-			gamman[n] = pow(gamma, (double)n);
+			t.gammaD3n[n] = pow(gamma, (D - 3.0)*(double)n);
+			t.gamman[n] = pow(gamma, (double)n);
 		}
 		
 		done = 1;
@@ -76,6 +102,16 @@ static inline double weierstrass(double x, double y, double phase = 0)
 	if (!done)
 		done.wait(0);
 
+	return t;
+}
+
+static inline double weierstrass(double x, double y, double phase = 0)
+{
+	static constexpr double L = WEIERSTRASS_L;
+	static constexpr size_t M = WEIERSTRASS_M, N = WEIERSTRASS_N;
+
+	const weierstrass_table &t = weierstrass_get_table();
+
 	double g = 0;
 
 	double r = hypot(x,y);
@@ -83,12 +119,12 @@ static inline double weierstrass(double x, double y, double phase = 0)
 
 	for (size_t m = 0; m < M; ++m) {
 		for (size_t n = 0; n < N; ++n) {
-			double phi_mn = phase + phi[m][n];
+			double phi_mn = phase + t.phi[m][n];
 
-			g += gammaD3n[n] * (cos_phi[m][n] - cos(TWOPI*gamman[n]*r*cos(tht - PI*(double)m/M)/L + phi_mn));
+			g += t.gammaD3n[n] * (t.cos_phi[m][n] - cos(TWOPI*t.gamman[n]*r*cos(tht - PI*(double)m/M)/L + phi_mn));
 		}
 	}
-	return A*g;
+	return t.A*g;
 
 }
 
@@ -9,11 +9,16 @@
 
 // STL
 #include <vector>
+#include <type_traits>
 
 // libc
 #include <cstdint>
 #include <cmath>
 
+#if defined(__BMI2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
 #ifndef PI
 #define PI 3.141592654
 #endif 
@@ -211,6 +216,77 @@ static inline double obb_dist_sq(const obb_t &obb, glm::dvec3 v)
 	return d;
 }
 
+/// @brief Tests whether a sphere of radius r about the origin blocks the line 
+/// of sight from eye to p.  Points inside the sphere are also occluded.
+static inline bool sphere_occludes(double r, glm::dvec3 eye, glm::dvec3 p)
+{
+	double r_sq = r*r;
+
+	if (dot(p,p) < r_sq)
+		return true;
+
+	glm::dvec3 d = p - eye;
+	double dd = dot(d,d);
+
+	if (dd <= 0)
+		return false;
+
+	// closest approach of the segment to the center
+	double t = -dot(eye,d)/dd;
+	if (t <= 0 || t >= 1)
+		return false;
+
+	glm::dvec3 c = eye + t*d;
+	return dot(c,c) < r_sq;
+}
+
+/// @brief Tests whether a sphere of radius r about the origin hides the whole 
+/// box from eye.  The occluded region is convex, so testing the corners is 
+/// enough.
+static inline bool obb_occluded(const obb_t &box, double r, glm::dvec3 eye)
+{
+	if (dot(eye,eye) <= r*r)
+		return false;
+
+	for (int i = 0; i < 8; ++i) {
+		glm::dvec3 p = box.O + 
+			box.T[0]*((i & 1) ? box.S.x : -box.S.x) + 
+			box.T[1]*((i & 2) ? box.S.y : -box.S.y) + 
+			box.T[2]*((i & 4) ? box.S.z : -box.S.z);
+
+		if (!sphere_occludes(r, eye, p))
+			return false;
+	}
+
+	return true;
+}
+
+//------------------------------------------------------------------------------
+// OBB batches
+
+static constexpr size_t OBB_BATCH_WIDTH = 4;
+
+/// @brief Structure-of-arrays layout of several boxes, for testing them 
+/// together.  T[j][k][i] is row k of column j of box i.
+struct obb_batch_t
+{
+	double T[3][3][OBB_BATCH_WIDTH];
+	double O[3][OBB_BATCH_WIDTH];
+	double S[3][OBB_BATCH_WIDTH];
+};
+
+/// @brief Packs up to OBB_BATCH_WIDTH boxes.  Unused lanes repeat the last box.
+extern void obb_batch_pack(obb_batch_t &batch, const obb_t *boxes, size_t count);
+
+/// @brief Batch version of classify against several planes.  Vectorized with
+/// AVX2 when available.
+/// @return Mask with bit i set if box i is entirely in front of any plane
+extern uint32_t obb_batch_cull(const obb_batch_t &batch, 
+							   const plane_t *planes, size_t plane_count);
+
+/// @brief Batch version of obb_dist_sq.  Writes OBB_BATCH_WIDTH values.
+extern void obb_batch_dist_sq(const obb_batch_t &batch, glm::dvec3 v, double *out);
+
 static inline bool intersects(const aabb2_t& box, const circle_t &circ)
 {
 	glm::dvec2 nearest = glm::clamp(circ.c, box.ll(),box.ur());
@@ -350,19 +426,19 @@ static inline uint_t hilbert_index_u32_f32(float_t xf, float_t yf, int n)
 	return code;
 }
 
-static inline constexpr uint64_t morton_u64(double x, double y, int level)
-{
-    double w = (double)(0x1 << level);
-
-    uint64_t px = (uint64_t)(x*w);
-    uint64_t py = (uint64_t)(y*w);
+static constexpr uint64_t MORTON_X_MASK = 0x5555555555555555;
+static constexpr uint64_t MORTON_Y_MASK = 0xAAAAAAAAAAAAAAAA;
 
+/// @brief Interleaves the lower `level` bits of px and py one bit at a time.
+/// Reference implementation; usable in constant expressions.
+static inline constexpr uint64_t morton_u64_encode_bits(uint64_t px, uint64_t py, int level)
+{
     uint64_t xi, yi; 
 
 	uint64_t index = 0;
 
     while(level--) {
-		uint64_t mask = 0x1 << level;
+		uint64_t mask = (uint64_t)0x1 << level;
 
 		xi = px & mask;
 		yi = py & mask;
@@ -376,30 +452,81 @@ static inline constexpr uint64_t morton_u64(double x, double y, int level)
     return index;
 }
 
-static constexpr aabb2_t morton_u64_to_rect_f64(uint64_t index, uint8_t level)
+/// @brief Inverse of morton_u64_encode_bits.
+static inline constexpr void morton_u64_decode_bits(uint64_t index, int level, 
+												  uint64_t *px, uint64_t *py)
 {
-    aabb2_t box = {};
+	uint64_t x = 0, y = 0;
+
+	for (int i = 0; i < level; ++i) {
+		x |= (index & 0x1) << i;
+		index >>= 1;
+		y |= (index & 0x1) << i;
+		index >>= 1;
+	}
+
+	*px = x;
+	*py = y;
+}
+
+static inline constexpr uint64_t morton_u64(double x, double y, int level)
+{
+    double w = (double)(0x1 << level);
+	uint64_t mask = ((uint64_t)0x1 << level) - 1;
+
+    uint64_t px = (uint64_t)(x*w) & mask;
+    uint64_t py = (uint64_t)(y*w) & mask;
 
+#ifdef __BMI2__
+	if (!std::is_constant_evaluated())
+		return _pdep_u64(px, MORTON_X_MASK) | _pdep_u64(py, MORTON_Y_MASK);
+#endif
+
+	return morton_u64_encode_bits(px, py, level);
+}
+
+static constexpr aabb2_t morton_u64_to_rect_f64(uint64_t index, uint8_t level)
+{
 	double h = 1.0/(double)(1 << level);
 
-	for (; level > 0; --level) {
-        uint8_t xi = index & 0x1;
-        index >>= 1;
-        uint8_t yi = index & 0x1;
-        index >>= 1;
+	uint64_t px = 0, py = 0;
 
-		double hi = 1.0/(double)(1 << level);
+#ifdef __BMI2__
+	if (!std::is_constant_evaluated()) {
+		index &= ((uint64_t)0x1 << 2*level) - 1;
+		px = _pext_u64(index, MORTON_X_MASK);
+		py = _pext_u64(index, MORTON_Y_MASK);
+	} else 
+#endif
+	morton_u64_decode_bits(index, level, &px, &py);
 
-        box.min.x += xi ? hi : 0.0;
-        box.min.y += yi ? hi : 0.0;
-	}
+    aabb2_t box = {};
 
+	box.min.x = (double)px*h;
+	box.min.y = (double)py*h;
 	box.max.x = box.min.x + h;
 	box.max.y = box.min.y + h;
 
     return box;
 }
 
+// Constant evaluation takes the bit-by-bit path, so these only check it.  The
+// BMI2 and batched paths are checked against it by the morton bench.
+static_assert(morton_u64(0.3, 0.7, 12) == morton_u64_encode_bits(
+	(uint64_t)(0.3*4096.0), (uint64_t)(0.7*4096.0), 12));
+static_assert(morton_u64_to_rect_f64(morton_u64(0.75, 0.25, 2), 2).min.x == 0.75);
+static_assert(morton_u64_to_rect_f64(morton_u64(0.75, 0.25, 2), 2).min.y == 0.25);
+
+/// @brief Batch version of morton_u64 for points sharing the same level. 
+/// Vectorized with AVX2 when available.  Requires level <= 28.
+extern void morton_u64_batch(const double *x, const double *y, size_t count, 
+							 int level, uint64_t *out);
+
+/// @brief Batch version of morton_u64_to_rect_f64. Levels may differ per 
+/// index. Vectorized with AVX2 when available.  Requires level <= 28.
+extern void morton_u64_to_rect_f64_batch(const uint64_t *index, 
+										 const uint8_t *level, size_t count, 
+										 aabb2_t *out);
 
 namespace geometry
 {
@@ -4,9 +4,428 @@
 
 #include <cassert>
 #include <cstdlib>
+#include <bit>
+#include <algorithm>
+#include <mutex>
 
-static int alc_create_page(alc_table *alc, alc_page *page)
+//------------------------------------------------------------------------------
+// Open addressing map
+
+static inline size_t alc_map_hash(uint64_t key)
+{
+	// splitmix64 finalizer; tile codes keep most of their entropy in the 
+	// upper bits
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ULL;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebULL;
+	key ^= key >> 31;
+	return (size_t)key;
+}
+
+static int alc_map_create(alc_map *map, size_t capacity)
+{
+	// Keep the load factor at or below one half
+	size_t count = std::bit_ceil(std::max(2*capacity, (size_t)16));
+
+	map->buckets = (alc_map_bucket*)calloc(count, sizeof(alc_map_bucket));
+	map->mask = count - 1;
+	map->size = 0;
+
+	return map->buckets ? 0 : -1;
+}
+
+static void alc_map_destroy(alc_map *map)
+{
+	free(map->buckets);
+	*map = {};
+}
+
+static size_t alc_map_lookup(const alc_map *map, uint64_t key)
+{
+	size_t i = alc_map_hash(key) & map->mask;
+
+	for (uint32_t dist = 1;; ++dist, i = (i + 1) & map->mask) {
+		const alc_map_bucket &b = map->buckets[i];
+
+		// The key would have displaced this bucket if it were present
+		if (b.dist < dist)
+			return SIZE_MAX;
+
+		if (b.key == key)
+			return i;
+	}
+}
+
+static uint32_t alc_map_find(const alc_map *map, uint64_t key)
+{
+	size_t i = alc_map_lookup(map, key);
+	return i == SIZE_MAX ? ALC_SLOT_NONE : map->buckets[i].slot;
+}
+
+static void alc_map_insert(alc_map *map, uint64_t key, uint32_t slot)
+{
+	assert(map->size < map->mask);
+
+	alc_map_bucket ins = {
+		.key = key,
+		.slot = slot,
+		.dist = 1
+	};
+
+	size_t i = alc_map_hash(key) & map->mask;
+
+	for (;; ++ins.dist, i = (i + 1) & map->mask) {
+		alc_map_bucket &b = map->buckets[i];
+
+		if (!b.dist) {
+			b = ins;
+			break;
+		}
+
+		// Take from the rich
+		if (b.dist < ins.dist)
+			std::swap(b, ins);
+	}
+
+	++map->size;
+}
+
+static bool alc_map_erase(alc_map *map, uint64_t key)
 {
+	size_t i = alc_map_lookup(map, key);
+	if (i == SIZE_MAX)
+		return false;
+
+	// Backward shift deletion, so there are no tombstones
+	for (;;) {
+		size_t next = (i + 1) & map->mask;
+		alc_map_bucket &b = map->buckets[next];
+
+		if (b.dist <= 1)
+			break;
+
+		map->buckets[i] = b;
+		--map->buckets[i].dist;
+		i = next;
+	}
+
+	map->buckets[i] = {};
+	--map->size;
+
+	return true;
+}
+
+//------------------------------------------------------------------------------
+// Shards
+
+static inline alc_shard *alc_key_shard(const alc_table *alc, uint64_t key)
+{
+	// The map takes the low bits of the hash, so shards use the high ones
+	uint64_t h = alc_map_hash(key) >> 32;
+	return &alc->shards[(h*alc->shard_count) >> 32];
+}
+
+static size_t alc_shard_capacity(const alc_table *alc, size_t i)
+{
+	return alc->capacity/alc->shard_count + (i < alc->capacity%alc->shard_count);
+}
+
+static inline alc_shard *alc_slot_shard(const alc_table *alc, uint32_t slot)
+{
+	return &alc->shards[slot/(alc->pages_per_shard*alc->page_size)];
+}
+
+//------------------------------------------------------------------------------
+// LRU
+
+static inline uint32_t alc_slot(const alc_table *alc, alc_index idx)
+{
+	return idx.page*(uint32_t)alc->page_size + idx.ent;
+}
+
+static inline alc_index alc_slot_index(const alc_table *alc, uint32_t slot)
+{
+	return alc_index{
+		.page = slot/(uint32_t)alc->page_size,
+		.ent = slot%(uint32_t)alc->page_size,
+	};
+}
+
+static inline alc_entry *alc_slot_entry(const alc_table *alc, uint32_t slot)
+{
+	return &alc->entries[slot];
+}
+
+static void alc_list_unlink(alc_table *alc, alc_list *list, uint32_t slot)
+{
+	alc_entry *ent = alc_slot_entry(alc, slot);
+
+	if (ent->prev != ALC_SLOT_NONE)
+		alc_slot_entry(alc, ent->prev)->next = ent->next;
+	else 
+		list->head = ent->next;
+
+	if (ent->next != ALC_SLOT_NONE)
+		alc_slot_entry(alc, ent->next)->prev = ent->prev;
+	else 
+		list->tail = ent->prev;
+
+	ent->prev = ALC_SLOT_NONE;
+	ent->next = ALC_SLOT_NONE;
+	--list->size;
+}
+
+static void alc_list_push_front(alc_table *alc, alc_list *list, uint32_t slot)
+{
+	alc_entry *ent = alc_slot_entry(alc, slot);
+
+	ent->prev = ALC_SLOT_NONE;
+	ent->next = list->head;
+
+	if (list->head != ALC_SLOT_NONE)
+		alc_slot_entry(alc, list->head)->prev = slot;
+	else 
+		list->tail = slot;
+
+	list->head = slot;
+	++list->size;
+}
+
+static void alc_list_move_front(alc_table *alc, alc_list *from, alc_list *to, 
+								uint32_t slot)
+{
+	if (from == to && to->head == slot)
+		return;
+
+	alc_list_unlink(alc, from, slot);
+	alc_list_push_front(alc, to, slot);
+}
+
+//------------------------------------------------------------------------------
+// Eviction policies
+//
+// LRU   : One list in recency order.
+// CLOCK : One list in insertion order.  A hit only sets the reference bit of
+//         the entry, and entries with it set get moved back to the front 
+//         instead of being evicted.
+// 2Q    : New entries start on a probation list in insertion order, which 
+//         hits do not change.  Keys evicted from it are remembered on a ghost
+//         list, and only a key found there goes on the main list, which is 
+//         kept in recency order, when it is inserted again.  While the 
+//         probation list is over its share of the shard it is evicted from 
+//         first, so one pass over new keys cannot flush the keys that are 
+//         used every frame, however often it requests them.
+//
+// With any policy, protected keys go on their own list in recency order.  It
+// is only evicted from while it is over its share of the shard, or when 
+// nothing else can be.
+
+// Share of a shard that protected keys may keep
+static constexpr size_t ALC_PROTECTED_DIV = 4;
+// Share of a shard the 2Q probation list may use before it is evicted from 
+// first
+static constexpr size_t ALC_2Q_PROBATION_DIV = 4;
+// Share of a shard's capacity the 2Q ghost list remembers keys for
+static constexpr size_t ALC_2Q_GHOST_DIV = 2;
+
+static void alc_ghost_pop(alc_shard *shard)
+{
+	uint32_t pos = shard->ghost_first;
+
+	// Keys inserted again were already erased, and may be in the ring twice
+	uint64_t key = shard->ghost_keys[pos];
+	if (alc_map_find(&shard->ghost, key) == pos)
+		alc_map_erase(&shard->ghost, key);
+
+	shard->ghost_first = (pos + 1) % shard->ghost_size;
+	--shard->ghost_count;
+}
+
+static void alc_ghost_push(alc_shard *shard, uint64_t key)
+{
+	size_t limit = std::min((size_t)shard->ghost_size, 
+						 shard->capacity/ALC_2Q_GHOST_DIV);
+
+	while (shard->ghost_count && shard->ghost_count >= limit)
+		alc_ghost_pop(shard);
+
+	if (!limit)
+		return;
+
+	uint32_t pos = (shard->ghost_first + shard->ghost_count) % shard->ghost_size;
+	shard->ghost_keys[pos] = key;
+	++shard->ghost_count;
+
+	alc_map_erase(&shard->ghost, key);
+	alc_map_insert(&shard->ghost, key, pos);
+}
+
+// @return true if key was on the ghost list, which it is then taken off
+static bool alc_ghost_take(alc_shard *shard, uint64_t key)
+{
+	return shard->ghost_keys && alc_map_erase(&shard->ghost, key);
+}
+
+static void alc_policy_insert(alc_table *alc, alc_shard *shard, uint32_t slot)
+{
+	alc_entry *ent = alc_slot_entry(alc, slot);
+
+	ent->clock = 0;
+
+	bool ghost = alc->policy == ALC_POLICY_2Q && alc_ghost_take(shard, ent->key);
+
+	if (alc->is_protected && alc->is_protected(alc->usr, ent->key))
+		ent->list = ALC_LIST_PROTECTED;
+	else if (alc->policy == ALC_POLICY_2Q && !ghost)
+		ent->list = ALC_LIST_PROBATION;
+	else 
+		ent->list = ALC_LIST_MAIN;
+
+	alc_list_push_front(alc, &shard->lists[ent->list], slot);
+}
+
+static void alc_policy_hit(alc_table *alc, alc_shard *shard, uint32_t slot)
+{
+	alc_entry *ent = alc_slot_entry(alc, slot);
+	alc_list *list = &shard->lists[ent->list];
+
+	if (ent->list == ALC_LIST_PROTECTED) {
+		alc_list_move_front(alc, list, list, slot);
+		return;
+	}
+
+	switch (alc->policy) {
+	case ALC_POLICY_LRU:
+		alc_list_move_front(alc, list, list, slot);
+		break;
+	case ALC_POLICY_CLOCK:
+		ent->clock = 1;
+		break;
+	case ALC_POLICY_2Q:
+		// Probation stays in insertion order
+		if (ent->list == ALC_LIST_MAIN)
+			alc_list_move_front(alc, list, list, slot);
+		break;
+	}
+}
+
+static void alc_policy_skip(alc_table *alc, alc_shard *shard, uint32_t slot)
+{
+	alc_entry *ent = alc_slot_entry(alc, slot);
+	alc_list *list = &shard->lists[ent->list];
+	alc_list_move_front(alc, list, list, slot);
+}
+
+static void alc_policy_remove(alc_table *alc, alc_shard *shard, uint32_t slot)
+{
+	alc_entry *ent = alc_slot_entry(alc, slot);
+	alc_list_unlink(alc, &shard->lists[ent->list], slot);
+
+	if (ent->list == ALC_LIST_PROBATION)
+		alc_ghost_push(shard, ent->key);
+}
+
+// @return Next entry to try evicting
+static uint32_t alc_policy_victim(alc_table *alc, alc_shard *shard)
+{
+	alc_list *probation = &shard->lists[ALC_LIST_PROBATION];
+	alc_list *main = &shard->lists[ALC_LIST_MAIN];
+	alc_list *prot = &shard->lists[ALC_LIST_PROTECTED];
+
+	if (prot->size > shard->capacity/ALC_PROTECTED_DIV || 
+		probation->size + main->size == 0)
+		return prot->tail;
+
+	switch (alc->policy) {
+	case ALC_POLICY_LRU:
+		return main->tail;
+	case ALC_POLICY_CLOCK:
+		// Every entry passed loses its reference bit, so this ends within 
+		// one pass over the list
+		while (main->tail != ALC_SLOT_NONE) {
+			uint32_t slot = main->tail;
+			alc_entry *ent = alc_slot_entry(alc, slot);
+
+			if (!ent->clock)
+				return slot;
+
+			ent->clock = 0;
+			alc_list_move_front(alc, main, main, slot);
+		}
+		return ALC_SLOT_NONE;
+	case ALC_POLICY_2Q:
+		if (!main->size || probation->size > shard->capacity/ALC_2Q_PROBATION_DIV)
+			return probation->size ? probation->tail : main->tail;
+		return main->tail;
+	}
+
+	return ALC_SLOT_NONE;
+}
+
+void alc_touch(alc_table *alc, alc_index idx)
+{
+	uint32_t slot = alc_slot(alc, idx);
+	alc_shard *shard = alc_slot_shard(alc, slot);
+
+	std::lock_guard<alc_lock> lock(shard->lock);
+	alc_policy_hit(alc, shard, slot);
+}
+
+alc_index alc_find(const alc_table *alc, uint64_t key)
+{
+	alc_shard *shard = alc_key_shard(alc, key);
+
+	std::lock_guard<alc_lock> lock(shard->lock);
+	uint32_t slot = alc_map_find(&shard->map, key);
+
+	return slot == ALC_SLOT_NONE ? ALC_INDEX_NONE : alc_slot_index(alc, slot);
+}
+
+bool alc_touch_ready(alc_table *alc, uint64_t key)
+{
+	alc_shard *shard = alc_key_shard(alc, key);
+
+	std::lock_guard<alc_lock> lock(shard->lock);
+	uint32_t slot = alc_map_find(&shard->map, key);
+
+	if (slot == ALC_SLOT_NONE)
+		return false;
+
+	alc_entry *ent = alc_slot_entry(alc, slot);
+	if (alc_state_status(ent->state.load()) != ALC_STATUS_READY)
+		return false;
+
+	alc_policy_hit(alc, shard, slot);
+	return true;
+}
+
+alc_entry *alc_find_ready(const alc_table *alc, uint64_t key, uint16_t *p_gen)
+{
+	alc_shard *shard = alc_key_shard(alc, key);
+
+	std::lock_guard<alc_lock> lock(shard->lock);
+	uint32_t slot = alc_map_find(&shard->map, key);
+
+	if (slot == ALC_SLOT_NONE)
+		return nullptr;
+
+	alc_entry *ent = alc_slot_entry(alc, slot);
+	uint64_t state = ent->state.load();
+	if (alc_state_status(state) != ALC_STATUS_READY)
+		return nullptr;
+
+	*p_gen = alc_state_gen(state);
+	return ent;
+}
+
+//------------------------------------------------------------------------------
+// Table
+
+static int alc_create_page(alc_table *alc, uint32_t page_idx)
+{
+	alc_page *page = &alc->pages[page_idx];
+
 	size_t size = alc->page_size;
 	page->free_list.resize(size);
 
@@ -14,25 +433,48 @@ static int alc_create_page(alc_table *alc, alc_page *page)
 		page->free_list[i] = static_cast<uint32_t>(size - i - 1);
 	}
 
-	page->entries = (alc_entry*)calloc(size, sizeof(alc_entry));
+	page->entries = alc->entries + page_idx*size;
+
+	if (alc->page_create(alc->usr, page_idx, &page->handle) < 0)
+		return -1;
 
-	return alc->page_create(alc->usr, &page->handle);
+	page->created = true;
+	++alc->page_count;
+
+	return 0;
 }
 
-static alc_index alc_allocate(alc_table *alc)
+static void alc_destroy_page(alc_table *alc, uint32_t page_idx)
 {
-	if (alc->open_pages.empty()) {
-		alc->pages.emplace_back();
+	alc_page *page = &alc->pages[page_idx];
+
+	alc->page_destroy(alc->usr, page->handle);
+
+	page->created = false;
+	page->handle = 0;
+	page->free_list = {};
+	--alc->page_count;
+}
+
+static alc_index alc_allocate(alc_table *alc, alc_shard *shard)
+{
+	if (shard->open_pages.empty()) {
+		uint32_t page = shard->page_first;
+		while (page < shard->page_limit && alc->pages[page].created)
+			++page;
+
+		if (page == shard->page_limit)
+			return ALC_INDEX_NONE;
 
-		if (alc_create_page(alc, &alc->pages.back()) < 0)
+		if (alc_create_page(alc, page) < 0)
 			return ALC_INDEX_NONE;
 
-		alc->open_pages.push(static_cast<uint16_t>(alc->pages.size() - 1));
+		shard->open_pages.push(static_cast<uint16_t>(page));
 	}
 	
-	uint16_t page = alc->open_pages.top(); 
+	uint16_t page = shard->open_pages.top(); 
 
-	assert(page < alc->pages.size());
+	assert(page < shard->page_end);
 
 	alc_page *p_page = &alc->pages[page];
 
@@ -43,7 +485,7 @@ static alc_index alc_allocate(alc_table *alc)
 	p_page->free_list.pop_back();
 
 	if (p_page->free_list.empty()) {
-		alc->open_pages.pop();
+		shard->open_pages.pop();
 	}
 
 	return alc_index{
@@ -52,66 +494,123 @@ static alc_index alc_allocate(alc_table *alc)
 	};
 }
 
-static alc_index alc_evict_one(alc_table *alc)
+static void alc_deallocate(alc_table *alc, alc_shard *shard, uint32_t slot)
 {
-	alc_index idx = alc->lru.back(); 
-	alc_entry *ent = &alc->pages[idx.page].entries[idx.ent];
+	alc_index idx = alc_slot_index(alc, slot);
+	alc_page *page = &alc->pages[idx.page];
 
-	uint64_t state_packed = ent->state.load(std::memory_order_relaxed);
-	alc_state desired = {
-		.status = ALC_STATUS_EMPTY, 
-		.flags = 0,
-		.gen = 0,
-		.refs = 0
-	};
+	page->free_list.push_back(idx.ent);
+
+	if (page->free_list.size() == 1 && idx.page < shard->page_limit)
+		shard->open_pages.push(static_cast<uint16_t>(idx.page));
+}
+
+// Entries with references are skipped when evicting, up to this many
+static constexpr int ALC_EVICT_MAX_SCAN = 16;
 
+// @return true if the entry was not referenced and is now empty
+static bool alc_state_evict(alc_atomic_state *p_state)
+{
+	uint64_t state_pkd = p_state->load(std::memory_order_relaxed);
+	alc_state desired;
 	do {
-		alc_state state = alc_state_unpack(state_packed);
-		if (state.refs > 0) {
-			log_info("Could not evialc entry %d from cache; in use",ent->key);
-			return ALC_INDEX_NONE;
-		}
+		desired = alc_state_unpack(state_pkd);
+		if (desired.refs > 0) 
+			return false;
+
+		// A queued load fails once it sees the new generation, but one that
+		// already started has to finish writing first
+		if (desired.status == ALC_STATUS_LOADING)
+			desired.flags |= ALC_FLAG_STALE_LOADER;
+
+		desired.status = ALC_STATUS_EMPTY;
+		++desired.gen;
+	} while (!p_state->compare_exchange_weak(state_pkd, alc_state_pack(desired),
+											std::memory_order_acq_rel, std::memory_order_relaxed));
 
-		if (state.status == ALC_STATUS_CANCELLED) {
-			return ALC_INDEX_NONE;
-		}
+	return true;
+}
 
-		if (state.status == ALC_STATUS_LOADING || 
-			state.status == ALC_STATUS_QUEUED)
-			desired = {
-				.status = ALC_STATUS_CANCELLED, 
-				.flags = 0,
-				.gen = 0,
-				.refs = state.refs
-			};
-		else 
-			desired = {
-				.status = ALC_STATUS_EMPTY,
-				.flags = 0,
-				.gen = 0,
-				.refs = 0
-			};
-	} while (!ent->state.compare_exchange_weak(state_packed, alc_state_pack(desired),
+// @return true if the entry was neither referenced nor being written to, 
+// and is now empty
+static bool alc_state_evict_idle(alc_atomic_state *p_state)
+{
+	uint64_t state_pkd = p_state->load(std::memory_order_relaxed);
+	alc_state desired;
+	do {
+		desired = alc_state_unpack(state_pkd);
+		if (desired.refs > 0 || desired.status == ALC_STATUS_LOADING ||
+			(desired.flags & ALC_FLAG_STALE_LOADER))
+			return false;
+
+		desired.status = ALC_STATUS_EMPTY;
+		++desired.gen;
+	} while (!p_state->compare_exchange_weak(state_pkd, alc_state_pack(desired),
 											std::memory_order_acq_rel, std::memory_order_relaxed));
-	
-	uint64_t key = ent->key;
-		
-	if (desired.status == ALC_STATUS_CANCELLED) {
-		log_info("Cancelled load for entry %d",ent->key);
-		return ALC_INDEX_NONE;
+
+	return true;
+}
+
+// @return true if the entry was not in use and is now evicted
+static bool alc_evict_slot(alc_table *alc, alc_shard *shard, uint32_t slot)
+{
+	alc_entry *ent = alc_slot_entry(alc, slot);
+
+	if (!alc_state_evict(&ent->state)) {
+		// In use, so treat it as recently used
+		alc_policy_skip(alc, shard, slot);
+		return false;
 	}
 
-	if (alc->map.find(key) == alc->map.end()) {
+	if (!alc_map_erase(&shard->map, ent->key))
 		log_error("Failed to evict entry at %d; not contained in table!",ent->key);
-		return ALC_INDEX_NONE;
-	}
 
 	//log_info("Evialced tile %d from CPU cache",ent->code);
 
-	alc->map.erase(key);	
-	alc->lru.pop_back();
+	alc_policy_remove(alc, shard, slot);
+
+	return true;
+}
+
+static alc_index alc_evict_one(alc_table *alc, alc_shard *shard)
+{
+	for (int i = 0; i < ALC_EVICT_MAX_SCAN; ++i) {
+		uint32_t slot = alc_policy_victim(alc, shard);
+		if (slot == ALC_SLOT_NONE)
+			break;
+
+		if (alc_evict_slot(alc, shard, slot))
+			return alc_slot_index(alc, slot);
+	}
+
+	// Everything the policy offered is in use, so protected entries are 
+	// evicted before giving up
+	alc_list *prot = &shard->lists[ALC_LIST_PROTECTED];
+	for (int i = 0; i < ALC_EVICT_MAX_SCAN && prot->tail != ALC_SLOT_NONE; ++i) {
+		uint32_t slot = prot->tail;
+		if (alc_evict_slot(alc, shard, slot))
+			return alc_slot_index(alc, slot);
+	}
 
-	return idx;
+	log_info("Could not evict from cache; the last %d entries are in use",
+		ALC_EVICT_MAX_SCAN);
+	return ALC_INDEX_NONE;
+}
+
+// @brief Evicts an entry if the shard is full, otherwise allocates one.  
+// Entries evicted from pages past page_limit are freed instead of reused, so
+// that the pages empty out for alc_trim.
+static alc_index alc_reserve(alc_table *alc, alc_shard *shard)
+{
+	while (shard->map.size >= shard->capacity) {
+		alc_index idx = alc_evict_one(alc, shard);
+		if (!idx.is_valid() || idx.page < shard->page_limit)
+			return idx;
+
+		alc_deallocate(alc, shard, alc_slot(alc, idx));
+	}
+
+	return alc_allocate(alc, shard);
 }
 
 alc_result alc_get(alc_table *alc, uint64_t key)
@@ -119,61 +618,54 @@ alc_result alc_get(alc_table *alc, uint64_t key)
 	// note that 'needs_load' and 'is_ready' are false by default
 	alc_result res {};
 
-	auto it = alc->map.find(key);
-	if (it != alc->map.end()) {
+	alc_shard *shard = alc_key_shard(alc, key);
+	std::lock_guard<alc_lock> lock(shard->lock);
 
-		// Move to front if key is found
-		alc_lru_list::iterator l_ent = it->second;
-		alc->lru.splice(alc->lru.begin(), alc->lru, l_ent);
+	uint32_t slot = alc_map_find(&shard->map, key);
+	if (slot != ALC_SLOT_NONE) {
+		alc_policy_hit(alc, shard, slot);
 
-		alc_index idx = *it->second;
-		alc_entry *ent = &alc->pages[idx.page].entries[idx.ent];
+		alc_entry *ent = alc_slot_entry(alc, slot);
 		alc_state state = alc_state_unpack(ent->state.load()); 
 
 		res.p_ent = ent;
+		res.gen = state.gen;
 
 		if (state.status == ALC_STATUS_EMPTY) {
 			if (state.refs > 0) 
 				log_error("Empty entry has %d references",state.refs);
 
-			res.idx = idx;
+			res.idx = alc_slot_index(alc, slot);
 			res.needs_load = true;
 
 		} else if (state.status == ALC_STATUS_READY) {
 			res.is_ready = true;
 		}
 	} else {
-		alc_index idx = alc->map.size() >= alc->capacity ?
-	  		alc_evict_one(alc) : alc_allocate(alc);
+		alc_index idx = alc_reserve(alc, shard);
 
 		if (!idx.is_valid()) 
 			return res;
 
-		alc->lru.push_front(idx);
-		alc->map[key] = alc->lru.begin();
+		slot = alc_slot(alc, idx);
+
+		alc_entry *ent = alc_entry_get(alc, idx);
+		ent->key = key;
 
-		alc_entry *ent = &alc->pages[idx.page].entries[idx.ent];
-		ent->key = key,
-		ent->state = alc_state_pack({
-			.status = ALC_STATUS_EMPTY, 
-			.flags = 0,
-			.gen = 0,
-			.refs = 0
-		}),
+		alc_policy_insert(alc, shard, slot);
+		alc_map_insert(&shard->map, key, slot);
 
+		// Already empty, either new or just evicted.  The generation is kept
+		// so that loaders for the old key can tell.
 		res.idx = idx;
 		res.p_ent = ent;
+		res.gen = alc_state_gen(ent->state.load());
 		res.needs_load = true;
 	}
 
 	return res;
 }
 
-static alc_entry * alc_entry_get(alc_table *ct, alc_index idx)
-{
-	return &ct->pages[idx.page].entries[idx.ent];
-}
-
 int alc_create(alc_table **p_alc, alc_params const *ci)
 {
 	alc_table *alc = new alc_table {};
@@ -182,54 +674,122 @@ int alc_create(alc_table **p_alc, alc_params const *ci)
 	alc->page_destroy = ci->page_destroy;
 	alc->page_size = ci->page_size;
 	alc->capacity = ci->capacity;
+	alc->max_capacity = ci->capacity;
 	alc->usr = ci->usr;
+	alc->policy = ci->policy;
+	alc->is_protected = ci->is_protected;
 
-	*p_alc = alc;
+	// Every shard needs room for at least one entry
+	alc->shard_count = std::clamp(ci->shard_count, (size_t)1, 
+							   std::max(alc->capacity, (size_t)1));
 
-	return 0;
-}
+	size_t shard_cap = (alc->capacity + alc->shard_count - 1)/alc->shard_count;
+	alc->pages_per_shard = (shard_cap + alc->page_size - 1)/alc->page_size;
 
-void alc_destroy(alc_table *alc)
-{
-	for (auto [key, val] : alc->map) {
-		alc_index idx = *val;
-		alc_entry *ent = alc_entry_get(alc, idx);
+	// Page slots for all shards are reserved up front, so that the vector 
+	// never moves while another shard reads from it
+	alc->pages.resize(alc->shard_count*alc->pages_per_shard);
+
+	// Entries for every page are allocated up front as well, so that the LRU
+	// can follow links by slot without going through the page
+	alc->entries = (alc_entry*)calloc(alc->pages.size()*alc->page_size, 
+								   sizeof(alc_entry));
+	if (!alc->entries)
+		goto alc_create_failed;
+
+	alc->shards = new alc_shard[alc->shard_count]();
+
+	for (size_t i = 0; i < alc->shard_count; ++i) {
+		alc_shard *shard = &alc->shards[i];
+
+		for (alc_list &list : shard->lists)
+			list = {ALC_SLOT_NONE, ALC_SLOT_NONE, 0};
 
-		uint64_t state = ent->state.load(std::memory_order_relaxed);
+		shard->capacity = alc_shard_capacity(alc, i);
 
-		alc_state desired;
-		do {
-			desired = alc_state_unpack(state);
+		shard->page_first = (uint32_t)(i*alc->pages_per_shard);
+		shard->page_end = (uint32_t)((i + 1)*alc->pages_per_shard);
+		shard->page_limit = shard->page_end;
 
-			if (desired.status != ALC_STATUS_LOADING && 
-				desired.status != ALC_STATUS_CANCELLED
-			)
-				break;
-			else 
-				desired.status = ALC_STATUS_CANCELLED;
-		} while (!ent->state.compare_exchange_weak(state, alc_state_pack(desired)));
+		if (alc_map_create(&shard->map, shard->capacity) < 0)
+			goto alc_create_failed;
 
-		if (desired.status == ALC_STATUS_CANCELLED) {
-			ent->state.wait(alc_state_pack(desired));
+		if (alc->policy == ALC_POLICY_2Q) {
+			shard->ghost_size = (uint32_t)std::max(
+				shard->capacity/ALC_2Q_GHOST_DIV, (size_t)1);
+			shard->ghost_keys = (uint64_t*)calloc(shard->ghost_size, sizeof(uint64_t));
+
+			if (!shard->ghost_keys || 
+				alc_map_create(&shard->ghost, shard->ghost_size) < 0)
+				goto alc_create_failed;
 		}
 	}
 
-	for (alc_page &page : alc->pages) {
-		alc->page_destroy(alc->usr,page.handle);
-		free(page.entries);
+	*p_alc = alc;
+
+	return 0;
+
+alc_create_failed:
+	if (alc->shards) {
+		for (size_t i = 0; i < alc->shard_count; ++i) {
+			alc_map_destroy(&alc->shards[i].map);
+			alc_map_destroy(&alc->shards[i].ghost);
+			free(alc->shards[i].ghost_keys);
+		}
+		delete[] alc->shards;
 	}
+
+	free(alc->entries);
+	delete alc;
+	return -1;
+}
+
+void alc_destroy(alc_table *alc)
+{
+	for (size_t s = 0; s < alc->shard_count; ++s) {
+		alc_shard *shard = &alc->shards[s];
+
+		for (uint32_t p = shard->page_first; p < shard->page_end; ++p) {
+			if (!alc->pages[p].created)
+				continue;
+
+			// Loaders still write to the page, including ones for a key that
+			// was evicted
+			for (uint32_t i = 0; i < alc->page_size; ++i) {
+				alc_entry *ent = &alc->pages[p].entries[i];
+
+				uint64_t state = ent->state.load();
+				while (alc_state_status(state) == ALC_STATUS_LOADING ||
+					   (alc_state_flags(state) & ALC_FLAG_STALE_LOADER)) {
+					ent->state.wait(state);
+					state = ent->state.load();
+				}
+			}
+
+			alc_destroy_page(alc, p);
+		}
+
+		alc_map_destroy(&shard->map);
+		alc_map_destroy(&shard->ghost);
+		free(shard->ghost_keys);
+	}
+
+	delete[] alc->shards;
+	free(alc->entries);
 	delete alc;
 }
 
 alc_entry *alc_acquire(alc_table *alc, uint64_t key)
 {
-	auto it = alc->map.find(key);
-	if (it == alc->map.end()) {
+	alc_shard *shard = alc_key_shard(alc, key);
+	std::lock_guard<alc_lock> lock(shard->lock);
+
+	uint32_t slot = alc_map_find(&shard->map, key);
+	if (slot == ALC_SLOT_NONE) {
 		return nullptr;
 	}
 
-	alc_index idx = *it->second;
-	alc_entry *ent = alc_entry_get(alc,idx);
+	alc_entry *ent = alc_slot_entry(alc, slot);
 
 	uint64_t state = ent->state.load(std::memory_order_relaxed);
 	alc_state desired;
@@ -246,24 +806,8 @@ alc_entry *alc_acquire(alc_table *alc, uint64_t key)
 }
 void alc_release(alc_entry *ent)
 {
-	uint64_t state = ent->state.load(std::memory_order_relaxed);
-	uint64_t desired;
-	do {
-		uint32_t refs = alc_state_refs(state); 
-
-		if (!refs) {
-			log_error("alc_release : refcount is zero");
-			refs = 1;
-		}
-
-		desired = alc_state_pack({
-			.status = ALC_STATUS_READY, 
-			.flags = 0,
-			.gen = 0,
-			.refs = refs - 1
-		});
-	} while (!ent->state.compare_exchange_weak(state, desired, std::memory_order_relaxed));
-
+	if (!alc_state_dec_ref(&ent->state))
+		log_error("alc_release : refcount is zero");
 }
 
 //------------------------------------------------------------------------------
@@ -277,3 +821,103 @@ static_assert(alc_state_unpack(alc_state_pack(alc_state_test_val)).gen == alc_st
 static_assert(alc_state_unpack(alc_state_pack(alc_state_test_val)).refs == alc_state_test_val.refs);
 static_assert(alc_state_pack(alc_state_unpack(0xDEADBEEF)) == 0xDEADBEEF);
 
+
+//------------------------------------------------------------------------------
+// Capacity
+
+// Loaders of evicted entries can still be writing to the page
+static bool alc_page_idle(const alc_table *alc, uint32_t page)
+{
+	for (uint32_t ent = 0; ent < alc->page_size; ++ent) {
+		uint64_t state = alc->pages[page].entries[ent].state.load();
+		if (alc_state_status(state) == ALC_STATUS_LOADING ||
+			(alc_state_flags(state) & ALC_FLAG_STALE_LOADER))
+			return false;
+	}
+	return true;
+}
+
+// @brief Empties and destroys pages past page_limit, then evicts down to the
+// shard's capacity.  The shard must be locked.
+static void alc_shard_trim(alc_table *alc, alc_shard *shard)
+{
+	bool done = true;
+
+	for (uint32_t p = shard->page_limit; p < shard->page_end; ++p) {
+		alc_page *page = &alc->pages[p];
+		if (!page->created)
+			continue;
+
+		for (uint32_t ent = 0; ent < alc->page_size; ++ent) {
+			uint32_t slot = p*(uint32_t)alc->page_size + ent;
+			alc_entry *e = alc_slot_entry(alc, slot);
+
+			// Free entries keep the key they last had
+			if (alc_map_find(&shard->map, e->key) != slot)
+				continue;
+
+			if (!alc_state_evict_idle(&e->state))
+				continue;
+
+			alc_map_erase(&shard->map, e->key);
+			alc_policy_remove(alc, shard, slot);
+			page->free_list.push_back(ent);
+		}
+
+		if (page->free_list.size() == alc->page_size && alc_page_idle(alc, p))
+			alc_destroy_page(alc, p);
+		else
+			done = false;
+	}
+
+	while (shard->map.size > shard->capacity) {
+		alc_index idx = alc_evict_one(alc, shard);
+		if (!idx.is_valid()) {
+			done = false;
+			break;
+		}
+		alc_deallocate(alc, shard, alc_slot(alc, idx));
+	}
+
+	shard->needs_trim = !done;
+}
+
+void alc_set_capacity(alc_table *alc, size_t capacity)
+{
+	capacity = std::clamp(capacity, alc->shard_count, alc->max_capacity);
+
+	alc->capacity = capacity;
+
+	for (size_t i = 0; i < alc->shard_count; ++i) {
+		alc_shard *shard = &alc->shards[i];
+		std::lock_guard<alc_lock> lock(shard->lock);
+
+		shard->capacity = alc_shard_capacity(alc, i);
+
+		size_t pages = (shard->capacity + alc->page_size - 1)/alc->page_size;
+		shard->page_limit = shard->page_first + (uint32_t)pages;
+
+		// Pages that were past the old limit can take entries again, and 
+		// ones past the new limit no longer do
+		shard->open_pages = {};
+		for (uint32_t p = shard->page_first; p < shard->page_limit; ++p) {
+			const alc_page &page = alc->pages[p];
+			if (page.created && !page.free_list.empty())
+				shard->open_pages.push(static_cast<uint16_t>(p));
+		}
+
+		alc_shard_trim(alc, shard);
+	}
+}
+
+void alc_trim(alc_table *alc)
+{
+	for (size_t i = 0; i < alc->shard_count; ++i) {
+		alc_shard *shard = &alc->shards[i];
+		if (!shard->needs_trim.load(std::memory_order_relaxed))
+			continue;
+
+		std::lock_guard<alc_lock> lock(shard->lock);
+		alc_shard_trim(alc, shard);
+	}
+}
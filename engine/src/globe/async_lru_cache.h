@@ -3,10 +3,9 @@
 
 #include <atomic>
 #include <vector>
-#include <list>
 #include <queue>
-#include <unordered_map>
 #include <functional>
+#include <thread>
 
 #include <cstddef>
 #include <cstdint>
@@ -17,13 +16,18 @@ enum alc_status : uint8_t
 	ALC_STATUS_READY,
 	ALC_STATUS_LOADING,
 	ALC_STATUS_QUEUED,
-	ALC_STATUS_CANCELLED,
 };
 
+// A loader was still writing to the entry when it was evicted.  The entry can
+// be reused, but not loaded into until that loader is done.
+static const uint8_t ALC_FLAG_STALE_LOADER = 0x1;
+
 struct alignas(8) alc_state
 {
 	uint8_t status;
 	uint8_t flags;
+	// Incremented every time the entry is evicted, so that a loader can tell
+	// whether the entry it was given still holds the same key
 	uint16_t gen;
 	uint32_t refs;
 };
@@ -100,26 +104,48 @@ struct alc_index
 	}
 };
 
-struct alc_index_hash
-{
-	size_t operator()(const alc_index& idx) const {
-		uint64_t u64 = ((uint64_t)idx.page << 32) | (uint64_t)(idx.ent);
-		return std::hash<uint64_t>()(u64);
-	}
-};
-
 static const alc_index ALC_INDEX_NONE = {UINT32_MAX, UINT32_MAX};
 
+// Entries are also numbered by slot = page*page_size + ent, which is what the
+// LRU links and the map store.
+static const uint32_t ALC_SLOT_NONE = UINT32_MAX;
+
 typedef uint64_t alc_page_handle_t;
 typedef std::atomic_uint64_t alc_atomic_state;
-typedef int(*alc_page_create)(void*, alc_page_handle_t*);
+// Pages are numbered from zero up to the capacity the table was created 
+// with, and a page may be destroyed and created again when the capacity 
+// changes
+typedef int(*alc_page_create)(void*, uint32_t page, alc_page_handle_t*);
 typedef int(*alc_page_destroy)(void*, alc_page_handle_t);
-typedef std::list<alc_index> alc_lru_list;
+typedef bool(*alc_key_protected)(void*, uint64_t);
+
+enum alc_policy : uint8_t
+{
+	ALC_POLICY_LRU,
+	ALC_POLICY_CLOCK,
+	ALC_POLICY_2Q,
+};
+
+enum alc_list_id : uint8_t
+{
+	ALC_LIST_MAIN,
+	ALC_LIST_PROBATION,
+	ALC_LIST_PROTECTED,
+	ALC_LIST_COUNT
+};
 
 struct alc_entry 
 {
 	uint64_t key;
 	alc_atomic_state state;
+
+	// Eviction list links, only touched with the shard locked
+	uint32_t prev;
+	uint32_t next;
+
+	// Eviction policy state, see async_lru_cache.cpp
+	uint8_t list;
+	uint8_t clock;
 };
 
 struct alc_page
@@ -127,12 +153,16 @@ struct alc_page
 	alc_page_handle_t handle;
 	std::vector<uint32_t> free_list;
 	alc_entry *entries;
+	bool created;
 };
 
 struct alc_result
 {
 	alc_index idx;
 	alc_entry *p_ent;
+	// Generation of the entry when it was looked up, for the alc_state_set_*
+	// functions
+	uint16_t gen;
 	bool needs_load;
 	bool is_ready;
 };
@@ -141,10 +171,18 @@ struct alc_params
 {
 	size_t capacity;
 	size_t page_size;
+	// Keys are split over this many independently locked shards, each with
+	// its own LRU order and an equal share of the capacity.  Zero means one.
+	size_t shard_count;
 
 	void *usr;
 	alc_page_create page_create;
 	alc_page_destroy page_destroy;
+
+	alc_policy policy;
+	// Optional.  Keys it returns true for are only evicted while they take up
+	// more than a quarter of a shard, or if nothing else can be.
+	alc_key_protected is_protected;
 };
 
 struct alc_table;
@@ -152,85 +190,271 @@ struct alc_table;
 extern int alc_create(alc_table **p_alc, alc_params const *ci);
 extern void alc_destroy(alc_table *alc);
 
+// All functions below are thread safe.  They lock the shard the key or entry
+// belongs to, and page_create may be called from any thread that calls 
+// alc_get.
+
 /// @brief If key does not exist in the table, attempts to evict an existing 
 /// entry and allocate space for the new value.  If the key exists, the result
 /// will indicate whether it is ready.  If the key did not exist but an entry
 /// was reserved, the result will always indicate that a load is needed.
 ///
-/// @note This function is not thread safe. 
+/// @note Once the shard is unlocked the entry may be evicted and reused, so 
+/// claim it with alc_state_set_queued and the returned generation before 
+/// loading into it.
 extern alc_result alc_get(alc_table *alc, uint64_t key);
 
+/// @return Index of the entry for key, or ALC_INDEX_NONE.  Does not change 
+/// the LRU order.
+/// @note Unless the caller holds a reference, the entry may be evicted and 
+/// reused for another key as soon as this returns.
+extern alc_index alc_find(const alc_table *alc, uint64_t key);
+
+/// @brief Marks an entry as most recently used
+extern void alc_touch(alc_table *alc, alc_index idx);
+
+/// @brief Marks the entry for key as most recently used if it is ready
+/// @return true if the entry exists and is ready
+extern bool alc_touch_ready(alc_table *alc, uint64_t key);
+
+/// @return The entry for key if it is ready, or null.  Does not change the
+/// LRU order.
+/// @note The entry may be evicted as soon as this returns, which changes its
+/// generation from the one written to p_gen.
+extern alc_entry *alc_find_ready(const alc_table *alc, uint64_t key, uint16_t *p_gen);
+
 extern alc_entry *alc_acquire(alc_table *alc, uint64_t key);
 extern void alc_release(alc_entry *ent);
 
-struct alc_table
+/// @brief Changes the capacity, up to the one the table was created with.  
+/// When shrinking, entries are evicted until every shard is within its share,
+/// and pages that are no longer needed are destroyed.  
+/// @note Entries in pages past the new end are evicted first, whatever their
+/// place in the LRU order.  Ones that are referenced or loading keep their
+/// page until a later alc_trim.
+extern void alc_set_capacity(alc_table *alc, size_t capacity);
+
+/// @brief Retries destroying pages alc_set_capacity could not.  Cheap when 
+/// there are none.
+extern void alc_trim(alc_table *alc);
+
+//------------------------------------------------------------------------------
+// Open addressing map
+
+struct alc_map_bucket
 {
-	alc_lru_list lru;
+	uint64_t key;
+	uint32_t slot;
+	// Distance from the home bucket plus one, or zero if the bucket is empty
+	uint32_t dist;
+};
+
+// @brief Robin hood hash map from keys to slots.  Sized once for the table
+// capacity, so it never allocates after creation.
+struct alc_map
+{
+	alc_map_bucket *buckets;
+	size_t mask;
+	size_t size;
+};
+
+// @brief Test and test-and-set lock.  Shards are only held for a few map and
+// list operations, which is cheaper to spin on than to park in a mutex.
+struct alc_lock
+{
+	std::atomic_bool locked;
+
+	void lock() {
+		while (locked.exchange(true, std::memory_order_acquire)) {
+			while (locked.load(std::memory_order_relaxed))
+				std::this_thread::yield();
+		}
+	}
+
+	void unlock() {
+		locked.store(false, std::memory_order_release);
+	}
+};
+
+// @brief Doubly linked list threaded through alc_entry::prev/next
+struct alc_list
+{
+	uint32_t head;
+	uint32_t tail;
+	size_t size;
+};
+
+struct alignas(64) alc_shard
+{
+	alc_lock lock;
 
-	std::unordered_map<
-		uint64_t, 
-		alc_lru_list::iterator 
-	> map;
+	// Slots in eviction order, the tail is evicted first
+	alc_list lists[ALC_LIST_COUNT];
 
+	alc_map map;
+
+	// 2Q only.  Keys recently evicted from probation, oldest first, in a ring
+	// of ghost_size keys.  ghost maps each key to its place in the ring.
+	alc_map ghost;
+	uint64_t *ghost_keys;
+	uint32_t ghost_size;
+	uint32_t ghost_first;
+	uint32_t ghost_count;
+
+	// Created pages below page_limit with free entries.  The lowest page is
+	// filled first, so that the highest ones empty out when there is room.
 	std::priority_queue<
 		uint16_t, 
 		std::vector<uint16_t>, 
 		std::greater<uint16_t>
 	> open_pages;
 
+	// Pages from page_first up to page_limit may be used, the ones after it
+	// up to page_end are only there for a larger capacity
+	uint32_t page_first;
+	uint32_t page_limit;
+	uint32_t page_end;
+
+	size_t capacity;
+
+	// Pages past page_limit still have entries in use
+	std::atomic_bool needs_trim;
+};
+
+struct alc_table
+{
+	alc_shard *shards;
+	size_t shard_count;
+	size_t pages_per_shard;
+
+	// Entries of all pages, indexed by slot
+	alc_entry *entries;
+
+	// Shard i owns pages [i*pages_per_shard, (i + 1)*pages_per_shard).  Never
+	// resized after creation.
 	std::vector<alc_page> pages;
 
 	size_t page_size;
 	size_t capacity;
+	// Capacity the table was created with, which it cannot grow past
+	size_t max_capacity;
+
+	std::atomic_size_t page_count;
 
 	void *usr;
 	alc_page_create page_create;
 	alc_page_destroy page_destroy;
+
+	alc_policy policy;
+	alc_key_protected is_protected;
 };
 
+static inline alc_entry *alc_entry_get(const alc_table *alc, alc_index idx)
+{
+	return &alc->pages[idx.page].entries[idx.ent];
+}
+
+static inline alc_index alc_entry_index(const alc_table *alc, const alc_entry *ent)
+{
+	uint32_t slot = (uint32_t)(ent - alc->entries);
+	return alc_index{
+		.page = slot/(uint32_t)alc->page_size,
+		.ent = slot%(uint32_t)alc->page_size,
+	};
+}
+
+/// @return Number of pages that currently exist
+static inline size_t alc_page_count(const alc_table *alc)
+{
+	return alc->page_count.load(std::memory_order_relaxed);
+}
+
 //------------------------------------------------------------------------------
 // Atomic state updates
 
-// @return true if state was set, false otherwise
-static inline bool alc_state_set_loading(alc_atomic_state *p_state)
+// The loading functions below take the generation the entry had when it was
+// looked up, and fail without changing anything once it has been evicted 
+// since.
+
+// @return true if the entry was empty and is now queued, false otherwise
+static inline bool alc_state_set_queued(alc_atomic_state *p_state, uint16_t gen)
 {
 	uint64_t state_pkd = p_state->load(std::memory_order_relaxed);
 	alc_state desired;
 	do {
-		alc_state state = alc_state_unpack(state_pkd);
-		desired = state;
-		// If it was cancelled then we are the one stuff is waiting on to 
-		// se the status back to empty
-		if (state.status == ALC_STATUS_CANCELLED) {
-			desired.status = ALC_STATUS_EMPTY;
-		} else {
-			desired.status = ALC_STATUS_LOADING;
-		}
+		desired = alc_state_unpack(state_pkd);
+		if (desired.gen != gen || desired.status != ALC_STATUS_EMPTY ||
+			(desired.flags & ALC_FLAG_STALE_LOADER))
+			return false;
+
+		desired.status = ALC_STATUS_QUEUED;
 	} while (!p_state->compare_exchange_weak(state_pkd, alc_state_pack(desired), 
 										std::memory_order_acq_rel,std::memory_order_relaxed));
 
-	p_state->notify_one();
-	return desired.status == ALC_STATUS_LOADING;
+	return true;
 }
 
 // @return true if state was set, false otherwise
-static inline bool alc_state_set_ready(alc_atomic_state *p_state)
+static inline bool alc_state_set_loading(alc_atomic_state *p_state, uint16_t gen)
+{
+	uint64_t state_pkd = p_state->load(std::memory_order_relaxed);
+	alc_state desired;
+	do {
+		desired = alc_state_unpack(state_pkd);
+		if (desired.gen != gen || desired.status != ALC_STATUS_QUEUED)
+			return false;
+
+		desired.status = ALC_STATUS_LOADING;
+	} while (!p_state->compare_exchange_weak(state_pkd, alc_state_pack(desired), 
+										std::memory_order_acq_rel,std::memory_order_relaxed));
+
+	return true;
+}
+
+// @brief Ends a load started with alc_state_set_loading.  If the entry was
+// evicted in the meantime, this lets it be loaded into again instead.
+// @return true if the entry is now ready, false otherwise
+static inline bool alc_state_set_ready(alc_atomic_state *p_state, uint16_t gen)
 {
 	uint64_t state_pkd = p_state->load(std::memory_order_relaxed);
 	alc_state desired;
 	do {
-		alc_state state = alc_state_unpack(state_pkd);
-		desired = state;
-		if (state.status == ALC_STATUS_CANCELLED) {
-			desired.status = ALC_STATUS_EMPTY;
-		} else { 
+		desired = alc_state_unpack(state_pkd);
+		if (desired.gen == gen) 
 			desired.status = ALC_STATUS_READY;
-		}
+		else 
+			desired.flags &= ~ALC_FLAG_STALE_LOADER;
 	} while(!p_state->compare_exchange_weak(state_pkd, alc_state_pack(desired),
 										 std::memory_order_acq_rel, std::memory_order_relaxed));
 
-	p_state->notify_one();
-	return desired.status == ALC_STATUS_READY;
+	p_state->notify_all();
+	return desired.gen == gen;
+}
+
+// @brief Stops a load that is queued or running.  Like eviction, the entry is
+// left empty under a new generation, so the loader sees it is cancelled, but
+// it keeps its key.
+// @return true if the load was cancelled, false if it had already finished 
+// or the entry was evicted
+static inline bool alc_state_cancel(alc_atomic_state *p_state, uint16_t gen)
+{
+	uint64_t state_pkd = p_state->load(std::memory_order_relaxed);
+	alc_state desired;
+	do {
+		desired = alc_state_unpack(state_pkd);
+		if (desired.gen != gen || (desired.status != ALC_STATUS_QUEUED && 
+			desired.status != ALC_STATUS_LOADING))
+			return false;
+
+		if (desired.status == ALC_STATUS_LOADING)
+			desired.flags |= ALC_FLAG_STALE_LOADER;
+
+		desired.status = ALC_STATUS_EMPTY;
+		++desired.gen;
+	} while (!p_state->compare_exchange_weak(state_pkd, alc_state_pack(desired), 
+										std::memory_order_acq_rel,std::memory_order_relaxed));
+
+	return true;
 }
 
 // @return true if refcount was incremented, false otherwise
@@ -243,7 +467,6 @@ static inline bool alc_state_inc_ref(alc_atomic_state *p_state)
 			return false;
 
 		desired = alc_state_unpack(state); 
-		desired.status = ALC_STATUS_READY;
 		++desired.refs;
 	} while (!p_state->compare_exchange_weak(state, alc_state_pack(desired),
 		std::memory_order_acq_rel, std::memory_order_relaxed));
@@ -252,20 +475,18 @@ static inline bool alc_state_inc_ref(alc_atomic_state *p_state)
 }
 
 // @return true if refcount was decremented, false otherwise
-// TODO : Handle other states
 static inline bool alc_state_dec_ref(alc_atomic_state *p_state)
 {
-	uint64_t state = p_state->load();
-	uint64_t desired;
+	uint64_t state = p_state->load(std::memory_order_relaxed);
+	alc_state desired;
 	do {
-		desired = alc_state_pack({
-			.status = ALC_STATUS_READY, 
-			.flags = 0,
-			.gen = 0,
-			.refs = alc_state_refs(state) - 1
-		});
-	} while (!p_state->compare_exchange_weak(state, 
-		desired, std::memory_order_acq_rel, std::memory_order_relaxed));
+		desired = alc_state_unpack(state);
+		if (!desired.refs)
+			return false;
+
+		--desired.refs;
+	} while (!p_state->compare_exchange_weak(state, alc_state_pack(desired), 
+		std::memory_order_acq_rel, std::memory_order_relaxed));
 	return true;
 }
 
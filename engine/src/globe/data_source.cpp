@@ -8,3 +8,20 @@ void ds_context_destroy(ds_context *ctx)
 	ctx->vtbl.destroy(ctx);
 }
 
+void ds_sample_batch(
+	const ds_context *ctx, 
+	const double *u, 
+	const double *v, 
+	uint8_t f, 
+	size_t count, 
+	float *out
+)
+{
+	if (ctx->vtbl.sample_batch) {
+		ctx->vtbl.sample_batch(ctx->usr, u, v, f, count, out);
+		return;
+	}
+
+	for (size_t i = 0; i < count; ++i)
+		out[i] = ctx->vtbl.sample(ctx->usr, u[i], v[i], f);
+}
@@ -0,0 +1,545 @@
+#include "disk_cache.h"
+
+#include <ev2/utils/log.h>
+
+#include "utils/thread_pool.h"
+#include "utils/common.h"
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//------------------------------------------------------------------------------
+// File layout
+
+static constexpr char DC_MAGIC[8] = {'E','V','2','T','I','L','E','S'};
+static constexpr uint32_t DC_FILE_VERSION = 1;
+// Sections start on this boundary, so tiles can be mapped page by page
+static constexpr size_t DC_ALIGN = 4096;
+static constexpr uint32_t DC_SLOT_NONE = UINT32_MAX;
+
+struct dc_file_header
+{
+	char magic[8];
+	uint32_t file_version;
+	uint32_t reserved;
+	uint64_t version;
+	uint64_t tile_size;
+	uint64_t slot_count;
+};
+
+// One per slot, after the header
+struct dc_slot_header
+{
+	uint64_t key;
+	// When the slot was last used.  Zero if it holds no tile.
+	uint64_t tick;
+	uint64_t checksum;
+	uint64_t reserved;
+};
+
+struct dc_layout
+{
+	size_t slot_size;
+	size_t slot_count;
+	size_t index_offset;
+	size_t data_offset;
+	size_t file_size;
+};
+
+static dc_layout dc_layout_for(size_t tile_size, size_t capacity)
+{
+	dc_layout l;
+	l.slot_size = align_up(tile_size, DC_ALIGN);
+	l.index_offset = align_up(sizeof(dc_file_header), DC_ALIGN);
+
+	size_t per_slot = l.slot_size + sizeof(dc_slot_header);
+	l.slot_count = std::max(capacity, per_slot)/per_slot;
+
+	l.data_offset = l.index_offset + align_up(l.slot_count*sizeof(dc_slot_header), DC_ALIGN);
+	l.file_size = l.data_offset + l.slot_count*l.slot_size;
+	return l;
+}
+
+// Four independent lanes, so it keeps up with copying the tile
+static uint64_t dc_checksum(const void *data, size_t size)
+{
+	static constexpr uint64_t P1 = 0x9e3779b185ebca87ULL;
+	static constexpr uint64_t P2 = 0xc2b2ae3d27d4eb4fULL;
+
+	const uint8_t *p = static_cast<const uint8_t*>(data);
+
+	uint64_t h[4] = {P1, P2, ~P1, ~P2};
+
+	size_t i = 0;
+	for (; i + 32 <= size; i += 32) {
+		for (int l = 0; l < 4; ++l) {
+			uint64_t w;
+			memcpy(&w, p + i + 8*l, 8);
+			h[l] = (h[l] ^ w)*P1;
+			h[l] ^= h[l] >> 29;
+		}
+	}
+
+	uint64_t res = size*P2;
+	for (int l = 0; l < 4; ++l)
+		res = (res ^ h[l])*P2 + (uint64_t)l;
+
+	for (; i < size; ++i)
+		res = (res ^ p[i])*P1;
+
+	return res ^ (res >> 32);
+}
+
+//------------------------------------------------------------------------------
+// Cache
+
+struct dc_slot
+{
+	uint64_t key;
+	// LRU order, most recent at the head
+	uint32_t prev, next;
+	uint32_t readers;
+	// Being written, and not in the map
+	bool writing;
+};
+
+struct dc_cache
+{
+	dc_layout layout;
+	size_t tile_size;
+
+	uint8_t *base;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+
+	std::mutex mut;
+	std::unordered_map<uint64_t, uint32_t> map;
+	std::vector<dc_slot> slots;
+	uint32_t head, tail;
+	uint64_t tick;
+
+	// Copies of tiles waiting to be written
+	std::vector<std::vector<uint8_t>> buffers;
+	std::vector<uint32_t> free_buffers;
+	std::atomic_size_t pending;
+
+	std::atomic_size_t hits;
+	std::atomic_size_t misses;
+	std::atomic_size_t corrupt;
+	std::atomic_size_t writes;
+	std::atomic_size_t dropped;
+};
+
+static dc_file_header *dc_header(const dc_cache *dc)
+{
+	return reinterpret_cast<dc_file_header*>(dc->base);
+}
+
+static dc_slot_header *dc_slot_hdr(const dc_cache *dc, uint32_t slot)
+{
+	return reinterpret_cast<dc_slot_header*>(dc->base + dc->layout.index_offset) + slot;
+}
+
+static uint8_t *dc_slot_data(const dc_cache *dc, uint32_t slot)
+{
+	return dc->base + dc->layout.data_offset + (size_t)slot*dc->layout.slot_size;
+}
+
+static void dc_lru_unlink(dc_cache *dc, uint32_t slot)
+{
+	dc_slot &s = dc->slots[slot];
+
+	if (s.prev != DC_SLOT_NONE)
+		dc->slots[s.prev].next = s.next;
+	else
+		dc->head = s.next;
+
+	if (s.next != DC_SLOT_NONE)
+		dc->slots[s.next].prev = s.prev;
+	else
+		dc->tail = s.prev;
+
+	s.prev = s.next = DC_SLOT_NONE;
+}
+
+static void dc_lru_push_front(dc_cache *dc, uint32_t slot)
+{
+	dc_slot &s = dc->slots[slot];
+	s.prev = DC_SLOT_NONE;
+	s.next = dc->head;
+
+	if (dc->head != DC_SLOT_NONE)
+		dc->slots[dc->head].prev = slot;
+	else
+		dc->tail = slot;
+
+	dc->head = slot;
+}
+
+static void dc_lru_push_back(dc_cache *dc, uint32_t slot)
+{
+	dc_slot &s = dc->slots[slot];
+	s.next = DC_SLOT_NONE;
+	s.prev = dc->tail;
+
+	if (dc->tail != DC_SLOT_NONE)
+		dc->slots[dc->tail].next = slot;
+	else
+		dc->head = slot;
+
+	dc->tail = slot;
+}
+
+// Must hold the lock
+static void dc_touch(dc_cache *dc, uint32_t slot)
+{
+	dc_lru_unlink(dc, slot);
+	dc_lru_push_front(dc, slot);
+	dc_slot_hdr(dc, slot)->tick = ++dc->tick;
+}
+
+// Must hold the lock.  The slot goes to the back, to be reused first.
+static void dc_invalidate(dc_cache *dc, uint32_t slot)
+{
+	dc_slot_hdr(dc, slot)->tick = 0;
+	dc->map.erase(dc->slots[slot].key);
+
+	dc_lru_unlink(dc, slot);
+	dc_lru_push_back(dc, slot);
+}
+
+static int dc_map_file(dc_cache *dc, const char *path, size_t size, bool *p_existed)
+{
+#ifdef _WIN32
+	dc->file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+						OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (dc->file == INVALID_HANDLE_VALUE)
+		return -1;
+
+	LARGE_INTEGER cur;
+	*p_existed = GetFileSizeEx(dc->file, &cur) && (size_t)cur.QuadPart == size;
+
+	LARGE_INTEGER li;
+	li.QuadPart = (LONGLONG)size;
+	if (!*p_existed &&
+		(!SetFilePointerEx(dc->file, li, nullptr, FILE_BEGIN) || !SetEndOfFile(dc->file)))
+		return -1;
+
+	dc->mapping = CreateFileMappingA(dc->file, nullptr, PAGE_READWRITE,
+								  li.HighPart, li.LowPart, nullptr);
+	if (!dc->mapping)
+		return -1;
+
+	dc->base = static_cast<uint8_t*>(MapViewOfFile(dc->mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+	return dc->base ? 0 : -1;
+#else
+	dc->fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (dc->fd < 0)
+		return -1;
+
+	struct stat st;
+	*p_existed = !fstat(dc->fd, &st) && (size_t)st.st_size == size;
+
+	// Sparse, so only written tiles take up space
+	if (!*p_existed && ftruncate(dc->fd, (off_t)size) < 0)
+		return -1;
+
+	void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, dc->fd, 0);
+	if (mem == MAP_FAILED)
+		return -1;
+
+	dc->base = static_cast<uint8_t*>(mem);
+	return 0;
+#endif
+}
+
+static void dc_unmap_file(dc_cache *dc)
+{
+#ifdef _WIN32
+	if (dc->base)
+		UnmapViewOfFile(dc->base);
+	if (dc->mapping)
+		CloseHandle(dc->mapping);
+	if (dc->file && dc->file != INVALID_HANDLE_VALUE)
+		CloseHandle(dc->file);
+#else
+	if (dc->base)
+		munmap(dc->base, dc->layout.file_size);
+	if (dc->fd >= 0)
+		close(dc->fd);
+#endif
+}
+
+// Rebuilds the map and LRU order from the slot headers
+static void dc_load_index(dc_cache *dc)
+{
+	uint32_t count = (uint32_t)dc->layout.slot_count;
+
+	std::vector<uint32_t> used;
+	for (uint32_t i = 0; i < count; ++i) {
+		if (dc_slot_hdr(dc, i)->tick)
+			used.push_back(i);
+		else
+			dc_lru_push_back(dc, i);
+	}
+
+	std::sort(used.begin(), used.end(), [dc](uint32_t a, uint32_t b) {
+		return dc_slot_hdr(dc, a)->tick < dc_slot_hdr(dc, b)->tick;
+	});
+
+	for (uint32_t i : used) {
+		dc_slot_header *hdr = dc_slot_hdr(dc, i);
+
+		// A write that was interrupted after the key was reused
+		auto [it, inserted] = dc->map.try_emplace(hdr->key, i);
+		if (!inserted) {
+			uint32_t older = it->second;
+			dc_slot_hdr(dc, older)->tick = 0;
+			dc_lru_unlink(dc, older);
+			dc_lru_push_back(dc, older);
+			it->second = i;
+		}
+
+		dc->slots[i].key = hdr->key;
+		dc_lru_push_front(dc, i);
+		dc->tick = std::max(dc->tick, hdr->tick);
+	}
+}
+
+int dc_open(dc_cache **p_dc, const dc_params *params)
+{
+	dc_cache *dc = new dc_cache{};
+#ifdef _WIN32
+	dc->file = INVALID_HANDLE_VALUE;
+#else
+	dc->fd = -1;
+#endif
+	dc->tile_size = params->tile_size;
+	dc->layout = dc_layout_for(params->tile_size, params->capacity);
+	dc->head = dc->tail = DC_SLOT_NONE;
+
+	bool existed;
+	if (dc_map_file(dc, params->path, dc->layout.file_size, &existed) < 0) {
+		log_error("dc_open : failed to map %s", params->path);
+		dc_unmap_file(dc);
+		delete dc;
+		return -1;
+	}
+
+	dc_file_header expected = {};
+	memcpy(expected.magic, DC_MAGIC, sizeof(DC_MAGIC));
+	expected.file_version = DC_FILE_VERSION;
+	expected.version = params->version;
+	expected.tile_size = params->tile_size;
+	expected.slot_count = dc->layout.slot_count;
+
+	if (!existed || memcmp(dc_header(dc), &expected, sizeof(expected))) {
+		if (existed)
+			log_info("dc_open : %s is out of date, clearing it", params->path);
+
+		memset(dc->base + dc->layout.index_offset, 0,
+			dc->layout.data_offset - dc->layout.index_offset);
+		*dc_header(dc) = expected;
+	}
+
+	dc->slots.resize(dc->layout.slot_count, dc_slot{
+		.key = 0,
+		.prev = DC_SLOT_NONE,
+		.next = DC_SLOT_NONE,
+		.readers = 0,
+		.writing = false,
+	});
+
+	dc_load_index(dc);
+
+	dc->buffers.resize(DC_MAX_PENDING_WRITES);
+	for (uint32_t i = 0; i < DC_MAX_PENDING_WRITES; ++i)
+		dc->free_buffers.push_back(i);
+
+	log_info("dc_open : %s, %zu of %zu tiles", params->path,
+		  dc->map.size(), dc->layout.slot_count);
+
+	*p_dc = dc;
+	return 0;
+}
+
+void dc_close(dc_cache *dc)
+{
+	if (!dc)
+		return;
+
+	for (size_t n; (n = dc->pending.load()) != 0;)
+		dc->pending.wait(n);
+
+	dc_unmap_file(dc);
+	delete dc;
+}
+
+bool dc_read(dc_cache *dc, uint64_t key, void *dst, size_t size)
+{
+	if (size != dc->tile_size) {
+		++dc->misses;
+		return false;
+	}
+
+	uint32_t slot;
+	uint64_t checksum;
+	{
+		std::lock_guard<std::mutex> lock(dc->mut);
+
+		auto it = dc->map.find(key);
+		if (it == dc->map.end()) {
+			++dc->misses;
+			return false;
+		}
+
+		slot = it->second;
+		++dc->slots[slot].readers;
+		checksum = dc_slot_hdr(dc, slot)->checksum;
+		dc_touch(dc, slot);
+	}
+
+	// Not written to while it has readers
+	memcpy(dst, dc_slot_data(dc, slot), size);
+	bool ok = dc_checksum(dst, size) == checksum;
+
+	std::lock_guard<std::mutex> lock(dc->mut);
+
+	--dc->slots[slot].readers;
+
+	if (ok) {
+		++dc->hits;
+	} else {
+		log_warn("dc_read : tile %llx failed its checksum", (unsigned long long)key);
+		++dc->corrupt;
+		++dc->misses;
+		dc_invalidate(dc, slot);
+	}
+
+	return ok;
+}
+
+// Must hold the lock
+static uint32_t dc_find_victim(dc_cache *dc)
+{
+	for (uint32_t i = dc->tail; i != DC_SLOT_NONE; i = dc->slots[i].prev) {
+		if (!dc->slots[i].readers && !dc->slots[i].writing)
+			return i;
+	}
+	return DC_SLOT_NONE;
+}
+
+static void dc_write_slot(dc_cache *dc, uint64_t key, const uint8_t *src)
+{
+	uint32_t slot;
+	{
+		std::lock_guard<std::mutex> lock(dc->mut);
+
+		if (dc->map.contains(key))
+			return;
+
+		slot = dc_find_victim(dc);
+		if (slot == DC_SLOT_NONE) {
+			++dc->dropped;
+			return;
+		}
+
+		if (dc_slot_hdr(dc, slot)->tick)
+			dc->map.erase(dc->slots[slot].key);
+
+		// Marked empty before the data changes, in case the process dies
+		// part way
+		dc_slot_hdr(dc, slot)->tick = 0;
+		dc->slots[slot].writing = true;
+	}
+
+	memcpy(dc_slot_data(dc, slot), src, dc->tile_size);
+	uint64_t checksum = dc_checksum(src, dc->tile_size);
+
+	std::lock_guard<std::mutex> lock(dc->mut);
+
+	dc_slot_header *hdr = dc_slot_hdr(dc, slot);
+	hdr->key = key;
+	hdr->checksum = checksum;
+
+	dc->slots[slot].key = key;
+	dc->slots[slot].writing = false;
+
+	// Written by someone else in the meantime
+	if (!dc->map.try_emplace(key, slot).second) {
+		dc_lru_unlink(dc, slot);
+		dc_lru_push_back(dc, slot);
+		return;
+	}
+
+	dc_touch(dc, slot);
+	++dc->writes;
+}
+
+void dc_write(dc_cache *dc, uint64_t key, const void *src, size_t size)
+{
+	if (size != dc->tile_size)
+		return;
+
+	uint32_t buf;
+	{
+		std::lock_guard<std::mutex> lock(dc->mut);
+
+		if (dc->map.contains(key))
+			return;
+
+		if (dc->free_buffers.empty()) {
+			++dc->dropped;
+			return;
+		}
+
+		buf = dc->free_buffers.back();
+		dc->free_buffers.pop_back();
+
+		++dc->pending;
+	}
+
+	std::vector<uint8_t> &data = dc->buffers[buf];
+	data.resize(size);
+	memcpy(data.data(), src, size);
+
+	g_schedule_background([dc, key, buf](){
+		dc_write_slot(dc, key, dc->buffers[buf].data());
+
+		{
+			std::lock_guard<std::mutex> lock(dc->mut);
+			dc->free_buffers.push_back(buf);
+		}
+
+		--dc->pending;
+		dc->pending.notify_all();
+	});
+}
+
+dc_stats dc_get_stats(const dc_cache *dc)
+{
+	return dc_stats{
+		.hits = dc->hits,
+		.misses = dc->misses,
+		.corrupt = dc->corrupt,
+		.writes = dc->writes,
+		.dropped = dc->dropped,
+	};
+}
@@ -0,0 +1,57 @@
+#ifndef DISK_CACHE_H
+#define DISK_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Writes that have not reached the file yet.  Tiles loaded past this are not
+// written.
+static constexpr size_t DC_MAX_PENDING_WRITES = 64;
+
+struct dc_params
+{
+	const char *path;
+	// Size of a tile in bytes, the same for every tile
+	size_t tile_size;
+	// Size of the file, in bytes
+	size_t capacity;
+	// Identifies what the tiles were loaded from.  A file written with a
+	// different version, tile size or capacity is cleared when opened.
+	uint64_t version;
+};
+
+struct dc_stats
+{
+	size_t hits;
+	size_t misses;
+	// Tiles that failed their checksum, and were dropped
+	size_t corrupt;
+	size_t writes;
+	// Writes skipped because too many were pending or every slot was in use
+	size_t dropped;
+};
+
+struct dc_cache;
+
+// @brief Opens the cache file at params->path, or creates it.  Tiles are
+// evicted least recently used first once it is full, and the order is kept
+// in the file.
+extern int dc_open(dc_cache **p_dc, const dc_params *params);
+
+// @brief Waits for pending writes, then closes the file
+extern void dc_close(dc_cache *dc);
+
+// All functions below are thread safe.
+
+// @brief Copies the tile for key to dst if it is in the file and its
+// checksum matches.
+// @return Whether it was copied
+extern bool dc_read(dc_cache *dc, uint64_t key, void *dst, size_t size);
+
+// @brief Copies the tile, and writes it to the file on a background thread.
+// Does nothing if the file already has it.
+extern void dc_write(dc_cache *dc, uint64_t key, const void *src, size_t size);
+
+extern dc_stats dc_get_stats(const dc_cache *dc);
+
+#endif // DISK_CACHE_H
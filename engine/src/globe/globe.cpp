@@ -1,7 +1,9 @@
 
 #include "terrain.h"
+#include "tile_select.h"
 #include "gpu_cache.h"
 #include "utils/thread_pool.h"
+#include "utils/frame_arena.h"
 
 #include <ev2/render.h>
 #include <ev2/globe/globe.h>
@@ -30,6 +32,7 @@
 #include <cstdint>
 #include <algorithm>
 #include <vector>
+#include <unordered_set>
 #include <complex.h>
 
 #ifndef PI 
@@ -44,7 +47,17 @@ static constexpr uint32_t TILE_VERT_WIDTH = 64;
 static constexpr uint32_t TILE_VERT_COUNT = 
 	TILE_VERT_WIDTH*TILE_VERT_WIDTH;
 
-static constexpr double tile_scale_factor = 12;
+// How many frames ahead the camera position is extrapolated
+static constexpr double PREFETCH_FRAMES = 15;
+static constexpr size_t PREFETCH_MAX_TILES = 256;
+// Weight of the latest frame in the smoothed camera velocity
+static constexpr double PREFETCH_VELOCITY_WEIGHT = 0.3;
+// No prediction is made while the camera would move less than this fraction 
+// of its height above the terrain in PREFETCH_FRAMES
+static constexpr double PREFETCH_MIN_SHIFT = 0.05;
+
+// Starting size of the per-frame arena, which grows to what frames use
+static constexpr size_t GLOBE_FRAME_ARENA_SIZE = 1024*1024;
 
 struct DebugInfo
 {
@@ -52,17 +65,10 @@ struct DebugInfo
 	std::unique_ptr<BoxDebugView> boxes;
 	bool enable_boxes;
 	bool fix_camera;
+	bool full_select;
 	int zoom;
 };
 
-struct alignas(8) GlobeVertex
-{
-	glm::vec3 pos;
-	glm::vec2 uv;
-	glm::vec3 normal;
-	//glm::vec2 big_uv;
-};
-
 struct alignas(16) TileMetadata
 {
 	glm::vec4 coord;
@@ -73,8 +79,14 @@ struct alignas(16) TileMetadata
 	TileGPUIndex tex_idx;
 	uint32_t code_lower;
 	uint32_t code_upper;
+
+	// Cube face of the drawn tile.  Vertices are pulled from a shared grid
+	// and placed on the globe using globe_uv and this face.
+	uint32_t face;
 };
 
+static_assert(sizeof(TileMetadata) == 64);
+
 
 template<
 	typename ArgIt, 
@@ -115,7 +127,6 @@ struct TileAllocator
 
 	std::vector<size_t> free_list;
 
-	std::vector<kv_t> new_tiles;
 	std::vector<kv_t> current;
 	std::vector<kv_t> previous;
 
@@ -141,11 +152,6 @@ struct TileAllocator
 		return SIZE_MAX;
 	}
 
-	void get_new(const kv_t **keys, size_t *count) const {
-		*keys = new_tiles.data();
-		*count = new_tiles.size();
-	}
-
 	// @brief Replaces old key-value pairs with new ones, allocating slots
 	// for any new keys from stale entries
 	void set(const std::vector<uint64_t> &keys)
@@ -164,29 +170,30 @@ struct TileAllocator
 
 		current.resize(std::min(keys.size(), cap));
 
-		new_tiles.resize(std::max(previous.size(), current.size()));
+		// Stale keys, then new ones
+		std::vector<kv_t> diff (std::max(previous.size(), current.size()));
 
 		// stale tiles (previous \ current)
 		// for tiles that are the same copy the values over
 		auto iter = set_difference2(
 			previous.begin(), previous.end(), 
 			current.begin(), current.end(), 
-			new_tiles.begin(),
+			diff.begin(),
 			[](kv_t a, kv_t b){},		
 			[](kv_t a){}
 		);
 
-		for (auto it = new_tiles.begin(); it < iter; ++it) {
+		for (auto it = diff.begin(); it < iter; ++it) {
 			free_list.push_back(it->idx);
 		}
 
 		std::vector<size_t> &tmp = free_list;
 
 		// newly added (current \ previous)
-		iter = set_difference2(
+		set_difference2(
 			current.begin(), current.end(), 
 			previous.begin(), previous.end(), 
-			new_tiles.begin(),
+			diff.begin(),
 			[](kv_t &a, kv_t b){
 				a.idx = b.idx;
 			},
@@ -197,15 +204,23 @@ struct TileAllocator
 				a.idx = idx;
 			}
 		);
-
-		size_t count = (size_t)(iter - new_tiles.begin());
-		new_tiles.resize(count);
 	}
 };
 
+struct PrefetchState
+{
+	glm::dvec3 prev_pos;
+	// Per frame
+	glm::dvec3 vel;
+	bool valid;
+
+	std::vector<uint64_t> tiles;
+	std::vector<tc_priority> priority;
+	std::vector<uint64_t> predicted;
+};
+
 struct RenderData
 {
-	ev2::BufferID vbo;
 	ev2::BufferID indirect;
 	ev2::BufferID ibo;
 
@@ -227,6 +242,12 @@ struct Globe
 	DebugInfo dbg;
 
 	std::vector<uint64_t> selected_tiles;
+	SelectionCut cut;
+
+	PrefetchState prefetch;
+
+	// Temporaries of globe_update, reset at the start of each call
+	frame_arena frame;
 
 	RenderData render_data;
 
@@ -235,19 +256,6 @@ struct Globe
 	std::unique_ptr<CPUTileCache> cpu_cache;
 };
 
-struct select_tiles_params
-{
-	const CPUTileCache * cpu_cache;
-	const DebugInfo *debug;
-
-	size_t max_tiles;
-	double cull_radius;
-	frustum_t frust;
-	aabb3_t frust_box;
-	glm::dvec3 origin;
-	double res;
-};
-
 static void globe_init_debug(Globe *globe) {
 	globe->dbg.boxes.reset(new BoxDebugView(globe->dev));
 	globe->dbg.camera.reset(new CameraDebugView(globe->dev));
@@ -301,157 +309,6 @@ static aabb3_t tile_aabb(TileCode code, float min, float max)
 	return box;
 }
 
-static obb_t tile_obb(TileCode code, double min, double max) 
-{
-	uint8_t face = code.face;
-
-	aabb2_t rect = morton_u64_to_rect_f64(code.idx,code.zoom);
-	glm::dvec2 mid_uv = 0.5*(rect.ur() + rect.ll());
-
-	double h = max - min;
-
-	glm::dvec3 mid = cube_to_globe(face, mid_uv);
-	mid *= (1.0 + 0.5*(min + max));
-
-	double s_min = 1.0 + min;
-	double s_max = 1.0 + max;
-
-	obb_t box;
-	box.T = orthonormal_globe_frame(mid_uv, face);
-	box.O = mid;
-	box.S = glm::dvec3(0,0,0.5*h);
-
-	// TODO : It should be possible to determine the minimum 
-	// dimensions of the box with less operations.
-	glm::dvec3 c[8] = {
-		cube_to_globe(face, rect.ll()),
-		cube_to_globe(face, rect.lr()),
-		cube_to_globe(face, rect.ul()),
-		cube_to_globe(face, rect.ur()),
-	};
-
-	for (size_t i = 0; i < 4; ++i) {
-		c[4 + i] = c[i] * s_max;
-		c[i] *= s_min;
-	}
-
-	obb_add(box, sizeof(c)/sizeof(c[0]),c);
-
-	return box;
-}
-
-struct selection_entry_t
-{
-	TileCode code;
-	double dist;
-};
-
-static inline int select_tiles_rec(
-	std::vector<selection_entry_t> &out, 
-	const select_tiles_params *params,
-	TileCode code)
-{
-	BoxDebugView * boxes = params->debug->enable_boxes ? 
-		params->debug->boxes.get() : nullptr;
-
-	if (code.zoom > 23)
-		return 0;
-
-	uint64_t u64 = tile_code_pack(code);
-
-	mmt_result_t mmt_res = mmt_minmax(params->cpu_cache->mmt, u64);
-	obb_t box = tile_obb(code, (double)mmt_res.min, (double)mmt_res.max);
-
-	if (code.zoom > 1 && dot(box.T[2],params->origin) < 0)
-		return 0;
-
-	for (uint8_t i = 0; i < 6; ++i) {
-		if (classify(box, params->frust.planes[i]) > 0) { 
-			return 0;
-		}
-	}
-
-	double d_min_sq = obb_dist_sq(box, params->origin);
-
-	d_min_sq = std::max(tile_scale_factor*sqrt(d_min_sq),1e-6);
-
-	double area = tile_factor(code.zoom);
-
-	if (area/d_min_sq < params->res 
-		|| mmt_res.dist >= (int)(TILE_WIDTH/(TILE_VERT_WIDTH))
-	) {
-
-		out.push_back({code,d_min_sq});
-		if(boxes) boxes->add(box);
-		return 1;
-	}
-
-	TileCode children[4] = {
-		tile_code_refine(code,TILE_LOWER_LEFT),
-		tile_code_refine(code,TILE_LOWER_RIGHT),
-		tile_code_refine(code,TILE_UPPER_LEFT),
-		tile_code_refine(code,TILE_UPPER_RIGHT)
-	};
-
-	int status = 0;
-	for (uint8_t i = 0; i < 4; ++i) {
-		status += select_tiles_rec(out, params, children[i]);
-	}
-
-	// If status is zero than no tiles were added, so add this tile
-	if (!status) {
-		out.push_back({code,d_min_sq});
-		if (boxes) boxes->add(box);
-		return 1;
-	}
-
-	return status;
-}
-
-// @brief Select tiles within camera frustum based on loaded terrain
-// @note The resulting tiles are sorted by distance from the camera.
-static void select_tiles(
-	select_tiles_params& params,
-	std::vector<tile_code_t>& tiles
-)
-{
-	params.res = std::max(params.res, 1e-5);
-
-	std::vector<selection_entry_t> selection;
-	for (uint8_t f = 0; f < CUBE_FACES; ++f) {
-
-		TileCode code = {
-			.face = f,
-			.zoom = 0,
-			.idx = 0
-		};
-		select_tiles_rec(selection, &params, code); 
-	}
-
-	constexpr auto comp = [](const selection_entry_t &a, const selection_entry_t &b) {
-		return a.dist < b.dist;
-	};
-	std::sort(selection.begin(), selection.end(), comp);
-
-	size_t count = std::min(selection.size(), params.max_tiles);
-
-	tiles.resize(count);
-	for (size_t i = 0; i < count; ++i) {
-		tiles[i] = tile_code_pack(selection[i].code);
-	}
-}
-
-static aabb2_t sub_rect(TileCode parent, TileCode child)
-{
-	if (parent.zoom >= child.zoom)
-		return aabb2_t{.min = glm::dvec2(0), .max = glm::dvec2(1)};
-
-	int diff = child.zoom - parent.zoom;	
-	child.idx &= (1 << (2*diff)) - 1;
-
-	return morton_u64_to_rect_f64(child.idx, (uint8_t)diff);
-}
-
 static std::vector<uint32_t> create_tile_indices()
 {
 	static const uint32_t n = TILE_VERT_WIDTH;
@@ -478,7 +335,6 @@ static ev2::Result create_render_data(ev2::Device *dev, RenderData &data)
 {
 	ev2::Result result = ev2::SUCCESS;
 
-	size_t vbo_size = MAX_TILES*TILE_VERT_COUNT*sizeof(GlobeVertex);
 	size_t ibo_size = sizeof(uint32_t)*6*TILE_VERT_COUNT;
 	size_t indirect_size = MAX_TILES*sizeof(ev2::DrawCommand);
 	size_t ssbo_size = MAX_TILES*sizeof(TileMetadata);
@@ -488,11 +344,6 @@ static ev2::Result create_render_data(ev2::Device *dev, RenderData &data)
 	if (!data.pipeline.id)
 		goto load_failed;
 
-	data.vbo = ev2::create_buffer(dev, vbo_size);
-
-	if (!data.vbo.id)
-		goto load_failed;
-
 	data.indirect = ev2::create_buffer(dev, indirect_size);
 
 	if (!data.indirect.id)
@@ -536,42 +387,12 @@ static ev2::Result create_render_data(ev2::Device *dev, RenderData &data)
 
 	return result;
 load_failed:
-	if (data.vbo.id) ev2::destroy_buffer(dev, data.vbo);
 	if (data.ibo.id) ev2::destroy_buffer(dev, data.ibo);
 	if (data.ssbo.id) ev2::destroy_buffer(dev, data.ssbo);
 	if (data.indirect.id) ev2::destroy_buffer(dev, data.indirect);
 	return result;
 }
 
-static void create_tile_verts(TileCode code, GlobeVertex* out_verts)
-{
-	uint8_t f = code.face;
-
-	aabb2_t rect = morton_u64_to_rect_f64(code.idx,code.zoom);
-	double factor = 1.0/(double)(TILE_VERT_WIDTH-1);
-
-	glm::dvec2 uv;
-
-	size_t idx = 0;
-	for (uint32_t i = 0; i < TILE_VERT_WIDTH; ++i) {
-		uv.x = (double)i*factor;
-		for (uint32_t j = 0; j < TILE_VERT_WIDTH; ++j) {
-			uv.y = (double)j*factor;
-
-			glm::dvec2 face_uv = glm::mix(rect.ll(),rect.ur(),uv);
-			glm::dvec3 p = cube_to_globe(f, face_uv);
-
-			GlobeVertex vert = {
-				.pos = glm::vec3(p),
-				.uv = glm::vec2(uv),
-				.normal = glm::vec3(p),
-			};
-
-			out_verts[idx++] = vert;
-		}
-	}
-}
-
 static uint64_t update_draw_cmds(Globe *globe) 
 {
 	size_t count = globe->selected_tiles.size();
@@ -590,6 +411,8 @@ static uint64_t update_draw_cmds(Globe *globe)
 		uint64_t code = globe->selected_tiles[i];
 		size_t slot = globe->tile_allocator->get_idx(code);
 
+		// There is no vertex buffer; baseVertex only offsets gl_VertexIndex 
+		// so the vertex shader can recover the metadata slot of the tile.
 		ev2::DrawCommand cmd = {
 			.count = 6*TILE_VERT_COUNT,
 			.instanceCount = 1, 
@@ -610,78 +433,11 @@ static uint64_t update_draw_cmds(Globe *globe)
 	return ev2::commit_buffer_uploads(globe->dev, uc, globe->render_data.indirect, &upload, 1);
 }
 
-static uint64_t update_vbo(Globe *globe)
-{
-	const TileAllocator::kv_t * new_tiles; 
-	size_t new_count;
-	globe->tile_allocator->get_new(&new_tiles, &new_count);
-
-	if (!new_count)
-		return 0;
-	
-	size_t total_size = new_count * TILE_VERT_COUNT * sizeof(GlobeVertex);
-
-	ev2::UploadContext uc = ev2::begin_upload(globe->dev, total_size, alignof(GlobeVertex));
-
-	size_t batch_size = std::max(2*new_count/(std::thread::hardware_concurrency()),1LU);
-
-	GlobeVertex *ptr = (GlobeVertex*)uc.ptr;
-
-	std::atomic_int ctr = (int)new_count;
-	std::atomic_bool done = false;
-
-	for (size_t start = 0; start < new_count; start += batch_size) {
-		size_t end = std::min(start + batch_size, new_count);
-
-		g_schedule_task([ptr, start, end, new_tiles, &ctr, &done](){
-
-			for (size_t i = start; i < end; ++i) {
-				TileAllocator::kv_t kv = new_tiles[i];
-
-				GlobeVertex *dst = ptr + i * TILE_VERT_COUNT;
-				TileCode code = tile_code_unpack(kv.code);
-				create_tile_verts(code, dst);
-				int value = ctr.fetch_sub(1);
-				if (value <= 1) {
-					done.store(true);
-					done.notify_one();
-				}
-			}
-		});
-	}
-
-	if (new_count)
-		done.wait(false);
-
-	if (ctr)
-		throw std::runtime_error("bad");
-
-	// TODO : Consolidate these
-	std::vector<ev2::BufferUpload> uploads (new_count); 
-
-	size_t tile_size = sizeof(GlobeVertex) * TILE_VERT_COUNT;
-
-	for (size_t i = 0; i < new_count; ++i) {
-		uploads[i] = ev2::BufferUpload{
-			.src_offset = i * tile_size,
-			.dst_offset = new_tiles[i].idx * tile_size,
-			.size = tile_size
-		};
-	}
-
-	uint64_t value = ev2::commit_buffer_uploads(globe->dev, uc, 
-							globe->render_data.vbo, 
-							uploads.data(), 
-							(uint32_t)uploads.size());
-
-	return value;
-}
-
 static ev2::Result update_render_data(
 	Globe *globe,
 	glm::dvec3 origin,
-	const std::vector<uint64_t>& parents, 
-	const std::vector<TileGPUIndex> &textures
+	std::span<const uint64_t> parents, 
+	std::span<const TileGPUIndex> textures
 )
 {
 	ev2::Device *dev = globe->dev;
@@ -691,13 +447,6 @@ static ev2::Result update_render_data(
 
 	globe->tile_allocator->set(tiles);
 
-	//-----------------------------------------------------------------------------
-	// vbo
-	
-	uint64_t vbo_sync = update_vbo(globe);
-
-	ev2::flush_uploads(dev);
-
 	//-----------------------------------------------------------------------------
 	// tex indices
 	
@@ -707,6 +456,31 @@ static ev2::Result update_render_data(
 
 	TileMetadata *metadata = static_cast<TileMetadata*>(uc.ptr);
 
+	// Decode all rects in one batch.  The first half are the tile rects on 
+	// the cube face, the second half the rect of each tile within the texture
+	// of its loaded parent.  A level of zero yields the unit rect.
+	frame_arena *arena = &globe->frame;
+
+	frame_vector<uint64_t> rect_idx (2*count, arena);
+	frame_vector<uint8_t> rect_lvl (2*count, arena);
+	frame_vector<aabb2_t> rects (2*count, arena);
+
+	for (uint32_t i = 0; i < count; ++i) {
+		TileCode child = tile_code_unpack(tiles[i]);
+		TileCode parent = tile_code_unpack(parents[i]);
+
+		uint8_t diff = (parent == TILE_CODE_NONE || parent.zoom >= child.zoom) ?
+			0 : (uint8_t)(child.zoom - parent.zoom);
+
+		rect_idx[i] = child.idx;
+		rect_lvl[i] = child.zoom;
+		rect_idx[count + i] = child.idx;
+		rect_lvl[count + i] = diff;
+	}
+
+	morton_u64_to_rect_f64_batch(rect_idx.data(), rect_lvl.data(), 
+							  rects.size(), rects.data());
+
 	for (uint32_t i = 0; i < count; ++i) {
 		uint64_t code_parent = parents[i];
 		uint64_t code_child = tiles[i];
@@ -714,12 +488,9 @@ static ev2::Result update_render_data(
 		TileGPUIndex idx = textures[i];
 
 		TileCode child = tile_code_unpack(code_child);
-		TileCode parent = tile_code_unpack(code_parent);
 
-		aabb2_t rect = morton_u64_to_rect_f64(child.idx,child.zoom);
-		aabb2_t rect_tex = parent == TILE_CODE_NONE ? 
-			aabb2_t{.min = glm::dvec2(0), .max = glm::dvec2(1)} : 
-			sub_rect(parent, child);
+		aabb2_t rect = rects[i];
+		aabb2_t rect_tex = rects[count + i];
 
 		metadata[i] = {
 			.coord = glm::vec4(0),
@@ -728,11 +499,12 @@ static ev2::Result update_render_data(
 			.tex_idx = idx,
 			.code_lower = (uint32_t)(code_parent & 0xFFFFFFFF),
 			.code_upper = (uint32_t)(code_parent >> 32),
+			.face = child.face,
 		};
 	}
 
 	// TODO : Consolidate these
-	std::vector<ev2::BufferUpload> uploads (count);
+	frame_vector<ev2::BufferUpload> uploads (count, arena);
 
 	for (size_t i = 0; i < count; ++i) {
 		size_t slot = globe->tile_allocator->get_idx(tiles[i]);
@@ -756,7 +528,7 @@ static ev2::Result update_render_data(
 
 	ev2::flush_uploads(dev);
 
-	ev2::wait_complete(dev, std::max(std::max(vbo_sync, ssbo_sync), indirect_sync));
+	ev2::wait_complete(dev, std::max(ssbo_sync, indirect_sync));
 
 	return ev2::SUCCESS;
 };
@@ -817,6 +589,129 @@ static void plot_tile_counts(size_t total, size_t new_tiles)
 		}
 }
 
+// Screen-space error of a tile, measured from its center
+static tc_priority tile_load_priority(TileCode code, glm::dvec3 origin)
+{
+	aabb2_t rect = morton_u64_to_rect_f64(code.idx, code.zoom);
+	glm::dvec3 mid = cube_to_globe(code.face, 0.5*(rect.ll() + rect.ur()));
+
+	double dist = std::max(length(mid - origin), 1e-6);
+
+	return tc_priority{
+		.error = (float)(tile_factor(code)/dist),
+		.dist = (float)dist
+	};
+}
+
+// Tiles are loaded two levels above the selected ones, and cover the area 
+// of sixteen of them
+static TileCode tile_load_code(TileCode code)
+{
+	if (code.zoom > 2) {
+		code.idx >>= 4;
+		code.zoom -= 2;
+	}
+	return code;
+}
+
+// Distance from pos past which no terrain can be seen
+static double horizon_cull_radius(const CPUTileCache *cpu_cache, glm::dvec3 pos)
+{
+	double h_max = (double)cpu_cache->max();
+	double h_min = (double)cpu_cache->min();
+
+	double r_min = 1.0 + h_min;
+	double r_max = 1.0 + h_max;
+
+	double r_horizon = sqrt(std::max(dot(pos,pos) - r_min*r_min,0.));
+	double r_horizon_max  = sqrt(std::max(r_max * r_max - r_min*r_min,0.));
+
+	return r_horizon + r_horizon_max;
+}
+
+// Queues tiles for where the camera is headed, and the ones bordering the
+// current selection, at a lower priority than those on screen.  The 
+// predicted tiles refine the current cut instead of selecting from the 
+// roots, and a camera that has nearly stopped predicts nothing.
+static void globe_prefetch(
+	Globe *globe, 
+	const select_tiles_params &params, 
+	std::span<const uint64_t> loading
+)
+{
+	PrefetchState &pf = globe->prefetch;
+	CPUTileCache *cpu_cache = globe->cpu_cache.get();
+
+	glm::dvec3 pos = params.origin;
+
+	if (pf.valid)
+		pf.vel = mix(pf.vel, pos - pf.prev_pos, PREFETCH_VELOCITY_WEIGHT);
+	else
+		pf.vel = glm::dvec3(0);
+
+	pf.prev_pos = pos;
+	pf.valid = true;
+
+	pf.tiles.clear();
+	pf.priority.clear();
+
+	frame_unordered_set<uint64_t> seen (loading.begin(), loading.end(), 
+		2*(loading.size() + PREFETCH_MAX_TILES), params.arena);
+
+	auto add = [&](TileCode code, glm::dvec3 origin) {
+		uint64_t u64 = tile_code_pack(code);
+		if (pf.tiles.size() >= PREFETCH_MAX_TILES || !seen.insert(u64).second)
+			return;
+		pf.tiles.push_back(u64);
+		pf.priority.push_back(tile_load_priority(code, origin));
+	};
+
+	glm::dvec3 shift = pf.vel*PREFETCH_FRAMES;
+
+	double height = std::max(length(pos) - (1.0 + (double)cpu_cache->max()), 1e-9);
+
+	if (length(shift) > PREFETCH_MIN_SHIFT*height && globe->cut.map.size) {
+		glm::dvec3 p = pos + shift;
+
+		// Do not extrapolate into the ground
+		double r = length(p);
+		double r_floor = std::min(length(pos), 1.0 + (double)cpu_cache->max());
+		if (r < r_floor)
+			p *= r_floor/r;
+		shift = p - pos;
+
+		select_tiles_params predicted = params;
+		predicted.boxes = nullptr;
+		predicted.max_tiles = PREFETCH_MAX_TILES;
+		predicted.origin = p;
+
+		for (plane_t &plane : predicted.frust.planes)
+			plane.d += dot(plane.n, shift);
+
+		predicted.cull_radius = horizon_cull_radius(cpu_cache, p);
+		predicted.frust.p.far.d = dot(p, predicted.frust.p.far.n) + 
+			predicted.cull_radius;
+		predicted.frust_box = frustum_aabb(predicted.frust);
+
+		select_tiles_predict(predicted, globe->cut, pf.predicted);
+
+		for (uint64_t tile : pf.predicted)
+			add(tile_load_code(tile_code_unpack(tile)), p);
+	}
+
+	static const int offsets[4][2] = {{1,0},{-1,0},{0,1},{0,-1}};
+
+	// Sorted by distance, so the nearest tiles fill the budget first
+	for (uint64_t tile : loading) {
+		TileCode code = tile_code_unpack(tile);
+		for (const auto &o : offsets)
+			add(tile_code_neighbor(code, o[0], o[1]), pos);
+	}
+
+	cpu_cache->prefetch_tiles(pf.tiles.size(), pf.tiles.data(), 
+						   pf.priority.data());
+}
+
 //------------------------------------------------------------------------------
 // Interface
 
@@ -841,11 +736,14 @@ Globe *globe_create(ev2::Device *dev)
 	);
 	globe_init_debug(globe.get());
 
+	frame_arena_init(&globe->frame, GLOBE_FRAME_ARENA_SIZE);
+
 	return globe.release();
 }
 
 void globe_destroy(Globe *globe)
 {
+	frame_arena_destroy(&globe->frame);
 	delete globe;
 }
 
@@ -861,6 +759,13 @@ void globe_imgui(Globe *globe)
 			"Enable globe tile boxes##globe tile boxes")) 
 			globe->dbg.enable_boxes = !globe->dbg.enable_boxes;
 
+		if (ImGui::Button(globe->dbg.full_select ? 
+				"Use incremental tile selection##globe tile selection" : 
+				"Use full tile selection##globe tile selection")
+		) {
+			globe->dbg.full_select = !globe->dbg.full_select;
+		}
+
 		if (ImGui::Button(globe->dbg.fix_camera ? 
 				"Unfix globe camera##globe tile camera" : 
 				"Fix globe camera##globe tile camera")
@@ -868,22 +773,79 @@ void globe_imgui(Globe *globe)
 			globe->dbg.fix_camera = !globe->dbg.fix_camera;
 		}
 		plot_tile_counts(globe->stats.loaded, globe->stats.new_loads);
+
+		ImGui::Text("CPU tiles: %zu / %zu MB", globe->stats.tile_bytes/MEGABYTE, 
+			  globe->stats.tile_budget/MEGABYTE);
+		ImGui::Text("Disk cache: %zu hits, %zu misses", globe->stats.disk_hits,
+			  globe->stats.disk_misses);
+		ImGui::Text("Frame arena: %zu KB, %zu heap allocations", 
+			  globe->stats.frame_bytes/KILOBYTE, globe->stats.frame_heap_allocs);
+		if (ImGui::Button("Simulate memory pressure##globe memory pressure"))
+			globe_memory_pressure(globe, GLOBE_MEMORY_PRESSURE_MODERATE);
 	}
 	ImGui::End();
 
 }
 
+void globe_set_memory_budget(Globe *globe, size_t bytes)
+{
+	tc_set_budget(globe->cpu_cache->tc, bytes);
+}
+
+void globe_memory_pressure(Globe *globe, GlobeMemoryPressure level)
+{
+	switch (level) {
+	case GLOBE_MEMORY_PRESSURE_MODERATE:
+		tc_memory_pressure(globe->cpu_cache->tc, TC_PRESSURE_MODERATE);
+		break;
+	case GLOBE_MEMORY_PRESSURE_CRITICAL:
+		tc_memory_pressure(globe->cpu_cache->tc, TC_PRESSURE_CRITICAL);
+		break;
+	}
+}
+
+GlobeElevation globe_query_elevation(const Globe *globe, const glm::dvec3& p, bool load)
+{
+	glm::dvec2 uv;
+	uint8_t f;
+	globe_to_cube(p, &uv, &f);
+
+	terrain_sample s = globe->cpu_cache->query_elevation(uv, f, load);
+
+	return GlobeElevation{
+		.height = s.height,
+		.error = s.error,
+		.zoom = s.zoom,
+		.exact = s.exact,
+	};
+}
+
 float globe_sample_elevation(const Globe *globe, const glm::dvec3& p)
 {
 	return globe->cpu_cache->sample_elevation_at(p);
 }
 
+void globe_sample_elevation_batch(
+	const Globe *globe, 
+	size_t count,
+	const double *x, 
+	const double *y, 
+	const double *z, 
+	float *out
+)
+{
+	globe->cpu_cache->sample_elevation_batch(count, x, y, z, out);
+}
+
 ev2::Result globe_update(Globe *globe, GlobeUpdateInfo *info)
 {
 	const Camera * p_camera = info->camera; 
 
 	CPUTileCache *cpu_cache = globe->cpu_cache.get();
 
+	frame_arena *arena = &globe->frame;
+	frame_arena_reset(arena);
+
 	if (globe->dbg.fix_camera)
 		p_camera = globe->dbg.camera->get_camera();
 	else {
@@ -907,17 +869,8 @@ ev2::Result globe_update(Globe *globe, GlobeUpdateInfo *info)
 	// Adjust culling frustum to only extend enough so that worst-case
 	// terrain is visible
 	if (true) {
-		double h_max = (double)cpu_cache->max();
-		double h_min = (double)cpu_cache->min();
-
-		double r_min = 1.0 + h_min;
-		double r_max = 1.0 + h_max;
-
-		double r_horizon = sqrt(std::max(dot(pos,pos) - r_min*r_min,0.));
-		double r_horizon_max  = sqrt(std::max(r_max * r_max - r_min*r_min,0.));
-
 		glm::dvec3 n_far = frust.p.far.n;
-		r_cull = r_horizon + r_horizon_max;
+		r_cull = horizon_cull_radius(cpu_cache, pos);
 		frust.p.far.d = dot(pos,n_far) + r_cull;
 	}
 
@@ -925,33 +878,49 @@ ev2::Result globe_update(Globe *globe, GlobeUpdateInfo *info)
 	// Process visible tiles
 	
 	select_tiles_params params = {
-		.cpu_cache = cpu_cache,
-		.debug = &globe->dbg,
+		.mmt = cpu_cache->mmt,
+		.boxes = globe->dbg.enable_boxes ? globe->dbg.boxes.get() : nullptr,
 		.max_tiles = MAX_TILES,
+		.max_mmt_dist = (int)(TILE_WIDTH/TILE_VERT_WIDTH),
 		.cull_radius = r_cull,
+		.occluder_radius = tile_occluder_radius(cpu_cache->mmt),
 		.frust = frust,
 		.frust_box = frustum_aabb(frust),
 		.origin = pos,
 		.res = resolution,
+		.arena = arena,
+		.mmt_changes = cpu_cache->mmt->changes.data(),
+		.mmt_change_count = cpu_cache->mmt->changes.size(),
 	};
 
-	select_tiles(params, globe->selected_tiles);
+	if (globe->dbg.full_select) {
+		select_cut_clear(globe->cut);
+		select_tiles(params, globe->selected_tiles);
+	} else {
+		select_tiles_incremental(params, globe->cut, globe->selected_tiles);
+	}
+	cpu_cache->mmt->changes.clear();
+	params.mmt_changes = nullptr;
+	params.mmt_change_count = 0;
 	size_t count = globe->selected_tiles.size();
 
-	std::vector<uint64_t> loaded_tiles (count, tile_code_pack(TILE_CODE_NONE));
-	std::vector<uint64_t> ideal_tiles = globe->selected_tiles;
+	frame_vector<uint64_t> loaded_tiles (count, tile_code_pack(TILE_CODE_NONE), arena);
+	frame_vector<uint64_t> ideal_tiles (globe->selected_tiles.begin(), 
+									 globe->selected_tiles.end(), arena);
+	frame_vector<tc_priority> priority (count, arena);
 
 	for (size_t i = 0; i < ideal_tiles.size(); ++i) {
-		TileCode code = tile_code_unpack(ideal_tiles[i]);
-		if (code.zoom > 2) {
-			code.idx >>= 4;
-			code.zoom -= 2;
-		}
+		TileCode code = tile_load_code(tile_code_unpack(ideal_tiles[i]));
 		ideal_tiles[i] = tile_code_pack(code);
+		priority[i] = tile_load_priority(code, pos);
 	}
-	cpu_cache->load_tiles(count, ideal_tiles.data(), loaded_tiles.data());
 
-	std::vector<TileGPUIndex> tile_textures;
+	globe_prefetch(globe, params, ideal_tiles);
+	cpu_cache->load_tiles(count, ideal_tiles.data(), priority.data(), 
+					   loaded_tiles.data());
+
+	frame_vector<TileGPUIndex> tile_textures (arena);
+	tile_textures.reserve(count);
 
 	size_t new_count = globe->gpu_cache->update(
 		cpu_cache, loaded_tiles, tile_textures);
@@ -959,8 +928,17 @@ ev2::Result globe_update(Globe *globe, GlobeUpdateInfo *info)
 	ev2::Result result = update_render_data(globe,
 		pos, loaded_tiles, tile_textures);
 	
+	globe->stats.frame_bytes = arena->used;
+	globe->stats.frame_heap_allocs = arena->heap_allocs;
 	globe->stats.new_loads = new_count;
 	globe->stats.loaded = count;
+	globe->stats.tile_bytes = tc_resident_bytes(cpu_cache->tc);
+	globe->stats.tile_budget = tc_budget(cpu_cache->tc);
+
+	dc_stats disk = {};
+	tc_disk_stats(cpu_cache->tc, &disk);
+	globe->stats.disk_hits = disk.hits;
+	globe->stats.disk_misses = disk.misses;
 
 	if (globe->dbg.enable_boxes)
 		globe->dbg.boxes->update();
@@ -976,7 +954,6 @@ void globe_draw(const Globe *globe, const ev2::PassCtx& ctx)
 
 	ev2::Device *dev = globe->dev;
 
-	const ev2::Buffer* vbo = dev->get_buffer(data.vbo); 
 	const ev2::Buffer* ibo = dev->get_buffer(data.ibo); 
 	const ev2::Buffer* indirect = dev->get_buffer(data.indirect); 
 
@@ -990,7 +967,6 @@ void globe_draw(const Globe *globe, const ev2::PassCtx& ctx)
 
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo->id);
 	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect->id);
-	glBindVertexBuffer(0, vbo->id, 0, sizeof(GlobeVertex));
 
 	glMultiDrawElementsIndirect(
 		GL_TRIANGLES, 
@@ -226,14 +226,15 @@ void GPUTileCache::insert(tile_code_t code, TileGPUIndex idx)
 size_t GPUTileCache::update(
 	CPUTileCache const *source,
 	const std::span<tile_code_t> loaded_tiles, 
-	std::vector<TileGPUIndex>& textures
+	frame_vector<TileGPUIndex>& textures
 )
 {
 	size_t tile_count = std::min(loaded_tiles.size(),(size_t)MAX_TILES);
 
 	reserve(static_cast<uint32_t>(tile_count));
 
-	std::vector<TileGPUUploadData> upload_data;
+	// From the same arena as textures, if any
+	frame_vector<TileGPUUploadData> upload_data (textures.get_allocator());
 	size_t offset = 0;
 
 	for (size_t i = 0; i < tile_count; ++i) {
@@ -319,7 +320,7 @@ static void tile_upload_fn(
 	} while (!data.p_state->compare_exchange_weak(gpu_state, TILE_GPU_STATE_UPLOADING,
 											   std::memory_order_acquire, std::memory_order_relaxed));
 
-	memcpy(dst,ref.data,ref.size);
+	tc_ref_decode(ref, reinterpret_cast<float*>(dst));
 
 cleanup:
 	tc_release(ref);
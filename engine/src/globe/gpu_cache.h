@@ -7,6 +7,7 @@
 #include "backends/opengl/def_opengl.h"
 
 #include "terrain.h"
+#include "utils/frame_arena.h"
 
 // STL
 #include <memory>
@@ -112,7 +113,7 @@ public:
 	size_t update(
 		CPUTileCache const *source,
 		const std::span<tile_code_t> tiles, 
-		std::vector<TileGPUIndex>& textures
+		frame_vector<TileGPUIndex>& textures
 	);
 	void bind_textures(uint32_t base) const;
 
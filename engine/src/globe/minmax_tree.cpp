@@ -52,6 +52,7 @@ static void modify_update(mmt_tree *mmt, uint64_t key, mmt_value_t new_val)
 		}
 
 		p_it->second = p_val;
+		mmt->changes.push_back(parent);
 
 		key = parent;
 
@@ -67,6 +68,7 @@ static void insert_update(mmt_tree *mmt, uint64_t key, mmt_value_t new_val)
 
 		if (it == mmt->map.end()) {
 			mmt->map[parent] = new_val;
+			mmt->changes.push_back(parent);
 		} else {
 			mmt_value_t p_val = it->second;
 
@@ -76,6 +78,7 @@ static void insert_update(mmt_tree *mmt, uint64_t key, mmt_value_t new_val)
 
 			it->second.min = std::min(new_val.min, p_val.min);
 			it->second.max = std::max(new_val.max, p_val.max);
+			mmt->changes.push_back(parent);
 		}
 
 		key = parent;
@@ -92,6 +95,8 @@ void mmt_insert(mmt_tree *mmt, uint64_t key, float min, float max)
 		.max = max
 	};
 
+	mmt->changes.push_back(key);
+
 	if (it == end) {
 		mmt->map[key] = new_val;
 		insert_update(mmt, key, new_val);
@@ -113,6 +118,7 @@ int mmt_insert_monotonic(mmt_tree *mmt, uint64_t key, float min, float max)
 
 	if (it == end) {
 		mmt->map[key] = new_val;
+		mmt->changes.push_back(key);
 		insert_update(mmt, key, new_val);
 		return 1;
 	}
@@ -124,6 +130,11 @@ void mmt_remove(mmt_tree *mmt, uint64_t key)
 
 }
 
+bool mmt_contains(const mmt_tree *mmt, uint64_t key)
+{
+	return mmt->map.find(key) != mmt->map.end();
+}
+
 int mmt_create(mmt_tree **p_mmt, mmt_value_t defval)
 {
 	mmt_tree *mmt = new mmt_tree{};
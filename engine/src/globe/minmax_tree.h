@@ -4,6 +4,7 @@
 #include <cstdint>
 
 #include <unordered_map>
+#include <vector>
 
 typedef struct mmt_value_s
 {
@@ -21,6 +22,9 @@ typedef struct mmt_tree_s
 	// TODO: Use a better data structure
 	std::unordered_map<uint64_t, mmt_value_t> map;
 	mmt_value_t defval;		
+	// Keys whose entries were inserted or changed, in order.  Cleared by the
+	// user once read.
+	std::vector<uint64_t> changes;
 } mmt_tree;
 
 extern int mmt_create(mmt_tree **mmt, mmt_value_t defval);
@@ -33,6 +37,8 @@ extern void mmt_insert(mmt_tree *mmt, uint64_t key, float min, float max);
 /// @return 1 if insert was successful, 0 otherwise 
 extern int mmt_insert_monotonic(mmt_tree *mmt, uint64_t key, float min, float max);
 extern void mmt_remove(mmt_tree *mmt, uint64_t key);
+/// @return Whether the key has an entry of its own
+extern bool mmt_contains(mmt_tree const *mmt, uint64_t key);
 extern mmt_result_t mmt_minmax(mmt_tree const *mmt, uint64_t key);
 
 #endif // MINMAX_TREE_H
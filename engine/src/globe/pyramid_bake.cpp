@@ -0,0 +1,337 @@
+#include "tile_pyramid.h"
+#include "tile_quant.h"
+
+#include <ev2/utils/log.h>
+
+#include "utils/thread_pool.h"
+
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//------------------------------------------------------------------------------
+// Output file
+
+struct tp_out
+{
+	uint8_t *base;
+	size_t size;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+};
+
+static int tp_out_map(tp_out *out, const char *path, size_t size)
+{
+	out->size = size;
+#ifdef _WIN32
+	out->file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+						CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (out->file == INVALID_HANDLE_VALUE)
+		return -1;
+
+	LARGE_INTEGER li;
+	li.QuadPart = (LONGLONG)size;
+	if (!SetFilePointerEx(out->file, li, nullptr, FILE_BEGIN) || !SetEndOfFile(out->file))
+		return -1;
+
+	out->mapping = CreateFileMappingA(out->file, nullptr, PAGE_READWRITE,
+								  li.HighPart, li.LowPart, nullptr);
+	if (!out->mapping)
+		return -1;
+
+	out->base = static_cast<uint8_t*>(MapViewOfFile(out->mapping, FILE_MAP_ALL_ACCESS, 0, 0, size));
+	return out->base ? 0 : -1;
+#else
+	out->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (out->fd < 0)
+		return -1;
+
+	if (ftruncate(out->fd, (off_t)size) < 0)
+		return -1;
+
+	void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, out->fd, 0);
+	if (mem == MAP_FAILED)
+		return -1;
+
+	out->base = static_cast<uint8_t*>(mem);
+	return 0;
+#endif
+}
+
+// Everything before the header reaches the file first
+static void tp_out_flush(tp_out *out)
+{
+#ifdef _WIN32
+	FlushViewOfFile(out->base, out->size);
+#else
+	msync(out->base, out->size, MS_SYNC);
+#endif
+}
+
+static void tp_out_unmap(tp_out *out)
+{
+#ifdef _WIN32
+	if (out->base)
+		UnmapViewOfFile(out->base);
+	if (out->mapping)
+		CloseHandle(out->mapping);
+	if (out->file && out->file != INVALID_HANDLE_VALUE)
+		CloseHandle(out->file);
+#else
+	if (out->base)
+		munmap(out->base, out->size);
+	if (out->fd >= 0)
+		close(out->fd);
+#endif
+}
+
+//------------------------------------------------------------------------------
+// Baking
+
+// Runs fn(i) for every i below count, from at most threads tasks at once,
+// and waits for them.  Tasks take the next index as they finish one, so
+// uneven tiles still keep every thread busy.
+template<typename F>
+static void tp_parallel_for(size_t count, uint32_t threads, const F &fn)
+{
+	std::atomic_size_t next = 0;
+	std::mutex mut;
+	std::condition_variable cv;
+	uint32_t running = (uint32_t)std::min((size_t)threads, count);
+
+	for (uint32_t t = 0, n = running; t < n; ++t) {
+		g_schedule_task([&]() {
+			for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;)
+				fn(i);
+
+			std::unique_lock<std::mutex> lock(mut);
+			if (!--running)
+				cv.notify_one();
+		});
+	}
+
+	std::unique_lock<std::mutex> lock(mut);
+	cv.wait(lock, [&]() { return !running; });
+}
+
+static int never_cancelled(struct ds_token *)
+{
+	return 0;
+}
+
+struct tp_bake_tile
+{
+	uint64_t code;
+	size_t entry;
+};
+
+// Texel i of a tile lies on texel 2i of its children, counting the shared
+// edge once, so copying every other texel gives what the source would have
+// loaded for the tile itself.
+static void tp_downsample(const float *children[4], float *dst)
+{
+	static constexpr uint32_t HALF = TILE_WIDTH/2;
+	static constexpr uint32_t LAST = TILE_WIDTH - 1;
+
+	for (uint32_t i = 0; i < TILE_WIDTH; ++i) {
+		uint32_t cy = i < HALF ? 0 : 1;
+		uint32_t row = 2*i - cy*LAST;
+
+		const float *lo = children[2*cy] + (size_t)row*TILE_WIDTH;
+		const float *hi = children[2*cy + 1] + (size_t)row*TILE_WIDTH;
+		float *out = dst + (size_t)i*TILE_WIDTH;
+
+		for (uint32_t j = 0; j < HALF; ++j)
+			out[j] = lo[2*j];
+		for (uint32_t j = HALF; j < TILE_WIDTH; ++j)
+			out[j] = hi[2*j - LAST];
+	}
+}
+
+int tp_bake(const tp_bake_params *params, tp_bake_stats *stats)
+{
+	uint8_t max_zoom = params->max_zoom;
+	if (max_zoom >= TP_MAX_LEVELS || 2*(size_t)max_zoom > 56) {
+		log_error("tp_bake : zoom %u is too fine", max_zoom);
+		return -1;
+	}
+
+	std::vector<uint64_t> roots (params->roots, params->roots + params->root_count);
+	if (roots.empty()) {
+		for (uint8_t f = 0; f < CUBE_FACES; ++f)
+			roots.push_back(tile_code_pack(TileCode{.face = f, .zoom = 0, .idx = 0}));
+	}
+
+	// Morton indices of the tiles on each face at each zoom
+	std::vector<uint64_t> levels[TP_MAX_LEVELS][CUBE_FACES];
+
+	for (uint64_t root : roots) {
+		TileCode r = tile_code_unpack(root);
+		if (r.face >= CUBE_FACES || r.zoom > max_zoom) {
+			log_error("tp_bake : tile %llx is not on a face, or is past zoom %u",
+				(unsigned long long)root, max_zoom);
+			return -1;
+		}
+
+		for (uint8_t z = 0; z <= max_zoom; ++z) {
+			std::vector<uint64_t> &level = levels[z][r.face];
+
+			if (z < r.zoom) {
+				level.push_back(r.idx >> 2*(r.zoom - z));
+				continue;
+			}
+
+			uint64_t shift = 2*(uint64_t)(z - r.zoom);
+			for (uint64_t idx = r.idx << shift; idx < (r.idx + 1) << shift; ++idx)
+				level.push_back(idx);
+		}
+	}
+
+	tp_file_header hdr = {};
+	memcpy(hdr.magic, TP_MAGIC, sizeof(TP_MAGIC));
+	hdr.file_version = TP_FILE_VERSION;
+	hdr.tile_width = TILE_WIDTH;
+	hdr.max_zoom = max_zoom;
+
+	for (uint8_t z = 0; z <= max_zoom; ++z) {
+		for (uint8_t f = 0; f < CUBE_FACES; ++f) {
+			std::vector<uint64_t> &level = levels[z][f];
+			std::sort(level.begin(), level.end());
+			level.erase(std::unique(level.begin(), level.end()), level.end());
+
+			hdr.levels[z][f] = tp_level{.first = hdr.tile_count, .count = level.size()};
+			hdr.tile_count += level.size();
+		}
+	}
+
+	hdr.index_offset = TP_INDEX_OFFSET;
+	hdr.data_offset = align_up(TP_INDEX_OFFSET + hdr.tile_count*sizeof(tp_entry), TP_ALIGN);
+
+	// Tiles loaded from the source, then those downsampled at each zoom
+	std::vector<tp_bake_tile> loads;
+	std::vector<tp_bake_tile> downsamples[TP_MAX_LEVELS];
+
+	for (uint8_t z = 0; z <= max_zoom; ++z) {
+		for (uint8_t f = 0; f < CUBE_FACES; ++f) {
+			const std::vector<uint64_t> &level = levels[z][f];
+			const std::vector<uint64_t> *finer = z < max_zoom ? &levels[z + 1][f] : nullptr;
+
+			for (size_t i = 0; i < level.size(); ++i) {
+				tp_bake_tile tile = {
+					.code = tile_code_pack(TileCode{.face = f, .zoom = z, .idx = level[i]}),
+					.entry = hdr.levels[z][f].first + i,
+				};
+
+				bool children = false;
+				if (finer) {
+					auto it = std::lower_bound(finer->begin(), finer->end(), level[i] << 2);
+					children = finer->end() - it >= 4 && it[3] == (level[i] << 2) + 3;
+				}
+
+				if (children)
+					downsamples[z].push_back(tile);
+				else
+					loads.push_back(tile);
+			}
+		}
+	}
+
+	tp_out out = {};
+#ifdef _WIN32
+	out.file = INVALID_HANDLE_VALUE;
+#else
+	out.fd = -1;
+#endif
+
+	size_t size = hdr.data_offset + hdr.tile_count*TP_TILE_BYTES;
+	if (tp_out_map(&out, params->path, size) < 0) {
+		log_error("tp_bake : failed to map %s", params->path);
+		tp_out_unmap(&out);
+		return -1;
+	}
+
+	tp_entry *entries = reinterpret_cast<tp_entry*>(out.base + hdr.index_offset);
+	auto tile_data = [&](size_t entry) {
+		return reinterpret_cast<float*>(out.base + hdr.data_offset + entry*TP_TILE_BYTES);
+	};
+
+	uint32_t threads = params->threads ? params->threads :
+		std::max(std::thread::hardware_concurrency(), 1U);
+
+	log_info("tp_bake : %llu tiles to zoom %u, %zu loaded from the source",
+		(unsigned long long)hdr.tile_count, max_zoom, loads.size());
+
+	tp_parallel_for(loads.size(), threads, [&](size_t i) {
+		static const ds_token_vtbl vtbl = {.is_cancelled = never_cancelled};
+		ds_token tok = {.usr = nullptr, .vtbl = &vtbl};
+
+		const tp_bake_tile &tile = loads[i];
+		ds_buf buf = {.dst = tile_data(tile.entry), .size = TILE_SIZE*sizeof(float)};
+		params->ds->vtbl.loader(params->ds->usr, tile.code, &buf, &tok);
+
+		tp_entry &e = entries[tile.entry];
+		e.idx = tile_code_unpack(tile.code).idx;
+		tile_minmax_f32(tile_data(tile.entry), TILE_SIZE, &e.min, &e.max);
+	});
+
+	// Each zoom only reads the one below, which is done by now
+	for (int z = (int)max_zoom - 1; z >= 0; --z) {
+		const std::vector<tp_bake_tile> &tiles = downsamples[z];
+
+		tp_parallel_for(tiles.size(), threads, [&](size_t i) {
+			const tp_bake_tile &tile = tiles[i];
+			TileCode code = tile_code_unpack(tile.code);
+
+			// The four children are next to each other in the level below
+			const std::vector<uint64_t> &finer = levels[code.zoom + 1][code.face];
+			size_t first = hdr.levels[code.zoom + 1][code.face].first + (size_t)(
+				std::lower_bound(finer.begin(), finer.end(), code.idx << 2) - finer.begin());
+
+			const float *children[4];
+			for (uint32_t q = 0; q < 4; ++q)
+				children[q] = tile_data(first + q);
+
+			tp_downsample(children, tile_data(tile.entry));
+
+			tp_entry &e = entries[tile.entry];
+			e.idx = code.idx;
+			tile_minmax_f32(tile_data(tile.entry), TILE_SIZE, &e.min, &e.max);
+		});
+	}
+
+	hdr.min = FLT_MAX;
+	hdr.max = -FLT_MAX;
+	for (size_t i = 0; i < hdr.tile_count; ++i) {
+		hdr.min = std::min(hdr.min, entries[i].min);
+		hdr.max = std::max(hdr.max, entries[i].max);
+	}
+
+	tp_out_flush(&out);
+	memcpy(out.base, &hdr, sizeof(hdr));
+	tp_out_unmap(&out);
+
+	if (stats) {
+		*stats = tp_bake_stats{
+			.loaded = loads.size(),
+			.downsampled = hdr.tile_count - loads.size(),
+			.bytes = size,
+		};
+	}
+
+	return 0;
+}
@@ -0,0 +1,151 @@
+#include <ev2/globe/pyramid_source.h>
+#include <ev2/utils/log.h>
+
+#include "tile_pyramid.h"
+
+#include <algorithm>
+#include <cstring>
+
+static int pyramid_loader_fn(void *usr, uint64_t id, 
+					struct ds_buf *buf, struct ds_token *token);
+static_assert(std::is_same<decltype(&pyramid_loader_fn), ds_load_fn>::value);
+
+static uint64_t pyramid_find(void *usr, uint64_t id);
+static float sample(void *usr, double u, double v, uint8_t f);
+static float min_val(void *usr);
+static float max_val(void *usr);
+
+static void destroy(struct ds_context *ctx);
+
+int pyramid_data_source_init(struct ds_context **p_ctx, const char *path)
+{
+	tp_file *file = new tp_file;
+	if (tp_open(file, path) < 0) {
+		delete file;
+		return -1;
+	}
+
+	const tp_file_header *hdr = tp_header(file);
+	log_info("Opened tile pyramid %s : %llu tiles, zoom 0 to %u", path,
+		(unsigned long long)hdr->tile_count, hdr->max_zoom);
+
+	struct ds_context *ctx = new ds_context;
+	*ctx = ds_context{
+		.usr = file,
+		.vtbl = {
+			.destroy = destroy,
+
+			.loader = pyramid_loader_fn,
+			.find = pyramid_find,
+
+			.sample = sample,
+			// Each point is a lookup of its tile, batching would gain little
+			.sample_batch = nullptr,
+			.max = max_val,
+			.min = min_val,
+		}
+	};
+
+	*p_ctx = ctx;
+	return 0;
+}
+
+//------------------------------------------------------------------------------
+// Pyramid loader functions
+
+void destroy(struct ds_context *ctx)
+{
+	tp_file *file = static_cast<tp_file*>(ctx->usr);
+	tp_close(file);
+	delete file;
+	delete ctx;
+}
+
+// Tiles finer than the file has are drawn from the nearest one it does
+uint64_t pyramid_find(void *usr, uint64_t id)
+{
+	const tp_file *file = static_cast<const tp_file*>(usr);
+
+	size_t entry;
+	uint64_t code = tp_find_nearest(file, id, &entry);
+
+	// Loads as a flat tile
+	if (code == TILE_CODE_NONE_U)
+		return tile_code_ancestor(id, 0);
+
+	return code;
+}
+
+float min_val(void *usr)
+{
+	return tp_header(static_cast<const tp_file*>(usr))->min;
+}
+
+float max_val(void *usr)
+{
+	return tp_header(static_cast<const tp_file*>(usr))->max;
+}
+
+float sample(void *usr, double u, double v, uint8_t f)
+{
+	const tp_file *file = static_cast<const tp_file*>(usr);
+
+	u = std::clamp(u, 0.0, 1.0);
+	v = std::clamp(v, 0.0, 1.0);
+
+	uint8_t zoom = (uint8_t)tp_header(file)->max_zoom;
+	uint64_t code = tile_code_pack(TileCode{
+		.face = f,
+		.zoom = zoom,
+		.idx = morton_u64(u, v, zoom)
+	});
+
+	size_t entry;
+	code = tp_find_nearest(file, code, &entry);
+	if (code == TILE_CODE_NONE_U)
+		return 0;
+
+	TileCode c = tile_code_unpack(code);
+	aabb2_t rect = morton_u64_to_rect_f64(c.idx, c.zoom);
+
+	// Texels sit on the corners and edges of the tile
+	double scale = (double)(TILE_WIDTH - 1)/(rect.max.x - rect.min.x);
+	double x = std::clamp((u - rect.min.x)*scale, 0.0, (double)(TILE_WIDTH - 1));
+	double y = std::clamp((v - rect.min.y)*scale, 0.0, (double)(TILE_WIDTH - 1));
+
+	uint32_t x0 = std::min((uint32_t)x, TILE_WIDTH - 2);
+	uint32_t y0 = std::min((uint32_t)y, TILE_WIDTH - 2);
+	float tx = (float)(x - x0);
+	float ty = (float)(y - y0);
+
+	const float *row0 = tp_tile_data(file, entry) + (size_t)y0*TILE_WIDTH;
+	const float *row1 = row0 + TILE_WIDTH;
+
+	float h0 = row0[x0] + (row0[x0 + 1] - row0[x0])*tx;
+	float h1 = row1[x0] + (row1[x0 + 1] - row1[x0])*tx;
+
+	return h0 + (h1 - h0)*ty;
+}
+
+int pyramid_loader_fn(
+	void *usr, uint64_t id, struct ds_buf *buf, struct ds_token *token)
+{
+	const tp_file *file = static_cast<const tp_file*>(usr);
+
+	size_t size = std::min(buf->size, TILE_SIZE*sizeof(float));
+
+	size_t entry;
+	if (!tp_find(file, id, &entry)) {
+		memset(buf->dst, 0, buf->size);
+		return 0;
+	}
+
+	if (token->vtbl->is_cancelled(token))
+		return 0;
+
+	// Faults the tile in from the file if it is not in the page cache
+	tp_will_need(file, entry);
+	memcpy(buf->dst, tp_tile_data(file, entry), size);
+
+	return 0;
+}
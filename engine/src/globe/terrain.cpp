@@ -1,18 +1,42 @@
 #include <ev2/globe/test_source.h>
+#include <ev2/globe/pyramid_source.h>
 
 #include "terrain.h"
+#include "tile_quant.h"
+#include "utils/page_alloc.h"
 
 #include <algorithm>
+#include <filesystem>
+#include <cfloat>
 
 CPUTileCache 
 *CPUTileCache::create()
 {
 	CPUTileCache *source = new CPUTileCache{};
 
-	if (test_data_source_init(&source->ds))
+	tc_params params = {
+		.tile_size = TILE_SIZE*sizeof(float),
+		.capacity = (size_t)1*GIGABYTE,
+		.format = TERRAIN_TILE_FORMAT,
+		// Tiles are copied out whole, so fewer TLB misses help uploads.  Not 
+		// PAGE_ALLOC_HUGETLB, which reserves the whole capacity from the pool
+		// up front.
+		.page_flags = PAGE_ALLOC_THP,
+		.numa_node = PAGE_ALLOC_NODE_ANY,
+		.disk_path = TERRAIN_DISK_CACHE_PATH,
+		.disk_capacity = TERRAIN_DISK_CACHE_SIZE,
+		.disk_version = TERRAIN_DISK_CACHE_VERSION,
+	};
+
+	// Tiles from a file are already a copy away, so they skip the disk cache
+	if (std::filesystem::exists(TERRAIN_PYRAMID_PATH) &&
+		!pyramid_data_source_init(&source->ds, TERRAIN_PYRAMID_PATH)) {
+		params.disk_path = nullptr;
+	} else if (test_data_source_init(&source->ds)) {
 		goto create_failed;
+	}
 
-	if (tc_create(&source->tc, TILE_SIZE*sizeof(float), (size_t)1*GIGABYTE))
+	if (tc_create(&source->tc, &params))
 		goto create_failed;
 
 	if (mmt_create(&source->mmt, mmt_value_t{.min = - 0.1f, .max = 0.1f}))
@@ -37,21 +61,10 @@ CPUTileCache::~CPUTileCache()
 	mmt_destroy(mmt);
 }
 
-static void post_load(void* usr, uint64_t code, const ds_buf *buf)
+static void post_load(void* usr, uint64_t code, const ds_buf *buf, float min, float max)
 {
 	CPUTileCache *cache = static_cast<CPUTileCache*>(usr);
 
-	size_t count = buf->size/sizeof(float);
-
-	float *data = static_cast<float*>(buf->dst);
-	float min = FLT_MAX, max = -FLT_MAX;
-
-	for (size_t i = 0; i < count; ++i) {
-		float f = data[i];
-		min = std::min(min, f);
-		max = std::max(max, f);
-	}
-
 	std::unique_lock<std::mutex> lock(cache->sync);
 	cache->updates.push_back(mmt_update{
 		.min = min, 
@@ -60,7 +73,12 @@ static void post_load(void* usr, uint64_t code, const ds_buf *buf)
 	});
 }
 
-void CPUTileCache::load_tiles(size_t count, const tile_code_t *tiles, tile_code_t *out)
+void CPUTileCache::load_tiles(
+	size_t count, 
+	const tile_code_t *tiles, 
+	const tc_priority *priority, 
+	tile_code_t *out
+)
 {
 
 	tc_error err = tc_load(
@@ -70,6 +88,7 @@ void CPUTileCache::load_tiles(size_t count, const tile_code_t *tiles, tile_code_
 		post_load,
 		count, 
 		tiles,
+		priority,
 		out
 	);
 
@@ -95,9 +114,118 @@ void CPUTileCache::load_tiles(size_t count, const tile_code_t *tiles, tile_code_
 	working.clear();
 }
 
+void CPUTileCache::prefetch_tiles(
+	size_t count, 
+	const tile_code_t *tiles, 
+	const tc_priority *priority
+)
+{
+	tc_prefetch(tc, ds, count, tiles, priority);
+
+	{ std::unique_lock<std::mutex> lock(query_sync);
+		query_working.swap(query_requests);
+	}
+
+	if (query_working.empty())
+		return;
+
+	std::sort(query_working.begin(), query_working.end());
+	query_working.erase(std::unique(query_working.begin(), query_working.end()),
+					 query_working.end());
+
+	// Ahead of the tiles predicted to come into view, which may never be 
+	// needed
+	std::vector<tc_priority> p (query_working.size(), tc_priority{
+		.error = FLT_MAX,
+		.dist = 0
+	});
+
+	tc_prefetch(tc, ds, query_working.size(), query_working.data(), p.data());
+
+	query_working.clear();
+}
+
+// Finest tile the source has, which queries are measured against 
+static uint64_t query_tile(const ds_context *ds, glm::dvec2 uv, uint8_t f)
+{
+	uint64_t code = tile_code_pack(TileCode{
+		.face = f,
+		.zoom = TERRAIN_QUERY_ZOOM,
+		.idx = morton_u64(uv.x, uv.y, TERRAIN_QUERY_ZOOM)
+	});
+
+	return ds->vtbl.find(ds->usr, code);
+}
+
+// Past 1, the Morton index of a point wraps to the other edge of the face
+static glm::dvec2 query_uv(glm::dvec2 uv)
+{
+	return glm::clamp(uv, 0.0, 1.0 - DBL_EPSILON);
+}
+
+static float sample_tile(const tc_ref &ref, uint64_t code, glm::dvec2 uv, float *p_spread)
+{
+	TileCode c = tile_code_unpack(code);
+	aabb2_t rect = morton_u64_to_rect_f64(c.idx, c.zoom);
+
+	double scale = (double)(TILE_WIDTH - 1)/(rect.max.x - rect.min.x);
+
+	return tc_ref_sample(ref, (uv.x - rect.min.x)*scale, 
+					  (uv.y - rect.min.y)*scale, p_spread);
+}
+
+static float quant_error(const tc_ref &ref)
+{
+	if (ref.format != TC_FORMAT_U16)
+		return 0;
+	return 0.5f*tile_quant_step(ref.min, ref.max);
+}
+
+terrain_sample CPUTileCache::query_elevation(glm::dvec2 uv, uint8_t f, bool load) const
+{
+	uv = query_uv(uv);
+	uint64_t want = query_tile(ds, uv, f);
+
+	tc_ref ref;
+	uint64_t found;
+	if (tc_acquire_nearest(tc, want, &ref, &found) != TC_OK) {
+		// Nothing covering the point is loaded yet
+		if (load) {
+			std::unique_lock<std::mutex> lock(query_sync);
+			query_requests.push_back(want);
+		}
+
+		return terrain_sample{
+			.height = ds->vtbl.sample(ds->usr, uv.x, uv.y, f),
+			.error = 0,
+			.zoom = tile_code_zoom(want),
+			.exact = true,
+		};
+	}
+
+	bool exact = found == want;
+
+	float spread = 0;
+	terrain_sample res = {
+		.height = sample_tile(ref, found, uv, exact ? nullptr : &spread),
+		.error = quant_error(ref) + spread,
+		.zoom = tile_code_zoom(found),
+		.exact = exact,
+	};
+
+	tc_release(ref);
+
+	if (!exact && load) {
+		std::unique_lock<std::mutex> lock(query_sync);
+		query_requests.push_back(want);
+	}
+
+	return res;
+}
+
 float CPUTileCache::sample_elevation_at(glm::dvec2 uv, uint8_t f) const
 {
-	return ds->vtbl.sample(ds->usr, uv.x, uv.y, f);
+	return query_elevation(uv, f, false).height;
 }
 
 float CPUTileCache::sample_elevation_at(glm::dvec3 p) const
@@ -106,7 +234,87 @@ float CPUTileCache::sample_elevation_at(glm::dvec3 p) const
 	uint8_t f;
 	globe_to_cube(p, &uv, &f);
 
-	return ds->vtbl.sample(ds->usr, uv.x, uv.y, f);
+	return query_elevation(uv, f, false).height;
+}
+
+void CPUTileCache::sample_elevation_batch(
+	size_t count, 
+	const double *x, 
+	const double *y, 
+	const double *z, 
+	float *out
+) const
+{
+	// Tile each point is measured against, and where it came from
+	std::vector<std::pair<uint64_t, size_t>> order (count);
+	std::vector<glm::dvec2> uv (count);
+
+	for (size_t i = 0; i < count; ++i) {
+		uint8_t f;
+		globe_to_cube(glm::dvec3(x[i], y[i], z[i]), &uv[i], &f);
+
+		uv[i] = query_uv(uv[i]);
+		order[i] = {query_tile(ds, uv[i], f), i};
+	}
+
+	// By face first, so that points left for the source are in runs of one
+	auto face = [](uint64_t code) {
+		return (uint8_t)((code >> TILE_CODE_FACE_SHIFT) & TILE_CODE_FACE_MASK);
+	};
+	std::sort(order.begin(), order.end(), [&](const auto &a, const auto &b) {
+		uint8_t fa = face(a.first), fb = face(b.first);
+		return fa != fb ? fa < fb : a < b;
+	});
+
+	// Points with no loaded tile, in the same order
+	std::vector<std::pair<uint64_t, size_t>> missed;
+
+	for (size_t first = 0; first < count;) {
+		uint64_t want = order[first].first;
+
+		size_t last = first + 1;
+		while (last < count && order[last].first == want)
+			++last;
+
+		tc_ref ref;
+		uint64_t found;
+		if (tc_acquire_nearest(tc, want, &ref, &found) == TC_OK) {
+			for (size_t k = first; k < last; ++k) {
+				size_t i = order[k].second;
+				out[i] = sample_tile(ref, found, uv[i], nullptr);
+			}
+			tc_release(ref);
+		} else {
+			missed.insert(missed.end(), order.begin() + first, order.begin() + last);
+		}
+
+		first = last;
+	}
+
+	if (missed.empty())
+		return;
+
+	std::vector<double> u (missed.size()), v (missed.size());
+	std::vector<float> h (missed.size());
+	for (size_t k = 0; k < missed.size(); ++k) {
+		u[k] = uv[missed[k].second].x;
+		v[k] = uv[missed[k].second].y;
+	}
+
+	for (size_t first = 0; first < missed.size();) {
+		uint8_t f = face(missed[first].first);
+
+		size_t last = first + 1;
+		while (last < missed.size() && face(missed[last].first) == f)
+			++last;
+
+		ds_sample_batch(ds, u.data() + first, v.data() + first, f, 
+				  last - first, h.data() + first);
+		first = last;
+	}
+
+	for (size_t k = 0; k < missed.size(); ++k)
+		out[missed[k].second] = h[k];
 }
 
 std::pair<float,float> CPUTileCache::tile_minmax(TileCode code) const
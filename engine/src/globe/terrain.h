@@ -9,6 +9,38 @@
 #include <mutex>
 #include <vector>
 
+// Quantized heights are off by about half a 65535th of their tile's range
+static constexpr tc_format TERRAIN_TILE_FORMAT = TC_FORMAT_U16;
+
+// Used instead of the test source if it exists, relative to the working 
+// directory
+static constexpr const char *TERRAIN_PYRAMID_PATH = "ev2_terrain.pyramid";
+
+// Tiles from the test source are kept here between runs, relative to the 
+// working directory
+static constexpr const char *TERRAIN_DISK_CACHE_PATH = "ev2_terrain_tiles.cache";
+static constexpr size_t TERRAIN_DISK_CACHE_SIZE = 4*GIGABYTE;
+// Change whenever the test source produces different tiles
+static constexpr uint64_t TERRAIN_DISK_CACHE_VERSION = 3;
+
+// Elevation queries look for the tile the source maps this zoom to
+static constexpr uint8_t TERRAIN_QUERY_ZOOM = 20;
+
+struct terrain_sample
+{
+	float height;
+	// Difference from interpolating the finest tile the source has for the
+	// point.  Half a quantization step for that tile, which bounds it.  From
+	// an ancestor, the spread of the texels used is added as an estimate of
+	// the detail missing, which finer terrain can still exceed.
+	float error;
+	// Zoom of the tile interpolated
+	uint8_t zoom;
+	// Whether it was the finest tile, or the source if no tile covering the
+	// point was loaded
+	bool exact;
+};
+
 struct mmt_update
 {
 	float min, max;
@@ -27,15 +59,29 @@ struct CPUTileCache
 	std::vector<mmt_update> updates;
 	std::vector<mmt_update> working;
 
+	// Tiles elevation queries asked for, prefetched on the next frame
+	mutable std::mutex query_sync;
+	mutable std::vector<uint64_t> query_requests;
+	std::vector<uint64_t> query_working;
+
 	int m_debug_zoom = 8;
 
 	static CPUTileCache *create();
 	~CPUTileCache();
 
-	void load_tiles(size_t count, const tile_code_t *tiles, tile_code_t *out);
+	void load_tiles(size_t count, const tile_code_t *tiles, 
+				 const tc_priority *priority, tile_code_t *out);
+	void prefetch_tiles(size_t count, const tile_code_t *tiles, 
+					 const tc_priority *priority);
+
+	// Heights are interpolated from the finest loaded tile covering the 
+	// point.  With load set, the finest tile is prefetched if it is missing.
+	terrain_sample query_elevation(glm::dvec2 uv, uint8_t f, bool load) const;
 
 	float sample_elevation_at(glm::dvec2 uv, uint8_t f) const;
 	float sample_elevation_at(glm::dvec3 p) const;
+	void sample_elevation_batch(size_t count, const double *x, const double *y,
+							 const double *z, float *out) const;
 
 	std::pair<float,float> tile_minmax(TileCode tile) const;
 
@@ -1,6 +1,12 @@
 #include <ev2/globe/test_source.h>
 #include <ev2/utils/functions.h>
 
+#include <algorithm>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 static float test_elev_fn(glm::dvec2 uv, uint8_t f);
 
 static int test_loader_fn(void *usr, uint64_t id, 
@@ -9,6 +15,8 @@ static_assert(std::is_same<decltype(&test_loader_fn), ds_load_fn>::value);
 
 static uint64_t test_loader_find(void *usr, uint64_t id);
 static float sample(void *usr, double u, double v, uint8_t f);
+static void sample_batch(void *usr, const double *u, const double *v, uint8_t f,
+						 size_t count, float *out);
 static float min_val(void *usr);
 static float max_val(void *usr);
 
@@ -26,6 +34,7 @@ int test_data_source_init(struct ds_context **p_ctx)
 			.find = test_loader_find,
 
 			.sample = sample,
+			.sample_batch = sample_batch,
 			.max = max_val,
 			.min = min_val,
 		}
@@ -83,36 +92,269 @@ float test_elev_fn(glm::dvec2 uv, uint8_t f)
 	return (float)g;
 }
 
+//------------------------------------------------------------------------------
+// Tile evaluation
+//
+// Along a row of a tile y is fixed and x steps by a constant, so the 
+// r*cos(tht - a_m) of weierstrass is x*cos(a_m) + y*sin(a_m), and the 
+// argument of every cosine is linear in the column.  Each term is kept as a
+// start and a step in turns, and the cosine is a polynomial after taking the
+// nearest whole turn away, which needs no hypot, atan2 or range reduction
+// per texel.  Scattered points use the same terms with x0 = 0 and dx = 1,
+// so that the argument is base + x*dt + y*ky.
+
+static constexpr size_t TEST_TERMS = WEIERSTRASS_M*WEIERSTRASS_N;
+
+struct test_row_terms
+{
+	// Per term, the argument at the first column is base + y*ky, and each
+	// column adds dt
+	double base[TEST_TERMS];
+	double ky[TEST_TERMS];
+	double dt[TEST_TERMS];
+	double weight[TEST_TERMS];
+
+	// Per row
+	double t0[TEST_TERMS];
+
+	// Sum of weight*cos(phi), the part that does not depend on the texel
+	double bias;
+	double A;
+};
+
+static void test_terms_init(test_row_terms *terms, double x0, double dx, double phase)
+{
+	static constexpr double L = WEIERSTRASS_L;
+	static constexpr size_t M = WEIERSTRASS_M, N = WEIERSTRASS_N;
+
+	const weierstrass_table &t = weierstrass_get_table();
+
+	terms->bias = 0;
+	terms->A = t.A;
+
+	for (size_t m = 0; m < M; ++m) {
+		double c = cos(PI*(double)m/M);
+		double s = sin(PI*(double)m/M);
+
+		for (size_t n = 0; n < N; ++n) {
+			size_t k = m*N + n;
+			double freq = t.gamman[n]/L;
+
+			terms->base[k] = freq*x0*c + (phase + t.phi[m][n])/TWOPI;
+			terms->ky[k] = freq*s;
+			terms->dt[k] = freq*dx*c;
+			terms->weight[k] = t.gammaD3n[n];
+
+			terms->bias += t.gammaD3n[n]*t.cos_phi[m][n];
+		}
+	}
+}
+
+static void test_terms_set_row(test_row_terms *terms, double y)
+{
+	for (size_t k = 0; k < TEST_TERMS; ++k) {
+		double t0 = terms->base[k] + y*terms->ky[k];
+		terms->t0[k] = t0 - nearbyint(t0);
+	}
+}
+
+#ifdef __AVX2__
+// a*b + c, fused where the target has FMA
+static inline __m256d madd_pd(__m256d a, __m256d b, __m256d c)
+{
+#ifdef __FMA__
+	return _mm256_fmadd_pd(a, b, c);
+#else
+	return _mm256_add_pd(_mm256_mul_pd(a, b), c);
+#endif
+}
+
+// cos(2*pi*r) for |r| <= 1/2, as 1 - 2*sin(pi*r)^2 with sin to degree 13.
+// Off by less than 2e-9.
+static inline __m256d cos_turns_pd(__m256d r)
+{
+	const __m256d one = _mm256_set1_pd(1.0);
+
+	__m256d x = _mm256_mul_pd(r, _mm256_set1_pd(PI));
+	__m256d x2 = _mm256_mul_pd(x, x);
+
+	__m256d p = _mm256_set1_pd(1.0/6227020800.0);
+	p = madd_pd(p, x2, _mm256_set1_pd(-1.0/39916800.0));
+	p = madd_pd(p, x2, _mm256_set1_pd(1.0/362880.0));
+	p = madd_pd(p, x2, _mm256_set1_pd(-1.0/5040.0));
+	p = madd_pd(p, x2, _mm256_set1_pd(1.0/120.0));
+	p = madd_pd(p, x2, _mm256_set1_pd(-1.0/6.0));
+	p = madd_pd(p, x2, one);
+
+	__m256d s = _mm256_mul_pd(p, x);
+	return _mm256_sub_pd(one, _mm256_mul_pd(_mm256_add_pd(s, s), s));
+}
+#endif
+
+// weierstrass at count columns of the current row, count a multiple of 8
+static void test_row_eval(const test_row_terms *terms, size_t count, double *g)
+{
+#ifdef __AVX2__
+	static constexpr int ROUND = _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC;
+
+	const __m256d bias = _mm256_set1_pd(terms->bias);
+	const __m256d A = _mm256_set1_pd(terms->A);
+	const __m256d four = _mm256_set1_pd(4.0);
+
+	for (size_t j = 0; j < count; j += 8) {
+		__m256d j0 = _mm256_setr_pd((double)j, (double)(j + 1), 
+							  (double)(j + 2), (double)(j + 3));
+		__m256d j1 = _mm256_add_pd(j0, four);
+
+		__m256d acc0 = bias;
+		__m256d acc1 = bias;
+
+		for (size_t k = 0; k < TEST_TERMS; ++k) {
+			__m256d t0 = _mm256_set1_pd(terms->t0[k]);
+			__m256d dt = _mm256_set1_pd(terms->dt[k]);
+			__m256d w = _mm256_set1_pd(terms->weight[k]);
+
+			__m256d a0 = madd_pd(j0, dt, t0);
+			__m256d a1 = madd_pd(j1, dt, t0);
+			a0 = _mm256_sub_pd(a0, _mm256_round_pd(a0, ROUND));
+			a1 = _mm256_sub_pd(a1, _mm256_round_pd(a1, ROUND));
+
+			acc0 = _mm256_sub_pd(acc0, _mm256_mul_pd(w, cos_turns_pd(a0)));
+			acc1 = _mm256_sub_pd(acc1, _mm256_mul_pd(w, cos_turns_pd(a1)));
+		}
+
+		_mm256_storeu_pd(g + j, _mm256_mul_pd(A, acc0));
+		_mm256_storeu_pd(g + j + 4, _mm256_mul_pd(A, acc1));
+	}
+#else
+	for (size_t j = 0; j < count; ++j) {
+		double acc = terms->bias;
+		for (size_t k = 0; k < TEST_TERMS; ++k)
+			acc -= terms->weight[k]*cos(TWOPI*(terms->t0[k] + (double)j*terms->dt[k]));
+		g[j] = terms->A*acc;
+	}
+#endif
+}
+
+// weierstrass at count points given by their x and y
+static void test_points_eval(const test_row_terms *terms, const double *x, 
+							 const double *y, size_t count, double *g)
+{
+	size_t j = 0;
+
+#ifdef __AVX2__
+	static constexpr int ROUND = _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC;
+
+	const __m256d bias = _mm256_set1_pd(terms->bias);
+	const __m256d A = _mm256_set1_pd(terms->A);
+
+	for (; j + 8 <= count; j += 8) {
+		__m256d x0 = _mm256_loadu_pd(x + j);
+		__m256d x1 = _mm256_loadu_pd(x + j + 4);
+		__m256d y0 = _mm256_loadu_pd(y + j);
+		__m256d y1 = _mm256_loadu_pd(y + j + 4);
+
+		__m256d acc0 = bias;
+		__m256d acc1 = bias;
+
+		for (size_t k = 0; k < TEST_TERMS; ++k) {
+			__m256d base = _mm256_set1_pd(terms->base[k]);
+			__m256d kx = _mm256_set1_pd(terms->dt[k]);
+			__m256d ky = _mm256_set1_pd(terms->ky[k]);
+			__m256d w = _mm256_set1_pd(terms->weight[k]);
+
+			__m256d a0 = madd_pd(x0, kx, madd_pd(y0, ky, base));
+			__m256d a1 = madd_pd(x1, kx, madd_pd(y1, ky, base));
+			a0 = _mm256_sub_pd(a0, _mm256_round_pd(a0, ROUND));
+			a1 = _mm256_sub_pd(a1, _mm256_round_pd(a1, ROUND));
+
+			acc0 = _mm256_sub_pd(acc0, _mm256_mul_pd(w, cos_turns_pd(a0)));
+			acc1 = _mm256_sub_pd(acc1, _mm256_mul_pd(w, cos_turns_pd(a1)));
+		}
+
+		_mm256_storeu_pd(g + j, _mm256_mul_pd(A, acc0));
+		_mm256_storeu_pd(g + j + 4, _mm256_mul_pd(A, acc1));
+	}
+#endif
+
+	for (; j < count; ++j) {
+		double acc = terms->bias;
+		for (size_t k = 0; k < TEST_TERMS; ++k) {
+			double t = terms->base[k] + x[j]*terms->dt[k] + y[j]*terms->ky[k];
+			acc -= terms->weight[k]*cos(TWOPI*(t - nearbyint(t)));
+		}
+		g[j] = terms->A*acc;
+	}
+}
+
+// Points are taken in blocks, so that the scratch arrays stay on the stack
+static constexpr size_t TEST_SAMPLE_BLOCK = 256;
+
+void sample_batch(void *usr, const double *u, const double *v, uint8_t f,
+				  size_t count, float *out)
+{
+	test_row_terms terms;
+	test_terms_init(&terms, 0.0, 1.0, TWOPIf*(float)f);
+
+	double x[TEST_SAMPLE_BLOCK], y[TEST_SAMPLE_BLOCK], g[TEST_SAMPLE_BLOCK];
+
+	for (size_t first = 0; first < count; first += TEST_SAMPLE_BLOCK) {
+		size_t n = std::min(count - first, TEST_SAMPLE_BLOCK);
+
+		for (size_t i = 0; i < n; ++i) {
+			x[i] = 1.0 - 2.0*u[first + i];
+			y[i] = 1.0 - 2.0*v[first + i];
+		}
+
+		test_points_eval(&terms, x, y, n, g);
+
+		for (size_t i = 0; i < n; ++i) {
+			double h = TEST_AMP*g[i]*filter_band(x[i])*filter_band(y[i]);
+			out[first + i] = (float)smooth_max_zero(h);
+		}
+	}
+}
+
 int test_loader_fn(
 	void *usr, uint64_t id, struct ds_buf *buf, struct ds_token *token)
 {
+	static_assert(TILE_WIDTH % 8 == 0);
+
 	float *data = static_cast<float*>(buf->dst);
 
 	TileCode code = tile_code_unpack(id);
 
 	aabb2_t rect = morton_u64_to_rect_f64(code.idx, code.zoom);
 
-	float d = 1.0f/(float)(TILE_WIDTH - 1);
+	double d = (rect.max.x - rect.min.x)/(double)(TILE_WIDTH - 1);
 
-	glm::vec2 uv = glm::vec2(0);
-	size_t idx = 0;
+	// Face coordinates run opposite to uv
+	double x0 = 1.0 - 2.0*rect.min.x;
+	double dx = -2.0*d;
+
+	test_row_terms terms;
+	test_terms_init(&terms, x0, dx, TWOPIf*(float)code.face);
+
+	double band_x[TILE_WIDTH];
+	for (size_t j = 0; j < TILE_WIDTH; ++j)
+		band_x[j] = filter_band(x0 + (double)j*dx);
+
+	double g[TILE_WIDTH];
 
 	const struct ds_token_vtbl *vtbl = token->vtbl;
 	for (size_t i = 0; i < TILE_WIDTH; ++i) {
 		if (vtbl->is_cancelled(token))
 			return 0;
 
-		uv.y = (float)i*d;
+		double y = 1.0 - 2.0*(rect.min.y + (double)i*d);
+		double band_y = filter_band(y);
 
-		for (size_t j = 0; j < TILE_WIDTH; ++j) {
-			uv.x = (float)j*d;
-			glm::vec2 f = glm::mix(rect.ll(),rect.ur(),uv);
+		test_terms_set_row(&terms, y);
+		test_row_eval(&terms, TILE_WIDTH, g);
 
-			data[idx++] = test_elev_fn(f, code.face);
-			//uv.x += d;
-		}
-		uv.x = 0;
-		//uv.y += d;
+		float *row = data + i*TILE_WIDTH;
+		for (size_t j = 0; j < TILE_WIDTH; ++j)
+			row[j] = (float)smooth_max_zero(TEST_AMP*g[j]*band_x[j]*band_y);
 	}
 
 	return 0;
@@ -2,19 +2,254 @@
 #include <ev2/globe/tiling.h>
 
 #include "utils/thread_pool.h"
+#include "utils/common.h"
+#include "utils/page_alloc.h"
 #include "tile_cache.h"
+#include "tile_quant.h"
 
 #include <imgui.h>
 
-#include <unordered_set>
+#include <algorithm>
+#include <cstring>
 #include <atomic>
 #include <thread>
 
+// A tile waiting for a load slot
+struct tc_pending
+{
+	alc_index idx;
+	// Null until a prefetched tile is dispatched
+	alc_entry *ent;
+	uint16_t gen;
+	tc_priority priority;
+	// Only requested by tc_prefetch
+	bool prefetch;
+	// Last call to tc_load that requested it
+	uint64_t frame;
+};
+
+struct tc_queued
+{
+	tc_priority priority;
+	bool prefetch;
+	uint64_t key;
+};
+
+// Tiles on screen go before prefetched ones regardless of priority
+static bool tc_queued_less(const tc_queued &a, const tc_queued &b)
+{
+	if (a.prefetch != b.prefetch)
+		return a.prefetch;
+	return tc_priority_less(a.priority, b.priority);
+}
+
+// Drawn in place of a requested tile until it is ready
+struct tc_fallback
+{
+	// Nearest ready ancestor, or TILE_CODE_NONE_U if there was none
+	uint64_t code;
+	alc_entry *ent;
+	uint16_t gen;
+	// Last call to tc_load that requested it
+	uint64_t frame;
+};
+
+// A load handed to the thread pool, checked on until it finishes
+struct tc_dispatched
+{
+	uint64_t key;
+	alc_entry *ent;
+	uint16_t gen;
+};
+
+// Range of the heights in a TC_FORMAT_U16 block.  Kept apart from the 
+// blocks so that they stay a power of two in size.
+struct tc_range
+{
+	float min;
+	float max;
+};
+
+// @brief Robin hood hash map from keys to values, kept in the buckets.  Grows
+// by doubling and keeps its buckets when emptied, so that once the tiles in 
+// view stop growing in number, requesting new ones does not allocate.
+template<typename V>
+struct tc_map
+{
+	struct bucket
+	{
+		uint64_t key;
+		// Distance from the home bucket plus one, or zero if it is empty
+		uint32_t dist;
+		V value;
+	};
+
+	std::vector<bucket> buckets;
+	size_t size;
+};
+
+static inline size_t tc_map_hash(uint64_t key)
+{
+	// splitmix64 finalizer, as in alc_map
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ULL;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebULL;
+	key ^= key >> 31;
+	return (size_t)key;
+}
+
+// @return Bucket of key, or SIZE_MAX
+template<typename V>
+static size_t tc_map_find(const tc_map<V> &map, uint64_t key)
+{
+	if (map.buckets.empty())
+		return SIZE_MAX;
+
+	size_t mask = map.buckets.size() - 1;
+	size_t i = tc_map_hash(key) & mask;
+
+	for (uint32_t dist = 1;; ++dist, i = (i + 1) & mask) {
+		const auto &b = map.buckets[i];
+
+		// The key would have displaced this bucket if it were present
+		if (b.dist < dist)
+			return SIZE_MAX;
+
+		if (b.key == key)
+			return i;
+	}
+}
+
+// @return Bucket the first entry placed ends up in
+template<typename V>
+static size_t tc_map_place(tc_map<V> &map, typename tc_map<V>::bucket ins)
+{
+	size_t mask = map.buckets.size() - 1;
+	size_t i = tc_map_hash(ins.key) & mask;
+	size_t placed = SIZE_MAX;
+
+	for (ins.dist = 1;; ++ins.dist, i = (i + 1) & mask) {
+		auto &b = map.buckets[i];
+
+		if (!b.dist) {
+			b = ins;
+			return placed == SIZE_MAX ? i : placed;
+		}
+
+		// Take from the rich
+		if (b.dist < ins.dist) {
+			std::swap(b, ins);
+			if (placed == SIZE_MAX)
+				placed = i;
+		}
+	}
+}
+
+// @brief Finds key, or inserts it with a value-initialized value
+// @return The value, which stays in place until the next insertion or 
+// erasure, and whether it was inserted
+template<typename V>
+static std::pair<V*, bool> tc_map_emplace(tc_map<V> &map, uint64_t key)
+{
+	size_t i = tc_map_find(map, key);
+	if (i != SIZE_MAX)
+		return {&map.buckets[i].value, false};
+
+	// Keep the load factor at or below one half
+	if (2*(map.size + 1) > map.buckets.size()) {
+		std::vector<typename tc_map<V>::bucket> old (
+			std::max(2*map.buckets.size(), (size_t)64));
+		std::swap(old, map.buckets);
+
+		for (const auto &b : old) {
+			if (b.dist)
+				tc_map_place(map, b);
+		}
+	}
+
+	i = tc_map_place(map, {.key = key, .dist = 1, .value = V{}});
+	++map.size;
+
+	return {&map.buckets[i].value, true};
+}
+
+template<typename V>
+static void tc_map_erase(tc_map<V> &map, size_t i)
+{
+	size_t mask = map.buckets.size() - 1;
+
+	// Backward shift deletion, so there are no tombstones
+	for (;;) {
+		size_t next = (i + 1) & mask;
+		auto &b = map.buckets[next];
+
+		if (b.dist <= 1)
+			break;
+
+		map.buckets[i] = b;
+		--map.buckets[i].dist;
+		i = next;
+	}
+
+	map.buckets[i] = {};
+	--map.size;
+}
+
+// @brief Erases the entries pred returns true for.  An entry may be passed 
+// to pred more than once.
+template<typename V, typename F>
+static void tc_map_erase_if(tc_map<V> &map, F pred)
+{
+	// Erasing shifts the next entries back into the bucket, so it is looked 
+	// at again.  Only when the last bucket is erased do entries from the 
+	// front wrap around into it, and those were already seen.
+	for (size_t i = 0; i < map.buckets.size();) {
+		auto &b = map.buckets[i];
+		if (b.dist && pred(b.key, b.value))
+			tc_map_erase(map, i);
+		else
+			++i;
+	}
+}
+
 struct tc_cache
 {
 	alc_table *alc;
+	tc_format format;
+	// Size of a tile as floats
 	size_t tile_size;
+	// Size of a tile as stored
+	size_t block_size;
 	size_t tile_cap;
+
+	// Address space for every page the table can have, reserved up front.
+	// Pages are committed when first written to, and given back to the OS 
+	// when destroyed.
+	page_region region;
+	size_t page_bytes;
+
+	// Indexed by slot
+	std::vector<tc_range> ranges;
+
+	// Optional, checked before the data source
+	dc_cache *disk;
+
+	tc_map<tc_pending> pending;
+	// Reused between calls to order the pending tiles
+	std::vector<tc_queued> queue;
+	uint64_t frame;
+
+	// For each requested tile that is not ready.  Entries are checked with a
+	// single load of the ancestor's state, and only looked up again when it 
+	// is evicted.  Loads that finish move them to closer ancestors.
+	tc_map<tc_fallback> fallback;
+	std::vector<tc_dispatched> dispatched;
+	// Keys requested since the last call to tc_load, including by tc_prefetch.
+	// Dispatched loads of any other key are cancelled.
+	std::vector<uint64_t> requested;
+	// Reused between calls to touch each ancestor in use once
+	std::vector<alc_entry*> fallback_used;
 };
 
 enum {
@@ -23,15 +258,23 @@ enum {
 };
 
 
-static int MAX_TILES_IN_FLIGHT = std::thread::hardware_concurrency()/2;
+static int MAX_TILES_IN_FLIGHT = std::max((int)std::thread::hardware_concurrency()/2, 1);
+// Leaves load slots free for tiles that come into view
+static int MAX_PREFETCH_IN_FLIGHT = std::max(MAX_TILES_IN_FLIGHT/2, 1);
 static std::atomic_int g_tiles_in_flight = 0;
+static std::atomic_int g_prefetch_in_flight = 0;
 
 
-static int create_cpu_tile_page(void *usr, alc_page_handle_t *p_handle)
+static int create_cpu_tile_page(void *usr, uint32_t page, alc_page_handle_t *p_handle)
 {
-	const tc_cache *tc = static_cast<tc_cache*>(usr);
+	tc_cache *tc = static_cast<tc_cache*>(usr);
+
+	size_t offset = (size_t)page*tc->page_bytes;
+	if (page_region_commit(&tc->region, offset, tc->page_bytes) < 0)
+		return -1;
+
+	uint8_t *mem = tc->region.base + offset;
 
-	uint8_t * mem = new uint8_t[tc->tile_size*tc->alc->page_size];
 	uintptr_t ptr = reinterpret_cast<uintptr_t>(mem);
 
 	*p_handle = static_cast<uint64_t>(ptr);
@@ -41,47 +284,95 @@ static int create_cpu_tile_page(void *usr, alc_page_handle_t *p_handle)
 
 static int destroy_cpu_tile_page(void *usr, alc_page_handle_t handle)
 {
-	//const TileCPUCache *cache = static_cast<TileCPUCache*>(usr);
+	tc_cache *tc = static_cast<tc_cache*>(usr);
 	uint8_t *mem = reinterpret_cast<uint8_t*>(handle); 
-	delete[] mem;
+
+	// Keeps the address range, so the page can be created there again
+	page_region_decommit(&tc->region, (size_t)(mem - tc->region.base), tc->page_bytes);
 
 	return 0;
 }
 
-static alc_entry * alc_entry_get(alc_table *ct, alc_index idx)
+static bool is_protected_tile(void *usr, uint64_t key)
 {
-	return &ct->pages[idx.page].entries[idx.ent];
+	return tile_code_zoom(key) <= TILE_CPU_PROTECTED_ZOOM;
 }
 
-static TileCode find_best(const tc_cache *tc, TileCode code)
+// Without an ancestor, the entry stays as it is until a load finishes
+static bool tc_fallback_valid(const tc_fallback &fb)
 {
-	auto end = tc->alc->map.end();
-	auto it = tc->alc->map.find(tile_code_pack(code));
+	if (!fb.ent)
+		return true;
 
-	alc_status status = ALC_STATUS_EMPTY;
+	uint64_t state = fb.ent->state.load(std::memory_order_relaxed);
+	return alc_state_gen(state) == fb.gen && 
+		alc_state_status(state) == ALC_STATUS_READY;
+}
 
-	while (code.zoom > 0 && status != ALC_STATUS_READY) {
-		code.idx >>= 2;
-		--code.zoom;
+static void tc_fallback_resolve(const tc_cache *tc, uint64_t code, tc_fallback *fb)
+{
+	fb->code = TILE_CODE_NONE_U;
+	fb->ent = nullptr;
+	fb->gen = 0;
+
+	for (uint8_t zoom = tile_code_zoom(code); zoom-- > 0;) {
+		uint64_t anc = tile_code_ancestor(code, zoom);
+
+		uint16_t gen;
+		if (alc_entry *ent = alc_find_ready(tc->alc, anc, &gen)) {
+			fb->code = anc;
+			fb->ent = ent;
+			fb->gen = gen;
+			return;
+		}
+	}
+}
 
-		it = tc->alc->map.find(tile_code_pack(code));
+// @return The nearest ready ancestor of a tile that is not ready 
+static uint64_t tc_fallback_get(tc_cache *tc, uint64_t code, uint64_t frame)
+{
+	auto [p_fb, inserted] = tc_map_emplace(tc->fallback, code);
+	tc_fallback &fb = *p_fb;
 
-		if (it != end) {
-			alc_index idx = *it->second;
-			alc_entry *ent = alc_entry_get(tc->alc, idx);
-			status = alc_state_status(ent->state.load());
-		}
-	} 
+	if (inserted || !tc_fallback_valid(fb))
+		tc_fallback_resolve(tc, code, &fb);
 
-	if (status == ALC_STATUS_READY) {
-		alc_lru_list::iterator l_it = it->second;
-		tc->alc->lru.splice(tc->alc->lru.begin(), tc->alc->lru, l_it);
-		return tile_code_unpack(it->first);
-	}
+	fb.frame = frame;
+	return fb.code;
+}
+
+// Moves fallbacks to tiles that finished loading since the last call, if 
+// they are closer
+static void tc_fallback_update(tc_cache *tc)
+{
+	std::erase_if(tc->dispatched, [tc](const tc_dispatched &d) {
+		uint64_t state = d.ent->state.load(std::memory_order_relaxed);
+
+		// Cancelled, or evicted since
+		if (alc_state_gen(state) != d.gen || alc_state_status(state) == ALC_STATUS_EMPTY)
+			return true;
 
-	//log_info("No loaded parent found for tile %d",in);
+		if (alc_state_status(state) != ALC_STATUS_READY)
+			return false;
 
-	return TILE_CODE_NONE;
+		uint8_t zoom = tile_code_zoom(d.key);
+
+		for (auto &b : tc->fallback.buckets) {
+			uint64_t code = b.key;
+			tc_fallback &fb = b.value;
+
+			if (!b.dist || tile_code_zoom(code) <= zoom ||
+				(fb.code != TILE_CODE_NONE_U && tile_code_zoom(fb.code) >= zoom) ||
+				tile_code_ancestor(code, zoom) != d.key)
+				continue;
+
+			fb.code = d.key;
+			fb.ent = d.ent;
+			fb.gen = d.gen;
+		}
+
+		return true;
+	});
 }
 
 static uint8_t *get_block(const tc_cache *tc, alc_index idx)
@@ -90,25 +381,51 @@ static uint8_t *get_block(const tc_cache *tc, alc_index idx)
 
 	uint8_t *mem = reinterpret_cast<uint8_t*>(pg_handle);
 
-	return &mem[idx.ent*tc->tile_size];
+	return &mem[idx.ent*tc->block_size];
 }
 
+static tc_range *get_range(tc_cache *tc, alc_index idx)
+{
+	return &tc->ranges[(size_t)idx.page*tc->alc->page_size + idx.ent];
+}
+
+static const tc_range *get_range(const tc_cache *tc, alc_index idx)
+{
+	return &tc->ranges[(size_t)idx.page*tc->alc->page_size + idx.ent];
+}
+
+struct tc_load_state
+{
+	alc_atomic_state *p_state;
+	uint16_t gen;
+};
+
+// The entry was evicted, and possibly reused for another tile
 static int my_cancel(struct ds_token *tok)
 {
-	alc_atomic_state *p_state = static_cast<alc_atomic_state*>(tok->usr);
-	alc_atomic_state state = p_state->load(std::memory_order_relaxed);
-	bool cancelled = alc_state_status(state) == ALC_STATUS_CANCELLED; 
+	const tc_load_state *load = static_cast<tc_load_state*>(tok->usr);
+	uint64_t state = load->p_state->load(std::memory_order_relaxed);
+	bool cancelled = alc_state_gen(state) != load->gen; 
 	return cancelled;
 }
 
+// Loads as floats into buf, which is the block itself for TC_FORMAT_F32.  
+// The heights' range is written to p_loaded, and to range as well for 
+// TC_FORMAT_U16.
 static int load_thread_fn(
 	ds_context const *ds, 
+	dc_cache *disk,
 	uint64_t id,
 	alc_atomic_state *p_state, 
-	ds_buf *buf
+	uint16_t gen,
+	tc_format format,
+	uint8_t *block,
+	tc_range *range,
+	ds_buf *buf,
+	tc_range *p_loaded
 )
 {
-	if (!alc_state_set_loading(p_state)) {
+	if (!alc_state_set_loading(p_state, gen)) {
 		log_info("load cancelled successfully (tile %d)",id);
 		return LOAD_FAILED;
 	}
@@ -117,14 +434,36 @@ static int load_thread_fn(
 		.is_cancelled = &my_cancel
 	};
 
+	tc_load_state load = {
+		.p_state = p_state,
+		.gen = gen
+	};
+
 	struct ds_token tok = {
-		.usr = p_state,
+		.usr = &load,
 		.vtbl = &vtbl
 	};
 
-	ds->vtbl.loader(ds->usr, id, buf, &tok);
+	if (!disk || !dc_read(disk, id, buf->dst, buf->size)) {
+		ds->vtbl.loader(ds->usr, id, buf, &tok);
+
+		// Before the entry is ready, so that the cache outlives the call
+		if (disk && !my_cancel(&tok))
+			dc_write(disk, id, buf->dst, buf->size);
+	}
+
+	const float *src = static_cast<const float*>(buf->dst);
+	size_t count = buf->size/sizeof(float);
+
+	tile_minmax_f32(src, count, &p_loaded->min, &p_loaded->max);
 
-	if (!alc_state_set_ready(p_state)) {
+	if (format == TC_FORMAT_U16) {
+		*range = *p_loaded;
+		tile_encode_u16(src, count, range->min, range->max, 
+				  reinterpret_cast<uint16_t*>(block));
+	}
+
+	if (!alc_state_set_ready(p_state, gen)) {
 		log_info("load cancelled successfully (tile %d)",id);
 		return LOAD_FAILED;
 	}
@@ -132,28 +471,84 @@ static int load_thread_fn(
 	return LOAD_SUCCESS;
 }
 
-tc_error tc_create(tc_cache **p_tc, size_t tile_size, size_t capacity)
+tc_error tc_create(tc_cache **p_tc, const tc_params *params)
 {
 	tc_cache *tc = new tc_cache{};
-	tc->tile_size = tile_size;
-	tc->tile_cap = (std::max(capacity,(size_t)1) - 1)/tile_size + 1;
+	tc->format = params->format;
+	tc->tile_size = params->tile_size;
+
+	switch (tc->format) {
+	case TC_FORMAT_F32:
+		tc->block_size = tc->tile_size;
+		break;
+	case TC_FORMAT_U16:
+		tc->block_size = tc->tile_size/2;
+		break;
+	}
+
+	// Keeps blocks in separate cache lines
+	tc->block_size = align_up_pow2(tc->block_size, 64);
+	tc->tile_cap = (std::max(params->capacity,(size_t)1) - 1)/tc->block_size + 1;
 
 	alc_params p = {
 		.capacity = tc->tile_cap,
 		.page_size = TILE_CPU_PAGE_SIZE,
+		.shard_count = TILE_CPU_SHARD_COUNT,
 		.usr = tc,
 		.page_create = &create_cpu_tile_page,
-		.page_destroy = &destroy_cpu_tile_page
+		.page_destroy = &destroy_cpu_tile_page,
+		.policy = ALC_POLICY_CLOCK,
+		.is_protected = &is_protected_tile,
 	};
 
 	if (alc_create(&tc->alc, &p) < 0)
 		goto tc_create_failed;
 
+	{
+		// Pages are whole huge pages if those were asked for, so that each
+		// can be given back on its own
+		size_t page_align = params->page_flags ? PAGE_ALLOC_HUGE_SIZE : 4*KILOBYTE;
+		tc->page_bytes = align_up(tc->block_size*tc->alc->page_size, page_align);
+
+		page_region_params rp = {
+			.size = tc->page_bytes*tc->alc->pages.size(),
+			.flags = params->page_flags,
+			.numa_node = params->numa_node,
+		};
+
+		if (page_region_reserve(&tc->region, &rp) < 0)
+			goto tc_create_failed;
+
+		if (tc->page_bytes % tc->region.granularity) {
+			log_error("tc_create: page size %zu is not a multiple of %zu",
+				tc->page_bytes, tc->region.granularity);
+			goto tc_create_failed;
+		}
+	}
+
+	tc->ranges.resize(tc->alc->pages.size()*tc->alc->page_size);
+
+	if (params->disk_path) {
+		dc_params dp = {
+			.path = params->disk_path,
+			.tile_size = tc->tile_size,
+			.capacity = params->disk_capacity,
+			.version = params->disk_version,
+		};
+
+		// Tiles still load without it
+		if (dc_open(&tc->disk, &dp) < 0)
+			tc->disk = nullptr;
+	}
+
 	*p_tc = tc;
 
 	return TC_OK;
 
 tc_create_failed:
+	if (tc->alc)
+		alc_destroy(tc->alc);
+	page_region_release(&tc->region);
 	delete tc;
 	return TC_ENULL;
 }
@@ -163,10 +558,123 @@ void tc_destroy(tc_cache *tc)
 	if (!tc) 
 		return;
 
+	// Loaders hand their tiles to the disk cache before finishing
 	alc_destroy(tc->alc);
+	dc_close(tc->disk);
+	page_region_release(&tc->region);
 	delete tc;
 }
 
+void tc_set_budget(tc_cache *tc, size_t bytes)
+{
+	alc_set_capacity(tc->alc, bytes/tc->block_size);
+}
+
+size_t tc_budget(const tc_cache *tc)
+{
+	return tc->alc->capacity*tc->block_size;
+}
+
+size_t tc_resident_bytes(const tc_cache *tc)
+{
+	return alc_page_count(tc->alc)*tc->page_bytes;
+}
+
+bool tc_disk_stats(const tc_cache *tc, dc_stats *stats)
+{
+	if (!tc->disk)
+		return false;
+
+	*stats = dc_get_stats(tc->disk);
+	return true;
+}
+
+void tc_memory_pressure(tc_cache *tc, tc_pressure level)
+{
+	size_t floor = std::min(TILE_CPU_MIN_BUDGET, tc_budget(tc));
+
+	size_t budget = floor;
+	if (level == TC_PRESSURE_MODERATE)
+		budget = std::max(std::min(tc_budget(tc), tc_resident_bytes(tc))/2, floor);
+
+	log_info("Tile cache memory pressure, budget %zu -> %zu MB",
+		tc_budget(tc)/MEGABYTE, budget/MEGABYTE);
+
+	tc_set_budget(tc, budget);
+}
+
+static void tc_request(
+	tc_cache *tc, 
+	uint64_t key, 
+	const alc_result &res, 
+	tc_priority priority, 
+	bool prefetch,
+	uint64_t frame
+)
+{
+	auto [p_pend, inserted] = tc_map_emplace(tc->pending, key);
+	tc_pending &pend = *p_pend;
+
+	bool current = !inserted && pend.frame == frame && pend.gen == res.gen;
+
+	// Several tiles can map to the same one, the most valuable wins
+	if (!current || (pend.prefetch && !prefetch)) {
+		pend.priority = priority;
+		pend.prefetch = prefetch;
+	} else if (pend.prefetch == prefetch && 
+			   tc_priority_less(pend.priority, priority)) {
+		pend.priority = priority;
+	}
+
+	pend.idx = res.idx;
+	pend.ent = res.p_ent;
+	pend.gen = res.gen;
+	pend.frame = frame;
+}
+
+tc_error tc_prefetch(
+	tc_cache *tc,
+	ds_context const *ds,
+
+	size_t count,
+	tile_code_t const *tiles,
+	tc_priority const *priority
+)
+{
+	// Queued for the next tc_load
+	uint64_t frame = tc->frame + 1;
+
+	for (size_t i = 0; i < count; ++i) {
+		uint64_t key = ds->vtbl.find(ds->usr, tiles[i]);
+		tc->requested.push_back(key);
+
+		// Reserving an entry here could evict tiles on screen for one that is
+		// never loaded, so that waits until the load is dispatched
+		if (alc_find(tc->alc, key).is_valid())
+			continue;
+
+		auto [p_pend, inserted] = tc_map_emplace(tc->pending, key);
+		tc_pending &pend = *p_pend;
+
+		if (!inserted && pend.frame == frame) {
+			if (pend.prefetch && tc_priority_less(pend.priority, priority[i]))
+				pend.priority = priority[i];
+			continue;
+		}
+
+		pend = {
+			.idx = ALC_INDEX_NONE,
+			.ent = nullptr,
+			.gen = 0,
+			.priority = priority[i],
+			.prefetch = true,
+			.frame = frame
+		};
+	}
+
+	return TC_OK;
+}
+
 tc_error tc_load(
 	tc_cache *tc,
 	ds_context const *ds,
@@ -176,118 +684,296 @@ tc_error tc_load(
 
 	size_t count, 
 	tile_code_t const *tiles,
+	tc_priority const *priority,
 	tile_code_t *out
 )
 {
-	std::vector<TileCode> available (count);
+	uint64_t frame = ++tc->frame;
 
-	for (size_t i = 0; i < count; ++i) {
-		uint64_t code = tiles[i];
-		TileCode found = tile_code_unpack(ds->vtbl.find(ds->usr, code));
-		available[i] = found;
-	}
+	// Pages left over from shrinking the budget
+	alc_trim(tc->alc);
 
-	std::vector<TileCode> loaded (count,TILE_CODE_NONE);
+	tc_fallback_update(tc);
 
-	struct load_token_t
-	{
-		alc_index idx;
-		alc_entry *ent;
-	};
+	for (size_t i = 0; i < count; ++i) {
+		uint64_t ideal_u64 = ds->vtbl.find(ds->usr, tiles[i]);
+		tc->requested.push_back(ideal_u64);
 
-	std::vector<load_token_t> loads;
+		alc_result res = alc_get(tc->alc, ideal_u64);
 
-	// TODO: Doing this to avoid duplicate loads right now - could be better
-	std::unordered_set<uint64_t> unique_loads;
+		if (res.needs_load) {
+			tc_priority p = priority ? priority[i] : tc_priority{
+				.error = 0,
+				.dist = (float)i
+			};
 
-	for (size_t i = 0; i < count; ++i) {
-		TileCode ideal = available[i];
+			tc_request(tc, ideal_u64, res, p, false, frame);
+		}
 
-		uint64_t ideal_u64 = tile_code_pack(ideal);
-		alc_result res = alc_get(tc->alc,ideal_u64);
+		out[i] = res.is_ready ? ideal_u64 : tc_fallback_get(tc, ideal_u64, frame);
+	}
 
-		if (res.needs_load && unique_loads.insert(ideal_u64).second)
-			loads.push_back(load_token_t{
-				.idx = res.idx,
-				.ent = res.p_ent
-			});
+	tc_map_erase_if(tc->fallback, [frame](uint64_t, const tc_fallback &fb) {
+		return fb.frame != frame;
+	});
 
-		TileCode code = res.is_ready ? ideal : find_best(tc, ideal); 
+	// Ancestors drawn in place of other tiles are kept like tiles that were
+	// requested, but each is only touched once
+	tc->fallback_used.clear();
+	for (const auto &b : tc->fallback.buckets) {
+		if (b.dist && b.value.ent && tc_fallback_valid(b.value))
+			tc->fallback_used.push_back(b.value.ent);
+	}
 
-		out[i] = tile_code_pack(code);
+	std::sort(tc->fallback_used.begin(), tc->fallback_used.end());
+	auto last = std::unique(tc->fallback_used.begin(), tc->fallback_used.end());
+
+	for (auto it = tc->fallback_used.begin(); it != last; ++it)
+		alc_touch(tc->alc, alc_entry_index(tc->alc, *it));
+
+	// Loads of tiles that went out of view are cancelled, unless they already
+	// finished, in which case tc_fallback_update still gets to see them
+	std::sort(tc->requested.begin(), tc->requested.end());
+	std::erase_if(tc->dispatched, [tc](const tc_dispatched &d) {
+		return !std::binary_search(tc->requested.begin(), tc->requested.end(), d.key) &&
+			alc_state_cancel(&d.ent->state, d.gen);
+	});
+	tc->requested.clear();
+
+	// Drop tiles that went out of view, the rest are ordered by priority
+	tc_map_erase_if(tc->pending, [frame](uint64_t, const tc_pending &pend) {
+		return pend.frame != frame;
+	});
+
+	tc->queue.clear();
+	for (const auto &b : tc->pending.buckets) {
+		if (!b.dist)
+			continue;
+
+		tc->queue.push_back({
+			.priority = b.value.priority, 
+			.prefetch = b.value.prefetch, 
+			.key = b.key
+		});
 	}
 
-	const bool has_post_load = post_load;
+	std::make_heap(tc->queue.begin(), tc->queue.end(), tc_queued_less);
 
-	for (size_t i = 0; i < loads.size(); ++i) {
-		load_token_t tok = loads[i];
-		uint8_t *dst = get_block(tc, tok.idx);
+	const bool has_post_load = post_load;
+	const tc_format format = tc->format;
+	const size_t tile_size = tc->tile_size;
+	dc_cache *disk = tc->disk;
+
+	// Counted when scheduled rather than when started, so that the thread 
+	// pool never holds more than this many loads that cannot be reordered
+	while (!tc->queue.empty() && g_tiles_in_flight < MAX_TILES_IN_FLIGHT) {
+		std::pop_heap(tc->queue.begin(), tc->queue.end(), tc_queued_less);
+		uint64_t key = tc->queue.back().key;
+		tc->queue.pop_back();
+
+		size_t it = tc_map_find(tc->pending, key);
+		tc_pending tok = tc->pending.buckets[it].value;
+
+		// Only prefetched tiles are left
+		if (tok.prefetch && g_prefetch_in_flight >= MAX_PREFETCH_IN_FLIGHT)
+			break;
+
+		if (!tok.ent) {
+			alc_result res = alc_get(tc->alc, key);
+
+			if (!res.needs_load) {
+				tc_map_erase(tc->pending, it);
+				continue;
+			}
+
+			tok.idx = res.idx;
+			tok.ent = res.p_ent;
+			tok.gen = res.gen;
+		}
 
-		if (g_tiles_in_flight < MAX_TILES_IN_FLIGHT) {
-			//log_info("Loading tile %d",ent->code);
-
-			tok.ent->state.store(alc_state_pack({
-				.status = ALC_STATUS_QUEUED,
-				.flags = 0,
-				.gen = 0,
-				.refs = 0
-			}));
-
-			g_schedule_background([=](){
-				++g_tiles_in_flight;
-
-				struct ds_buf buf = {
-					.dst = dst,
-					.size = TILE_SIZE*sizeof(float)
-				};
-
-				uint64_t id = tok.ent->key; 
-
-				int status = load_thread_fn(
-					ds, 
-					id, 
-					&(tok.ent->state), 
-					&buf
-				);
-				--g_tiles_in_flight;
-
-				if (has_post_load && status == LOAD_SUCCESS) 
-					post_load(usr, id, &buf);
-			});
+		if (!alc_state_set_queued(&tok.ent->state, tok.gen)) {
+			// Wait for a previous loader that still writes to the entry,
+			// otherwise it was evicted or loaded by someone else
+			uint64_t state = tok.ent->state.load(std::memory_order_relaxed);
+			if (alc_state_gen(state) != tok.gen ||
+				alc_state_status(state) != ALC_STATUS_EMPTY ||
+				!(alc_state_flags(state) & ALC_FLAG_STALE_LOADER))
+				tc_map_erase(tc->pending, it);
+			continue;
 		}
+
+		tc_map_erase(tc->pending, it);
+
+		uint8_t *dst = get_block(tc, tok.idx);
+		tc_range *range = get_range(tc, tok.idx);
+
+		tc->dispatched.push_back({key, tok.ent, tok.gen});
+
+		++g_tiles_in_flight;
+		if (tok.prefetch)
+			++g_prefetch_in_flight;
+
+		g_schedule_background([=](){
+			// Quantized tiles are loaded here first
+			thread_local std::vector<float> scratch;
+
+			struct ds_buf buf = {
+				.dst = dst,
+				.size = tile_size
+			};
+
+			if (format != TC_FORMAT_F32) {
+				scratch.resize(tile_size/sizeof(float));
+				buf.dst = scratch.data();
+			}
+
+			// The block's range can change once the entry is ready
+			tc_range loaded;
+
+			int status = load_thread_fn(
+				ds, 
+				disk,
+				key, 
+				&(tok.ent->state), 
+				tok.gen,
+				format,
+				dst,
+				range,
+				&buf,
+				&loaded
+			);
+			--g_tiles_in_flight;
+			if (tok.prefetch)
+				--g_prefetch_in_flight;
+
+			if (has_post_load && status == LOAD_SUCCESS) 
+				post_load(usr, key, &buf, loaded.min, loaded.max);
+		});
 	}
 
 	return TC_OK;
 }
 
+static tc_ref tc_make_ref(const tc_cache *tc, alc_entry *ent)
+{
+	alc_index idx = alc_entry_index(tc->alc, ent);
+
+	//log_info("Acquired tile %d from CPU cache");
+
+	uint8_t *block = get_block(tc, idx);
+
+	tc_ref ref = {
+		.data = block,
+		.size = tc->tile_size,
+		.format = tc->format,
+		.min = 0,
+		.max = 0,
+		.p_state = &ent->state
+	};
+
+	if (tc->format == TC_FORMAT_U16) {
+		const tc_range *range = get_range(tc, idx);
+		ref.size = tc->tile_size/2;
+		ref.min = range->min;
+		ref.max = range->max;
+	}
+
+	return ref;
+}
+
 tc_error tc_acquire(const tc_cache *tc, tile_code_t id, tc_ref *p_ref)
 {
 	TileCode code = tile_code_unpack(id);
 
-	auto it = tc->alc->map.find(id);
-	if (it == tc->alc->map.end()) {
-		log_error("acquire_block: Failed to find tile with code %ld (face=%d,zoom=%d,idx=%d)",
-			id, code.face,code.zoom,code.idx);
+	// Finding and referencing the entry under one lock, so that it cannot be 
+	// evicted in between
+	alc_entry *ent = alc_acquire(tc->alc, id);
+	if (!ent) {
+		if (!alc_find(tc->alc, id).is_valid())
+			log_error("acquire_block: Failed to find tile with code %ld (face=%d,zoom=%d,idx=%d)",
+				id, code.face,code.zoom,code.idx);
 		return TC_ENULL;
 	}
 
-	alc_index idx = *it->second;
-	alc_entry *ent = alc_entry_get(tc->alc,idx);
+	*p_ref = tc_make_ref(tc, ent);
 
-	if (!alc_state_inc_ref(&ent->state))
-		return TC_ENULL;
+	return TC_OK;
+}
 
-	//log_info("Acquired tile %d from CPU cache");
+tc_error tc_acquire_nearest(
+	const tc_cache *tc, 
+	tile_code_t code, 
+	tc_ref *p_ref, 
+	tile_code_t *p_found
+)
+{
+	for (int zoom = tile_code_zoom(code); zoom >= 0; --zoom) {
+		uint64_t anc = tile_code_ancestor(code, (uint8_t)zoom);
 
-	tc_ref ref = {
-		.data = get_block(tc, idx),
-		.size = tc->tile_size,
-		.p_state = &ent->state
-	};
+		// Missing tiles are expected here, unlike in tc_acquire
+		alc_entry *ent = alc_acquire(tc->alc, anc);
+		if (!ent)
+			continue;
 
-	*p_ref = ref;
+		*p_ref = tc_make_ref(tc, ent);
+		*p_found = anc;
+		return TC_OK;
+	}
 
-	return TC_OK;
+	return TC_ENULL;
+}
+
+float tc_ref_sample(const tc_ref &ref, double x, double y, float *p_spread)
+{
+	static constexpr double LAST = (double)(TILE_WIDTH - 1);
+
+	x = std::clamp(x, 0.0, LAST);
+	y = std::clamp(y, 0.0, LAST);
+
+	uint32_t x0 = std::min((uint32_t)x, TILE_WIDTH - 2);
+	uint32_t y0 = std::min((uint32_t)y, TILE_WIDTH - 2);
+	float tx = (float)(x - x0);
+	float ty = (float)(y - y0);
+
+	size_t i00 = (size_t)y0*TILE_WIDTH + x0;
+	size_t at[4] = {i00, i00 + 1, i00 + TILE_WIDTH, i00 + TILE_WIDTH + 1};
+
+	float h[4];
+	switch (ref.format) {
+	case TC_FORMAT_F32:
+		for (int k = 0; k < 4; ++k)
+			h[k] = static_cast<const float*>(ref.data)[at[k]];
+		break;
+	case TC_FORMAT_U16: {
+		float step = tile_quant_step(ref.min, ref.max);
+		for (int k = 0; k < 4; ++k)
+			h[k] = ref.min + (float)static_cast<const uint16_t*>(ref.data)[at[k]]*step;
+		break;
+	}
+	}
+
+	if (p_spread) {
+		auto [lo, hi] = std::minmax({h[0], h[1], h[2], h[3]});
+		*p_spread = hi - lo;
+	}
+
+	float h0 = h[0] + (h[1] - h[0])*tx;
+	float h1 = h[2] + (h[3] - h[2])*tx;
+
+	return h0 + (h1 - h0)*ty;
+}
+
+void tc_ref_decode(const tc_ref &ref, float *dst)
+{
+	switch (ref.format) {
+	case TC_FORMAT_F32:
+		memcpy(dst, ref.data, ref.size);
+		break;
+	case TC_FORMAT_U16:
+		tile_decode_u16(static_cast<const uint16_t*>(ref.data), 
+				  ref.size/sizeof(uint16_t), ref.min, ref.max, dst);
+		break;
+	}
 }
 
 void tc_release(tc_ref ref)
@@ -5,8 +5,13 @@
 #include <ev2/globe/data_source.h>
 
 #include "globe/async_lru_cache.h"
+#include "globe/disk_cache.h"
 
 static constexpr size_t TILE_CPU_PAGE_SIZE = 32;
+static constexpr size_t TILE_CPU_SHARD_COUNT = 16;
+// Tiles at or above this level are fallbacks for most of the globe, and are
+// kept longer than others
+static constexpr uint8_t TILE_CPU_PROTECTED_ZOOM = 4;
 
 #ifndef KILOBYTE
 #define KILOBYTE ((size_t)1024)
@@ -20,10 +25,26 @@ static constexpr size_t TILE_CPU_PAGE_SIZE = 32;
 #define GIGABYTE (MEGABYTE*KILOBYTE)
 #endif
 
+// Memory pressure does not shrink the budget below this
+static constexpr size_t TILE_CPU_MIN_BUDGET = 64*MEGABYTE;
+
+enum tc_format : int
+{
+	// Tiles are stored as loaded
+	TC_FORMAT_F32,
+	// Heights are quantized to 16 bits between the minimum and maximum of 
+	// each tile, which fits twice as many tiles
+	TC_FORMAT_U16,
+};
+
 struct tc_ref
 {
+	// Packed tile in the cache's format, size bytes long
 	void *data;
 	size_t size;
+	tc_format format;
+	// Range of a TC_FORMAT_U16 tile
+	float min, max;
 	alc_atomic_state *p_state;
 };
 
@@ -34,13 +55,84 @@ enum tc_error : int
 	TC_ENULL = -2,
 };
 
-typedef void (*tc_post_load_fn)(void* usr, uint64_t code, const ds_buf *buf);
+// @brief How much a tile is worth loading.  Larger screen-space error goes
+// first, then smaller distance.
+struct tc_priority
+{
+	float error;
+	float dist;
+};
+
+static inline bool tc_priority_less(tc_priority a, tc_priority b)
+{
+	if (a.error != b.error)
+		return a.error < b.error;
+	return a.dist > b.dist;
+}
+
+enum tc_pressure : int
+{
+	// Give back about half of what is in use
+	TC_PRESSURE_MODERATE,
+	// Keep only TILE_CPU_MIN_BUDGET
+	TC_PRESSURE_CRITICAL,
+};
+
+// Called from the loader thread with the tile as floats and the range of its
+// heights, which the cache has already computed
+typedef void (*tc_post_load_fn)(void* usr, uint64_t code, const ds_buf *buf, 
+								float min, float max);
 
 struct tc_cache;
 
-tc_error tc_create(tc_cache **seg, size_t tile_size, size_t capacity);
+struct tc_params
+{
+	// Size of a tile as floats, in bytes
+	size_t tile_size;
+	// Memory for tiles in the cache's format, in bytes
+	size_t capacity;
+	tc_format format;
+
+	// page_alloc_flags for the memory pages are taken from.  With huge pages,
+	// each page of tiles is rounded up to a whole number of them.
+	uint32_t page_flags;
+	// Node to prefer for tile memory.  With PAGE_ALLOC_NODE_ANY, memory is 
+	// placed by the loader threads that first write to it.
+	int numa_node;
+
+	// Optional file that loaded tiles are kept in as floats, and read back 
+	// from instead of the data source, across runs.  See dc_params.
+	const char *disk_path;
+	size_t disk_capacity;
+	uint64_t disk_version;
+};
+
+tc_error tc_create(tc_cache **seg, const tc_params *params);
 void tc_destroy(tc_cache *seg);
 
+// @brief Changes how much memory tiles may take, up to the capacity given to
+// tc_create.  Tiles are evicted and pages returned to the OS until the cache
+// fits; pages still being read or loaded into are returned by later calls 
+// to tc_load.
+void tc_set_budget(tc_cache *tc, size_t bytes);
+size_t tc_budget(const tc_cache *tc);
+
+// @return Bytes of pages that currently hold tiles
+size_t tc_resident_bytes(const tc_cache *tc);
+
+// @return False if the cache has no disk cache
+bool tc_disk_stats(const tc_cache *tc, dc_stats *stats);
+
+// @brief Shrinks the budget in response to the system running low on memory.
+// Meant to be called from whatever notifies the application of it.
+void tc_memory_pressure(tc_cache *tc, tc_pressure level);
+
+// @brief Requests tiles for this frame, and writes the best loaded tile for 
+// each to out.  
+// @note Missing tiles wait in a queue kept between calls, and are loaded in
+// order of priority (or the order given if it is null).  Tiles that are not 
+// requested again the next call are dropped from the queue, and their loads
+// are cancelled if they already started.
 tc_error tc_load(
 	tc_cache *seg, 
 	ds_context const *ds, 
@@ -50,10 +142,43 @@ tc_error tc_load(
 
 	size_t count, 
 	tile_code_t const *tiles, 
+	tc_priority const *priority,
 	tile_code_t *out
 );
 
+// @brief Queues tiles that are likely to come into view for the next call to
+// tc_load.  They are only loaded when no tile requested by tc_load is 
+// waiting, and only use some of the load slots.  No cache entry is reserved
+// for them until their load is dispatched.
+tc_error tc_prefetch(
+	tc_cache *tc,
+	ds_context const *ds,
+
+	size_t count,
+	tile_code_t const *tiles,
+	tc_priority const *priority
+);
+
 tc_error tc_acquire(const tc_cache *tc, tile_code_t code, tc_ref *p_ref);
+
+// @brief Pins the tile, or its nearest ancestor that is ready
+// @return TC_ENULL if none of them are
+tc_error tc_acquire_nearest(
+	const tc_cache *tc, 
+	tile_code_t code, 
+	tc_ref *p_ref, 
+	tile_code_t *p_found
+);
+
+// @brief Height at texel coordinates (x, y) of the tile, interpolated 
+// bilinearly.  Texels are on the corners and edges of the tile, so each 
+// coordinate runs from 0 to TILE_WIDTH - 1.
+// @param p_spread Optional, set to the range of the four texels used
+float tc_ref_sample(const tc_ref &ref, double x, double y, float *p_spread);
+
+// @brief Writes the tile as floats, ref.size bytes for TC_FORMAT_F32 and 
+// twice that for TC_FORMAT_U16
+void tc_ref_decode(const tc_ref &ref, float *dst);
 void tc_release(tc_ref ref);
 
 #endif // CPU_CACHE_H
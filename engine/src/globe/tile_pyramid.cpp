@@ -0,0 +1,192 @@
+#include "tile_pyramid.h"
+
+#include <ev2/utils/log.h>
+
+#include <algorithm>
+#include <cstring>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static int tp_map_file(tp_file *file, const char *path)
+{
+#ifdef _WIN32
+	file->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+						OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file->file == INVALID_HANDLE_VALUE)
+		return -1;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file->file, &size))
+		return -1;
+	file->size = (size_t)size.QuadPart;
+
+	file->mapping = CreateFileMappingA(file->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!file->mapping)
+		return -1;
+
+	file->base = static_cast<const uint8_t*>(
+		MapViewOfFile(file->mapping, FILE_MAP_READ, 0, 0, file->size));
+	return file->base ? 0 : -1;
+#else
+	file->fd = open(path, O_RDONLY);
+	if (file->fd < 0)
+		return -1;
+
+	struct stat st;
+	if (fstat(file->fd, &st) < 0 || !st.st_size)
+		return -1;
+	file->size = (size_t)st.st_size;
+
+	void *mem = mmap(nullptr, file->size, PROT_READ, MAP_SHARED, file->fd, 0);
+	if (mem == MAP_FAILED)
+		return -1;
+
+	file->base = static_cast<const uint8_t*>(mem);
+	return 0;
+#endif
+}
+
+void tp_close(tp_file *file)
+{
+#ifdef _WIN32
+	if (file->base)
+		UnmapViewOfFile(file->base);
+	if (file->mapping)
+		CloseHandle(file->mapping);
+	if (file->file && file->file != INVALID_HANDLE_VALUE)
+		CloseHandle(file->file);
+	file->mapping = nullptr;
+	file->file = INVALID_HANDLE_VALUE;
+#else
+	if (file->base)
+		munmap(const_cast<uint8_t*>(file->base), file->size);
+	if (file->fd >= 0)
+		close(file->fd);
+	file->fd = -1;
+#endif
+	file->base = nullptr;
+	file->size = 0;
+}
+
+// Everything reads through the index, so it is checked once here
+static bool tp_validate(const tp_file *file)
+{
+	if (file->size < TP_INDEX_OFFSET)
+		return false;
+
+	const tp_file_header *hdr = tp_header(file);
+
+	if (memcmp(hdr->magic, TP_MAGIC, sizeof(TP_MAGIC)) ||
+		hdr->file_version != TP_FILE_VERSION ||
+		hdr->tile_width != TILE_WIDTH ||
+		hdr->max_zoom >= TP_MAX_LEVELS)
+		return false;
+
+	// Divided rather than multiplied, so that a damaged count cannot overflow
+	if (hdr->index_offset != TP_INDEX_OFFSET ||
+		hdr->data_offset < hdr->index_offset ||
+		hdr->data_offset > file->size ||
+		hdr->data_offset % TP_ALIGN ||
+		hdr->tile_count > (hdr->data_offset - hdr->index_offset)/sizeof(tp_entry) ||
+		hdr->tile_count > (file->size - hdr->data_offset)/TP_TILE_BYTES)
+		return false;
+
+	uint64_t next = 0;
+	for (uint32_t zoom = 0; zoom < TP_MAX_LEVELS; ++zoom) {
+		for (uint32_t face = 0; face < CUBE_FACES; ++face) {
+			const tp_level &level = hdr->levels[zoom][face];
+			if (level.count && (level.first != next || zoom > hdr->max_zoom ||
+				level.count > hdr->tile_count - next))
+				return false;
+			next += level.count;
+		}
+	}
+
+	return next == hdr->tile_count;
+}
+
+int tp_open(tp_file *file, const char *path)
+{
+	*file = {};
+#ifdef _WIN32
+	file->file = INVALID_HANDLE_VALUE;
+#else
+	file->fd = -1;
+#endif
+
+	if (tp_map_file(file, path) < 0) {
+		log_error("tp_open : failed to map %s", path);
+		tp_close(file);
+		return -1;
+	}
+
+	if (!tp_validate(file)) {
+		log_error("tp_open : %s is not a tile pyramid, or is truncated", path);
+		tp_close(file);
+		return -1;
+	}
+
+#ifndef _WIN32
+	// Every lookup goes through the header and index, which are small next to
+	// the tiles.  The tiles are read in no particular order, and readahead 
+	// past one would only fill the page cache with others that are not needed.
+	uint8_t *base = const_cast<uint8_t*>(file->base);
+	uint64_t data_offset = tp_header(file)->data_offset;
+
+	madvise(base, data_offset, MADV_WILLNEED);
+	madvise(base + data_offset, file->size - data_offset, MADV_RANDOM);
+#endif
+
+	return 0;
+}
+
+void tp_will_need(const tp_file *file, size_t entry)
+{
+#ifndef _WIN32
+	madvise(const_cast<float*>(tp_tile_data(file, entry)), TP_TILE_BYTES, MADV_WILLNEED);
+#else
+	(void)file;
+	(void)entry;
+#endif
+}
+
+bool tp_find(const tp_file *file, uint64_t code, size_t *p_entry)
+{
+	TileCode c = tile_code_unpack(code);
+	if (c.face >= CUBE_FACES)
+		return false;
+
+	const tp_level &level = tp_header(file)->levels[c.zoom][c.face];
+
+	const tp_entry *begin = tp_entries(file) + level.first;
+	const tp_entry *end = begin + level.count;
+
+	const tp_entry *it = std::lower_bound(begin, end, (uint64_t)c.idx,
+		[](const tp_entry &e, uint64_t idx) {
+		return e.idx < idx;
+	});
+
+	if (it == end || it->idx != c.idx)
+		return false;
+
+	*p_entry = (size_t)(it - tp_entries(file));
+	return true;
+}
+
+uint64_t tp_find_nearest(const tp_file *file, uint64_t code, size_t *p_entry)
+{
+	uint8_t zoom = std::min(tile_code_zoom(code), (uint8_t)tp_header(file)->max_zoom);
+
+	for (int z = zoom; z >= 0; --z) {
+		uint64_t anc = tile_code_ancestor(code, (uint8_t)z);
+		if (tp_find(file, anc, p_entry))
+			return anc;
+	}
+
+	return TILE_CODE_NONE_U;
+}
@@ -0,0 +1,148 @@
+#ifndef TILE_PYRAMID_H
+#define TILE_PYRAMID_H
+
+#include <ev2/globe/tiling.h>
+#include <ev2/globe/data_source.h>
+
+#include "utils/common.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+//------------------------------------------------------------------------------
+// File layout
+//
+// | header | index | tiles |
+//
+// The index has one entry per tile, sorted by zoom, then face, then Morton
+// index, and the tiles follow in the same order.  Each tile is TILE_SIZE
+// floats, laid out like the tiles of a ds_load_fn, and starts on a
+// TP_ALIGN boundary.  The file does not need to hold every tile of a level,
+// missing ones are drawn from their nearest ancestor in the file.
+
+static constexpr char TP_MAGIC[8] = {'E','V','2','P','Y','R','M','D'};
+static constexpr uint32_t TP_FILE_VERSION = 1;
+static constexpr size_t TP_ALIGN = 4096;
+static constexpr uint32_t TP_MAX_LEVELS = TILE_CODE_ZOOM_MASK + 1;
+
+// Tiles of one face at one zoom
+struct tp_level
+{
+	// First entry in the index
+	uint64_t first;
+	uint64_t count;
+};
+
+struct tp_file_header
+{
+	char magic[8];
+	uint32_t file_version;
+	uint32_t tile_width;
+	// Finest zoom in the file, on any face
+	uint32_t max_zoom;
+	// Range of every height in the file
+	float min, max;
+	uint32_t reserved;
+	uint64_t tile_count;
+	uint64_t index_offset;
+	uint64_t data_offset;
+	tp_level levels[TP_MAX_LEVELS][CUBE_FACES];
+};
+
+struct tp_entry
+{
+	uint64_t idx;
+	float min, max;
+};
+
+static constexpr size_t TP_TILE_BYTES = align_up(TILE_SIZE*sizeof(float), TP_ALIGN);
+static constexpr size_t TP_INDEX_OFFSET = align_up(sizeof(tp_file_header), TP_ALIGN);
+
+static_assert(sizeof(tp_file_header) <= TP_ALIGN);
+
+//------------------------------------------------------------------------------
+// Reading
+
+struct tp_file
+{
+	const uint8_t *base;
+	size_t size;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#else
+	int fd;
+#endif
+};
+
+// @brief Maps the file at path read-only, and checks its header and index
+// against its size.
+extern int tp_open(tp_file *file, const char *path);
+extern void tp_close(tp_file *file);
+
+static inline const tp_file_header *tp_header(const tp_file *file)
+{
+	return reinterpret_cast<const tp_file_header*>(file->base);
+}
+
+static inline const tp_entry *tp_entries(const tp_file *file)
+{
+	return reinterpret_cast<const tp_entry*>(file->base + tp_header(file)->index_offset);
+}
+
+static inline const float *tp_tile_data(const tp_file *file, size_t entry)
+{
+	return reinterpret_cast<const float*>(
+		file->base + tp_header(file)->data_offset + entry*TP_TILE_BYTES);
+}
+
+// @brief Reads the whole tile into the page cache in one request.  Readahead
+// is off for the tiles, so otherwise copying one faults it in a page at a 
+// time.
+extern void tp_will_need(const tp_file *file, size_t entry);
+
+// @brief Index entry of the tile, by binary search within its level
+// @return Whether the file has it
+extern bool tp_find(const tp_file *file, uint64_t code, size_t *p_entry);
+
+// @brief Finds the tile or its nearest ancestor in the file
+// @return The code of the tile found, or TILE_CODE_NONE_U if the face has
+// none of them
+extern uint64_t tp_find_nearest(const tp_file *file, uint64_t code, size_t *p_entry);
+
+//------------------------------------------------------------------------------
+// Baking
+
+struct tp_bake_params
+{
+	const char *path;
+	const ds_context *ds;
+	// Finest zoom to bake.  Tiles at it are loaded from ds, and coarser ones
+	// are downsampled from their children where all four are baked.
+	uint8_t max_zoom;
+	// Tiles to bake everything below of, down to max_zoom.  Their ancestors
+	// are baked too, so that every tile has one in the file.  The six faces
+	// if there are none.
+	const uint64_t *roots;
+	size_t root_count;
+	// Tasks run at once on the thread pool, one per hardware thread if zero
+	uint32_t threads;
+};
+
+struct tp_bake_stats
+{
+	size_t loaded;
+	size_t downsampled;
+	size_t bytes;
+};
+
+// @brief Writes a tile pyramid file of the tiles from params->ds.  The 
+// header is written last, so a bake that is interrupted leaves a file that
+// tp_open rejects.
+extern int tp_bake(const tp_bake_params *params, tp_bake_stats *stats);
+
+#endif // TILE_PYRAMID_H
@@ -0,0 +1,116 @@
+#include "tile_quant.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+void tile_minmax_f32(const float *src, size_t count, float *p_min, float *p_max)
+{
+	float min = FLT_MAX, max = -FLT_MAX;
+	size_t i = 0;
+
+#ifdef __AVX2__
+	__m256 vmin = _mm256_set1_ps(FLT_MAX);
+	__m256 vmax = _mm256_set1_ps(-FLT_MAX);
+
+	for (; i + 8 <= count; i += 8) {
+		__m256 v = _mm256_loadu_ps(src + i);
+		vmin = _mm256_min_ps(vmin, v);
+		vmax = _mm256_max_ps(vmax, v);
+	}
+
+	alignas(32) float lo[8], hi[8];
+	_mm256_store_ps(lo, vmin);
+	_mm256_store_ps(hi, vmax);
+
+	for (int k = 0; k < 8; ++k) {
+		min = std::min(min, lo[k]);
+		max = std::max(max, hi[k]);
+	}
+#endif
+
+	for (; i < count; ++i) {
+		min = std::min(min, src[i]);
+		max = std::max(max, src[i]);
+	}
+
+	*p_min = min;
+	*p_max = max;
+}
+
+void tile_encode_u16(
+	const float *src, 
+	size_t count, 
+	float min, 
+	float max, 
+	uint16_t *dst
+)
+{
+	float step = tile_quant_step(min, max);
+	float scale = step > 0 ? 1.0f/step : 0;
+
+	size_t i = 0;
+
+#ifdef __AVX2__
+	const __m256 vmin = _mm256_set1_ps(min);
+	const __m256 vscale = _mm256_set1_ps(scale);
+	const __m256 vtop = _mm256_set1_ps((float)UINT16_MAX);
+	const __m256 vzero = _mm256_setzero_ps();
+
+	for (; i + 16 <= count; i += 16) {
+		__m256 a = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(src + i), vmin), vscale);
+		__m256 b = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(src + i + 8), vmin), vscale);
+
+		a = _mm256_min_ps(_mm256_max_ps(a, vzero), vtop);
+		b = _mm256_min_ps(_mm256_max_ps(b, vzero), vtop);
+
+		// Rounds to nearest
+		__m256i qa = _mm256_cvtps_epi32(a);
+		__m256i qb = _mm256_cvtps_epi32(b);
+
+		// Packing works within 128 bit lanes, so the middle quarters are 
+		// swapped back afterwards
+		__m256i q = _mm256_packus_epi32(qa, qb);
+		q = _mm256_permute4x64_epi64(q, _MM_SHUFFLE(3, 1, 2, 0));
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), q);
+	}
+#endif
+
+	for (; i < count; ++i) {
+		float q = std::clamp((src[i] - min)*scale, 0.0f, (float)UINT16_MAX);
+		dst[i] = (uint16_t)lrintf(q);
+	}
+}
+
+void tile_decode_u16(
+	const uint16_t *src, 
+	size_t count, 
+	float min, 
+	float max, 
+	float *dst
+)
+{
+	float step = tile_quant_step(min, max);
+
+	size_t i = 0;
+
+#ifdef __AVX2__
+	const __m256 vmin = _mm256_set1_ps(min);
+	const __m256 vstep = _mm256_set1_ps(step);
+
+	for (; i + 8 <= count; i += 8) {
+		__m128i q = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		__m256 f = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(q));
+
+		_mm256_storeu_ps(dst + i, _mm256_add_ps(vmin, _mm256_mul_ps(f, vstep)));
+	}
+#endif
+
+	for (; i < count; ++i)
+		dst[i] = min + (float)src[i]*step;
+}
@@ -0,0 +1,33 @@
+#ifndef TILE_QUANT_H
+#define TILE_QUANT_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Heights stored as 16 bit steps between the minimum and maximum of a tile.
+// A decoded value is off by half a step at most, plus float rounding.
+
+static inline float tile_quant_step(float min, float max)
+{
+	return (max - min)/(float)UINT16_MAX;
+}
+
+extern void tile_minmax_f32(const float *src, size_t count, float *p_min, float *p_max);
+
+extern void tile_encode_u16(
+	const float *src, 
+	size_t count, 
+	float min, 
+	float max, 
+	uint16_t *dst
+);
+
+extern void tile_decode_u16(
+	const uint16_t *src, 
+	size_t count, 
+	float min, 
+	float max, 
+	float *dst
+);
+
+#endif // TILE_QUANT_H
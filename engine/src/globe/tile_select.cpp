@@ -0,0 +1,1697 @@
+#include "tile_select.h"
+
+#include "utils/thread_pool.h"
+#include "debug/box_debug_view.h"
+
+#include <glm/vec3.hpp>
+#include <glm/mat3x3.hpp>
+
+#include <atomic>
+#include <thread>
+#include <queue>
+#include <unordered_set>
+#include <cassert>
+#include <vector>
+#include <cfloat>
+#include <algorithm>
+
+obb_t tile_obb(TileCode code, double min, double max) 
+{
+	uint8_t face = code.face;
+
+	aabb2_t rect = morton_u64_to_rect_f64(code.idx,code.zoom);
+	glm::dvec2 mid_uv = 0.5*(rect.ur() + rect.ll());
+
+	double h = max - min;
+
+	glm::dvec3 mid = cube_to_globe(face, mid_uv);
+	mid *= (1.0 + 0.5*(min + max));
+
+	double s_min = 1.0 + min;
+	double s_max = 1.0 + max;
+
+	obb_t box;
+	box.T = orthonormal_globe_frame(mid_uv, face);
+	box.O = mid;
+	box.S = glm::dvec3(0,0,0.5*h);
+
+	// TODO : It should be possible to determine the minimum 
+	// dimensions of the box with less operations.
+	glm::dvec3 c[8] = {
+		cube_to_globe(face, rect.ll()),
+		cube_to_globe(face, rect.lr()),
+		cube_to_globe(face, rect.ul()),
+		cube_to_globe(face, rect.ur()),
+	};
+
+	for (size_t i = 0; i < 4; ++i) {
+		c[4 + i] = c[i] * s_max;
+		c[i] *= s_min;
+	}
+
+	obb_add(box, sizeof(c)/sizeof(c[0]),c);
+
+	return box;
+}
+
+double tile_occluder_radius(const mmt_tree *mmt)
+{
+	float h_min = FLT_MAX;
+
+	for (uint8_t f = 0; f < CUBE_FACES; ++f) {
+		TileCode root = {
+			.face = f,
+			.zoom = 0,
+			.idx = 0
+		};
+		h_min = std::min(h_min, mmt_minmax(mmt, tile_code_pack(root)).min);
+	}
+
+	return 1.0 + (double)h_min;
+}
+
+/// @brief Sorts the selection by distance and writes the codes
+static void select_tiles_finish(
+	const select_tiles_params& params,
+	frame_vector<selection_entry_t>& selection,
+	std::vector<tile_code_t>& tiles
+)
+{
+	constexpr auto comp = [](const selection_entry_t &a, const selection_entry_t &b) {
+		if (a.dist != b.dist)
+			return a.dist < b.dist;
+		return tile_code_pack(a.code) < tile_code_pack(b.code);
+	};
+	std::sort(selection.begin(), selection.end(), comp);
+
+	if (params.boxes) {
+		for (const selection_entry_t &ent : selection) {
+			mmt_result_t mmt_res = mmt_minmax(params.mmt, tile_code_pack(ent.code));
+			params.boxes->add(tile_obb(ent.code, 
+							  (double)mmt_res.min, (double)mmt_res.max));
+		}
+	}
+
+	// Only the unbudgeted reference selectors can go over
+	size_t count = std::min(selection.size(), params.max_tiles);
+
+	tiles.resize(count);
+	for (size_t i = 0; i < count; ++i) {
+		tiles[i] = tile_code_pack(selection[i].code);
+	}
+}
+
+// Subtrees below this many per worker thread are expanded on the calling 
+// thread before selection fans out to the thread pool.
+static constexpr size_t SELECT_SUBTREES_PER_THREAD = 4;
+
+static constexpr double tile_scale_factor = 12;
+
+/// @brief Leaf or refine decision for a tile that passed culling
+static select_result_t select_tile_resolve(
+	const select_tiles_params *params,
+	TileCode code,
+	int mmt_dist,
+	double d_min_sq,
+	selection_entry_t *p_ent)
+{
+	double dist = std::max(tile_scale_factor*sqrt(d_min_sq),1e-6);
+
+	double area = tile_factor(code);
+
+	*p_ent = {code, dist};
+
+	if (area/dist < params->res || mmt_dist >= params->max_mmt_dist) {
+		return SELECT_LEAF;
+	}
+
+	return SELECT_REFINE;
+}
+
+/// @brief Classifies a single node of the tile quadtree.  
+/// @param p_ent - Set to the selection entry for the tile unless culled.
+static select_result_t select_tile_test(
+	const select_tiles_params *params,
+	TileCode code,
+	selection_entry_t *p_ent)
+{
+	if (code.zoom > 23)
+		return SELECT_CULLED;
+
+	uint64_t u64 = tile_code_pack(code);
+
+	mmt_result_t mmt_res = mmt_minmax(params->mmt, u64);
+	obb_t box = tile_obb(code, (double)mmt_res.min, (double)mmt_res.max);
+
+	if (code.zoom > 1 && dot(box.T[2],params->origin) < 0)
+		return SELECT_CULLED;
+
+	if (obb_occluded(box, params->occluder_radius, params->origin))
+		return SELECT_CULLED;
+
+	for (uint8_t i = 0; i < 6; ++i) {
+		if (classify(box, params->frust.planes[i]) > 0) { 
+			return SELECT_CULLED;
+		}
+	}
+
+	double d_min_sq = obb_dist_sq(box, params->origin);
+
+	return select_tile_resolve(params, code, mmt_res.dist, d_min_sq, p_ent);
+}
+
+/// @brief Same as select_tile_test, but also gives how far each clock can
+/// advance before the result could change (see select_cut_motion).  Eye 
+/// tests move by at most the distance the camera moves, and frustum tests by
+/// the change in the planes, scaled by the size of the box.
+/// @param margin - Set to the advance on each clock before a test could change
+static select_result_t select_tile_test_margin(
+	const select_tiles_params *params,
+	TileCode code,
+	selection_entry_t *p_ent,
+	double margin[SELECT_CLOCK_COUNT])
+{
+	if (code.zoom > 23) {
+		margin[SELECT_CLOCK_EYE] = DBL_MAX;
+		margin[SELECT_CLOCK_FRUSTUM] = DBL_MAX;
+		return SELECT_CULLED;
+	}
+
+	uint64_t u64 = tile_code_pack(code);
+
+	mmt_result_t mmt_res = mmt_minmax(params->mmt, u64);
+	obb_t box = tile_obb(code, (double)mmt_res.min, (double)mmt_res.max);
+
+	glm::dvec3 eye = params->origin;
+
+	// A culled tile stays culled until every test that culls it passes, and a
+	// visible one until any test fails
+	double cull[SELECT_CLOCK_COUNT] = {-DBL_MAX, -DBL_MAX};
+	double keep[SELECT_CLOCK_COUNT] = {DBL_MAX, DBL_MAX};
+
+	auto add = [&](select_clock_t clock, bool culled, double m) {
+		m = std::max(m, 0.0);
+		if (culled)
+			cull[clock] = std::max(cull[clock], m);
+		keep[clock] = std::min(keep[clock], m);
+	};
+
+	if (code.zoom > 1) {
+		double s = dot(box.T[2], eye);
+		add(SELECT_CLOCK_EYE, s < 0, fabs(s));
+	}
+
+	// Each corner is hidden while the segment from the eye to it passes
+	// inside the sphere, and that distance moves no more than the eye does.
+	// Corners inside the sphere are always hidden.  Same test as 
+	// obb_occluded.
+	double r = params->occluder_radius;
+	double r_sq = r*r;
+	double eye_len = length(eye);
+
+	if (dot(eye,eye) <= r_sq) {
+		add(SELECT_CLOCK_EYE, false, r - eye_len);
+	} else {
+		bool occluded = true;
+		double gap_sq = 0;
+
+		for (int i = 0; i < 8; ++i) {
+			glm::dvec3 p = box.O + 
+				box.T[0]*((i & 1) ? box.S.x : -box.S.x) + 
+				box.T[1]*((i & 2) ? box.S.y : -box.S.y) + 
+				box.T[2]*((i & 4) ? box.S.z : -box.S.z);
+
+			if (dot(p,p) < r_sq)
+				continue;
+
+			glm::dvec3 d = p - eye;
+			double dd = dot(d,d);
+			double t = dd > 0 ? std::clamp(-dot(eye,d)/dd, 0.0, 1.0) : 0.0;
+			glm::dvec3 c = eye + t*d;
+			double c_sq = dot(c,c);
+
+			occluded &= c_sq < r_sq;
+			gap_sq = std::max(gap_sq, c_sq);
+		}
+
+		double gap = sqrt(gap_sq) - r;
+		add(SELECT_CLOCK_EYE, occluded, occluded ? std::min(-gap, eye_len - r) : gap);
+	}
+
+	// Same test as classify, which culls when f > 0
+	double extent = std::max(1.0, length(box.O) + box.S.x + box.S.y + box.S.z);
+
+	for (uint8_t i = 0; i < 6; ++i) {
+		const plane_t &pl = params->frust.planes[i];
+
+		double s = dot(pl.n, box.O) - pl.d;
+		double e = 
+			fabs(box.S.x*dot(pl.n, box.T[0])) + 
+			fabs(box.S.y*dot(pl.n, box.T[1])) + 
+			fabs(box.S.z*dot(pl.n, box.T[2]));
+
+		add(SELECT_CLOCK_FRUSTUM, s > e, fabs(s - e)/extent);
+	}
+
+	// Only one test has to keep culling, so the clocks are not both needed
+	if (cull[SELECT_CLOCK_EYE] >= 0 || cull[SELECT_CLOCK_FRUSTUM] >= 0) {
+		select_clock_t clock = cull[SELECT_CLOCK_EYE] >= cull[SELECT_CLOCK_FRUSTUM] ? 
+			SELECT_CLOCK_EYE : SELECT_CLOCK_FRUSTUM;
+		margin[SELECT_CLOCK_EYE] = DBL_MAX;
+		margin[SELECT_CLOCK_FRUSTUM] = DBL_MAX;
+		margin[clock] = cull[clock];
+		return SELECT_CULLED;
+	}
+
+	double d_min_sq = obb_dist_sq(box, eye);
+
+	if (mmt_res.dist < params->max_mmt_dist) {
+		double d_leaf = tile_factor(code)/(tile_scale_factor*params->res);
+		add(SELECT_CLOCK_EYE, false, fabs(sqrt(d_min_sq) - d_leaf));
+	}
+
+	margin[SELECT_CLOCK_EYE] = keep[SELECT_CLOCK_EYE];
+	margin[SELECT_CLOCK_FRUSTUM] = keep[SELECT_CLOCK_FRUSTUM];
+
+	return select_tile_resolve(params, code, mmt_res.dist, d_min_sq, p_ent);
+}
+
+/// @brief Classifies the four children of a refined tile together.  Same 
+/// result as calling select_tile_test on each child, but the frustum and 
+/// distance tests are done on all four boxes at once.
+static void select_children_test(
+	const select_tiles_params *params,
+	TileCode code,
+	selection_entry_t ents[4],
+	select_result_t res[4])
+{
+	static_assert(OBB_BATCH_WIDTH == 4);
+
+	if (code.zoom + 1 > 23) {
+		for (uint8_t i = 0; i < 4; ++i) 
+			res[i] = SELECT_CULLED;
+		return;
+	}
+
+	TileCode children[4];
+	mmt_result_t mmt_res[4];
+	obb_t boxes[4];
+
+	for (uint8_t i = 0; i < 4; ++i) {
+		children[i] = tile_code_refine(code, (tile_quadrant_t)i);
+		mmt_res[i] = mmt_minmax(params->mmt, tile_code_pack(children[i]));
+		boxes[i] = tile_obb(children[i], 
+					  (double)mmt_res[i].min, (double)mmt_res[i].max);
+	}
+
+	obb_batch_t batch;
+	obb_batch_pack(batch, boxes, 4);
+
+	uint32_t culled = obb_batch_cull(batch, params->frust.planes, 6);
+
+	double d_min_sq[4];
+	obb_batch_dist_sq(batch, params->origin, d_min_sq);
+
+	for (uint8_t i = 0; i < 4; ++i) {
+		if (children[i].zoom > 1 && dot(boxes[i].T[2],params->origin) < 0)
+			culled |= 1u << i;
+
+		if (!(culled & (1u << i)) && 
+			obb_occluded(boxes[i], params->occluder_radius, params->origin))
+			culled |= 1u << i;
+
+		if (culled & (1u << i)) {
+			res[i] = SELECT_CULLED;
+			continue;
+		}
+
+		res[i] = select_tile_resolve(params, children[i], mmt_res[i].dist, 
+							   d_min_sq[i], &ents[i]);
+	}
+}
+
+/// @return Number of tiles added to out
+static inline int select_tiles_rec(
+	frame_vector<selection_entry_t> &out, 
+	const select_tiles_params *params,
+	TileCode code)
+{
+	selection_entry_t ent;
+
+	switch (select_tile_test(params, code, &ent)) {
+	case SELECT_CULLED: 
+		return 0;
+	case SELECT_LEAF:
+		out.push_back(ent);
+		return 1;
+	case SELECT_REFINE:
+		break;
+	}
+
+	int status = 0;
+	for (uint8_t i = 0; i < 4; ++i) {
+		status += select_tiles_rec(out, params, 
+							 tile_code_refine(code,(tile_quadrant_t)i));
+	}
+
+	// If status is zero than no tiles were added, so add this tile
+	if (!status) {
+		out.push_back(ent);
+		return 1;
+	}
+
+	return status;
+}
+
+//------------------------------------------------------------------------------
+// Selection trees
+
+static constexpr uint32_t SELECT_NO_NODE = UINT32_MAX;
+
+// @brief Node of the tree explored by select_tiles.  The four children of a
+// refined node are next to each other, after it.
+struct select_tree_node_t
+{
+	selection_entry_t ent;
+	select_result_t res;
+	// First child, or SELECT_NO_NODE if the node was not refined
+	uint32_t children;
+	// Tree the node was continued in by a task, or SELECT_NO_NODE
+	uint32_t subtree;
+	// Tiles selected at or below the node
+	int status;
+};
+
+typedef frame_vector<select_tree_node_t> select_tree_t;
+
+static select_tree_node_t select_tree_node(TileCode code)
+{
+	return select_tree_node_t{
+		.ent = {code, DBL_MAX},
+		.res = SELECT_CULLED,
+		.children = SELECT_NO_NODE,
+		.subtree = SELECT_NO_NODE,
+		.status = 0,
+	};
+}
+
+/// @brief Explores the subtree below code breadth-first, testing the 
+/// children of each refined node together.  The root is tree[0].
+static void select_tree_bfs(
+	select_tree_t &tree,
+	const select_tiles_params *params,
+	TileCode code)
+{
+	tree.push_back(select_tree_node(code));
+	tree[0].res = select_tile_test(params, code, &tree[0].ent);
+
+	for (size_t head = 0; head < tree.size(); ++head) {
+		if (tree[head].res != SELECT_REFINE)
+			continue;
+
+		selection_entry_t ents[4];
+		select_result_t res[4];
+
+		TileCode parent = tree[head].ent.code;
+		select_children_test(params, parent, ents, res);
+
+		tree[head].children = (uint32_t)tree.size();
+
+		for (uint8_t i = 0; i < 4; ++i) {
+			tree.push_back(select_tree_node(tile_code_refine(parent, (tile_quadrant_t)i)));
+			tree.back().res = res[i];
+			if (res[i] != SELECT_CULLED)
+				tree.back().ent = ents[i];
+		}
+	}
+}
+
+/// @brief Resolves the fallback of select_tiles_rec bottom-up: a refined node 
+/// is selected itself if nothing below it is.  Children follow their parents,
+/// so walking the tree backwards sees them first.
+/// @param subtrees - Trees that nodes were continued in, already resolved
+static void select_tree_resolve(
+	select_tree_t &tree,
+	const select_tree_t *subtrees,
+	frame_vector<selection_entry_t> &out)
+{
+	for (size_t i = tree.size(); i-- > 0;) {
+		select_tree_node_t &node = tree[i];
+
+		if (node.subtree != SELECT_NO_NODE) {
+			node.status = subtrees[node.subtree][0].status;
+			continue;
+		}
+
+		switch (node.res) {
+		case SELECT_CULLED:
+			node.status = 0;
+			break;
+		case SELECT_LEAF:
+			node.status = 1;
+			out.push_back(node.ent);
+			break;
+		case SELECT_REFINE:
+			node.status = 0;
+			for (uint32_t c = node.children; c < node.children + 4; ++c)
+				node.status += tree[c].status;
+
+			if (!node.status) {
+				node.status = 1;
+				out.push_back(node.ent);
+			}
+			break;
+		}
+	}
+}
+
+//------------------------------------------------------------------------------
+// Budgeted selection
+
+/// @brief Screen-space error used to order refinement
+static double select_error(const selection_entry_t &ent, select_result_t res)
+{
+	if (res == SELECT_CULLED)
+		return 0;
+
+	return tile_factor(ent.code)/ent.dist;
+}
+
+template<typename Ref>
+struct select_greedy_item_t
+{
+	selection_entry_t ent;
+	select_result_t res;
+	Ref ref;
+};
+
+template<typename Ref>
+struct select_greedy_entry_t
+{
+	double err;
+	uint64_t code;
+	select_greedy_item_t<Ref> val;
+
+	// Ties go to the lower code, so that the order does not depend on how 
+	// the candidates were found
+	bool operator < (const select_greedy_entry_t &other) const {
+		if (err != other.err)
+			return err < other.err;
+		return code > other.code;
+	}
+};
+
+// @brief Refines the tile with the largest screen-space error first, as long
+// as its visible children still fit in max_tiles.  A tile whose children do 
+// not fit is kept, and smaller splits further down the queue are still tried.
+//
+// Produces the same tiles as select_tiles_rec when the budget is not reached,
+// and always a complete cover of the visible surface.
+// @param children - Fills the four children of a refined item
+template<typename Ref, typename F>
+static void select_greedy(
+	const select_tiles_params &params,
+	const select_greedy_item_t<Ref> *roots,
+	size_t root_count,
+	F &&children,
+	frame_vector<selection_entry_t> &selection)
+{
+	typedef select_greedy_entry_t<Ref> entry_t;
+
+	std::priority_queue<entry_t, frame_vector<entry_t>> queue (
+		frame_allocator<entry_t>(params.arena));
+
+	// visible tiles in the selection and the queue
+	size_t count = 0;
+
+	auto add = [&](const select_greedy_item_t<Ref> &item) {
+		switch (item.res) {
+		case SELECT_CULLED:
+			return;
+		case SELECT_LEAF:
+			selection.push_back(item.ent);
+			break;
+		case SELECT_REFINE:
+			queue.push({select_error(item.ent, item.res), 
+				tile_code_pack(item.ent.code), item});
+			break;
+		}
+		++count;
+	};
+
+	for (size_t i = 0; i < root_count; ++i)
+		add(roots[i]);
+
+	while (!queue.empty()) {
+		select_greedy_item_t<Ref> e = queue.top().val;
+		queue.pop();
+
+		select_greedy_item_t<Ref> c[4];
+		children(e, c);
+
+		size_t visible = 0;
+		for (uint8_t i = 0; i < 4; ++i)
+			visible += c[i].res != SELECT_CULLED;
+
+		// Same fallback as select_tiles_rec, or a split that does not fit
+		if (!visible || count - 1 + visible > params.max_tiles) {
+			selection.push_back(e.ent);
+			continue;
+		}
+
+		count += visible - 1;
+
+		for (uint8_t i = 0; i < 4; ++i) 
+			add(c[i]);
+	}
+}
+
+void select_tiles_greedy(
+	select_tiles_params& params,
+	std::vector<tile_code_t>& tiles
+)
+{
+	params.res = std::max(params.res, 1e-5);
+
+	const select_tiles_params *p_params = &params;
+
+	typedef select_greedy_item_t<char> item_t;
+
+	item_t roots[CUBE_FACES];
+	for (uint8_t f = 0; f < CUBE_FACES; ++f) {
+		TileCode code = {
+			.face = f,
+			.zoom = 0,
+			.idx = 0
+		};
+
+		roots[f] = {{code, DBL_MAX}, SELECT_CULLED, 0};
+		roots[f].res = select_tile_test(p_params, code, &roots[f].ent);
+	}
+
+	frame_vector<selection_entry_t> selection (params.arena);
+
+	select_greedy(params, roots, CUBE_FACES, [&](const item_t &e, item_t c[4]) {
+		selection_entry_t ents[4];
+		select_result_t res[4];
+
+		select_children_test(p_params, e.ent.code, ents, res);
+
+		for (uint8_t i = 0; i < 4; ++i)
+			c[i] = {ents[i], res[i], 0};
+	}, selection);
+
+	select_tiles_finish(params, selection, tiles);
+}
+
+// Node of the trees explored by select_tiles.  tree is SELECT_NO_NODE for the
+// nodes above the subtrees.
+struct select_tree_ref_t
+{
+	uint32_t tree;
+	uint32_t node;
+};
+
+/// @brief Spends the budget on the trees select_tiles already explored.  The
+/// same tiles as select_tiles_greedy, without testing any of them again.
+static void select_trees_greedy(
+	const select_tiles_params &params,
+	const select_tree_t &top,
+	const select_tree_t *subtrees,
+	frame_vector<selection_entry_t> &selection)
+{
+	typedef select_greedy_item_t<select_tree_ref_t> item_t;
+
+	auto item = [&](select_tree_ref_t ref) {
+		const select_tree_node_t *node = ref.tree == SELECT_NO_NODE ? 
+			&top[ref.node] : &subtrees[ref.tree][ref.node];
+
+		// Continued in a subtree, whose root is the same tile
+		if (node->subtree != SELECT_NO_NODE) {
+			ref = {node->subtree, 0};
+			node = &subtrees[ref.tree][0];
+		}
+
+		return item_t{node->ent, node->res, ref};
+	};
+
+	item_t roots[CUBE_FACES];
+	for (uint32_t f = 0; f < CUBE_FACES; ++f)
+		roots[f] = item({SELECT_NO_NODE, f});
+
+	select_greedy(params, roots, CUBE_FACES, [&](const item_t &e, item_t c[4]) {
+		const select_tree_node_t &node = e.ref.tree == SELECT_NO_NODE ? 
+			top[e.ref.node] : subtrees[e.ref.tree][e.ref.node];
+
+		for (uint32_t i = 0; i < 4; ++i)
+			c[i] = item({e.ref.tree, node.children + i});
+	}, selection);
+}
+
+struct select_subtree_task_t
+{
+	// Node above the subtrees that the task continues
+	uint32_t node;
+};
+
+// The top of the quadtree is expanded breadth-first on the calling thread 
+// until there are enough subtrees to occupy the thread pool.  Subtrees are 
+// then explored in parallel, and the fallback for refined nodes whose 
+// children were all culled is resolved afterwards, bottom-up.  The result 
+// does not depend on scheduling.  Within a subtree, the four children of a 
+// refined node are culled together with obb_batch_cull.
+//
+// Every tested node is kept, so that going over max_tiles only takes a 
+// greedy pass over the explored trees.
+void select_tiles(
+	select_tiles_params& params,
+	std::vector<tile_code_t>& tiles
+)
+{
+	params.res = std::max(params.res, 1e-5);
+
+	const select_tiles_params *p_params = &params;
+
+	frame_allocator<selection_entry_t> alloc (params.arena);
+
+	// Nodes above the subtrees.  Parents always precede children.
+	select_tree_t top (alloc);
+	frame_vector<uint32_t> frontier (alloc), next (alloc);
+
+	for (uint8_t f = 0; f < CUBE_FACES; ++f) {
+		TileCode code = {
+			.face = f,
+			.zoom = 0,
+			.idx = 0
+		};
+		frontier.push_back((uint32_t)top.size());
+		top.push_back(select_tree_node(code));
+	}
+
+	size_t target = SELECT_SUBTREES_PER_THREAD*
+		std::max(std::thread::hardware_concurrency(), 1U);
+
+	while (!frontier.empty() && frontier.size() < target) {
+		next.clear();
+
+		for (uint32_t i : frontier) {
+			TileCode code = top[i].ent.code;
+			top[i].res = select_tile_test(p_params, code, &top[i].ent);
+
+			if (top[i].res != SELECT_REFINE)
+				continue;
+
+			top[i].children = (uint32_t)top.size();
+
+			for (uint8_t q = 0; q < 4; ++q) {
+				next.push_back((uint32_t)top.size());
+				top.push_back(select_tree_node(tile_code_refine(code, (tile_quadrant_t)q)));
+			}
+		}
+
+		std::swap(frontier, next);
+	}
+
+	//-----------------------------------------------------------------------------
+	// Explore the remaining subtrees in parallel
+
+	size_t task_count = frontier.size();
+
+	frame_vector<select_tree_t> subtrees (alloc);
+	subtrees.reserve(task_count);
+
+	for (uint32_t i : frontier) {
+		top[i].subtree = (uint32_t)subtrees.size();
+		subtrees.emplace_back(alloc);
+	}
+
+	struct select_tasks_t
+	{
+		select_tree_t *subtrees;
+		const select_tree_t *top;
+		const uint32_t *nodes;
+		const select_tiles_params *params;
+		std::atomic_size_t next;
+		std::atomic_int ctr;
+		std::atomic_bool done;
+	} tasks = {
+		.subtrees = subtrees.data(),
+		.top = &top,
+		.nodes = frontier.data(),
+		.params = p_params,
+		.next = 0,
+		.ctr = (int)task_count,
+		.done = false,
+	};
+
+	// Only a pointer is captured, which std::function stores without 
+	// allocating
+	select_tasks_t *p_tasks = &tasks;
+
+	for (size_t i = 0; i < task_count; ++i) {
+		g_schedule_task([p_tasks](){
+			size_t k = p_tasks->next++;
+			TileCode code = (*p_tasks->top)[p_tasks->nodes[k]].ent.code;
+
+			select_tree_bfs(p_tasks->subtrees[k], p_tasks->params, code);
+
+			int value = p_tasks->ctr.fetch_sub(1);
+			if (value <= 1) {
+				p_tasks->done.store(true);
+				p_tasks->done.notify_one();
+			}
+		});
+	}
+
+	if (task_count)
+		tasks.done.wait(false);
+
+	for (uint32_t i : frontier) {
+		const select_tree_node_t &root = subtrees[top[i].subtree][0];
+		top[i].ent = root.ent;
+		top[i].res = root.res;
+	}
+
+	//-----------------------------------------------------------------------------
+	// Merge
+
+	frame_vector<selection_entry_t> selection (alloc);
+
+	for (select_tree_t &tree : subtrees)
+		select_tree_resolve(tree, nullptr, selection);
+
+	select_tree_resolve(top, subtrees.data(), selection);
+
+	// Over budget, so spend it where the error is largest instead
+	if (selection.size() > params.max_tiles) {
+		selection.clear();
+		select_trees_greedy(params, top, subtrees.data(), selection);
+	}
+
+	select_tiles_finish(params, selection, tiles);
+}
+
+//------------------------------------------------------------------------------
+// Cut map
+
+static inline size_t select_cut_hash(tile_code_t key)
+{
+	// splitmix64 finalizer, as in alc_map
+	key ^= key >> 30;
+	key *= 0xbf58476d1ce4e5b9ULL;
+	key ^= key >> 27;
+	key *= 0x94d049bb133111ebULL;
+	key ^= key >> 31;
+	return (size_t)key;
+}
+
+static size_t select_cut_lookup(const select_cut_map &map, tile_code_t key)
+{
+	if (map.buckets.empty())
+		return SIZE_MAX;
+
+	size_t mask = map.buckets.size() - 1;
+	size_t i = select_cut_hash(key) & mask;
+
+	for (uint32_t dist = 1;; ++dist, i = (i + 1) & mask) {
+		const select_cut_bucket &b = map.buckets[i];
+
+		// The key would have displaced this bucket if it were present
+		if (b.dist < dist)
+			return SIZE_MAX;
+
+		if (b.key == key)
+			return i;
+	}
+}
+
+static void select_cut_place(select_cut_map &map, select_cut_bucket ins)
+{
+	size_t mask = map.buckets.size() - 1;
+	size_t i = select_cut_hash(ins.key) & mask;
+
+	for (ins.dist = 1;; ++ins.dist, i = (i + 1) & mask) {
+		select_cut_bucket &b = map.buckets[i];
+
+		if (!b.dist) {
+			b = ins;
+			return;
+		}
+
+		// Take from the rich
+		if (b.dist < ins.dist)
+			std::swap(b, ins);
+	}
+}
+
+static void select_cut_map_insert(select_cut_map &map, tile_code_t key, uint32_t node)
+{
+	// Keep the load factor at or below one half
+	if (2*(map.size + 1) > map.buckets.size()) {
+		std::vector<select_cut_bucket> old (std::max(2*map.buckets.size(), (size_t)64));
+		std::swap(old, map.buckets);
+
+		for (const select_cut_bucket &b : old) {
+			if (b.dist)
+				select_cut_place(map, b);
+		}
+	}
+
+	select_cut_place(map, select_cut_bucket{.key = key, .node = node, .dist = 1});
+	++map.size;
+}
+
+static void select_cut_map_erase(select_cut_map &map, size_t i)
+{
+	size_t mask = map.buckets.size() - 1;
+
+	// Backward shift deletion, so there are no tombstones
+	for (;;) {
+		size_t next = (i + 1) & mask;
+		select_cut_bucket &b = map.buckets[next];
+
+		if (b.dist <= 1)
+			break;
+
+		map.buckets[i] = b;
+		--map.buckets[i].dist;
+		i = next;
+	}
+
+	map.buckets[i] = {};
+	--map.size;
+}
+
+static uint32_t select_cut_find(const SelectionCut &cut, tile_code_t code)
+{
+	size_t i = select_cut_lookup(cut.map, code);
+	return i == SIZE_MAX ? SELECT_NO_NODE : cut.map.buckets[i].node;
+}
+
+void select_cut_clear(SelectionCut& cut)
+{
+	std::fill(cut.map.buckets.begin(), cut.map.buckets.end(), select_cut_bucket{});
+	cut.map.size = 0;
+	cut.nodes.clear();
+	cut.free_nodes.clear();
+	cut.visible.clear();
+	for (std::vector<select_cut_queued> &d : cut.dues)
+		d.clear();
+	cut.splits.clear();
+	for (std::vector<select_cut_queued> &w : cut.waiting)
+		w.clear();
+	cut.merges.clear();
+	for (double &m : cut.motion)
+		m = 0;
+}
+
+//------------------------------------------------------------------------------
+// Incremental selection
+
+// Bounds the work done by the incremental selector in a single frame, as a 
+// multiple of max_tiles.  Any remaining splits are carried over to the next 
+// frame.
+static constexpr size_t SELECT_MAX_SPLITS_PER_TILE = 4;
+
+// All the queues of the cut pop the smallest key first.  Splits are keyed by
+// their negated error, so that the largest goes first.
+static bool select_cut_queued_after(const select_cut_queued &a, const select_cut_queued &b)
+{
+	if (a.key != b.key)
+		return a.key > b.key;
+	return a.code > b.code;
+}
+
+static void select_cut_push(
+	SelectionCut &cut, 
+	std::vector<select_cut_queued> &heap, 
+	uint32_t n, 
+	double key)
+{
+	const select_cut_node &node = cut.nodes[n];
+	heap.push_back({key, tile_code_pack(node.ent.code), n, node.stamp});
+	std::push_heap(heap.begin(), heap.end(), select_cut_queued_after);
+}
+
+static select_cut_queued select_cut_pop(std::vector<select_cut_queued> &heap)
+{
+	std::pop_heap(heap.begin(), heap.end(), select_cut_queued_after);
+	select_cut_queued q = heap.back();
+	heap.pop_back();
+	return q;
+}
+
+static bool select_cut_current(const SelectionCut &cut, const select_cut_queued &q)
+{
+	return cut.nodes[q.node].stamp == q.stamp;
+}
+
+/// @brief Drops entries for older states once they outnumber the nodes
+static void select_cut_compact(SelectionCut &cut, std::vector<select_cut_queued> &heap)
+{
+	if (heap.size() <= 2*cut.map.size + 64)
+		return;
+
+	heap.erase(std::remove_if(heap.begin(), heap.end(), [&](const select_cut_queued &q) {
+		return !select_cut_current(cut, q);
+	}), heap.end());
+	std::make_heap(heap.begin(), heap.end(), select_cut_queued_after);
+}
+
+static uint32_t select_cut_child(const SelectionCut &cut, uint32_t n, uint8_t i)
+{
+	TileCode code = tile_code_refine(cut.nodes[n].ent.code, (tile_quadrant_t)i);
+	return select_cut_find(cut, tile_code_pack(code));
+}
+
+static uint32_t select_cut_parent(const SelectionCut &cut, uint32_t n)
+{
+	TileCode code = cut.nodes[n].ent.code;
+	if (!code.zoom)
+		return SELECT_NO_NODE;
+	return select_cut_find(cut, tile_code_coarsen(tile_code_pack(code)));
+}
+
+/// @brief Adds or removes the node from the selection, which holds the leaves
+/// that are not culled
+static void select_cut_update_visible(SelectionCut &cut, uint32_t n)
+{
+	select_cut_node &node = cut.nodes[n];
+	bool selected = !node.split && node.res != SELECT_CULLED;
+
+	if (selected && node.visible == SELECT_NO_NODE) {
+		node.visible = (uint32_t)cut.visible.size();
+		cut.visible.push_back(n);
+	} else if (!selected && node.visible != SELECT_NO_NODE) {
+		uint32_t last = cut.visible.back();
+		cut.visible[node.visible] = last;
+		cut.nodes[last].visible = node.visible;
+		cut.visible.pop_back();
+		node.visible = SELECT_NO_NODE;
+	}
+}
+
+static uint32_t select_cut_alloc(SelectionCut &cut, TileCode code)
+{
+	uint32_t n;
+	if (!cut.free_nodes.empty()) {
+		n = cut.free_nodes.back();
+		cut.free_nodes.pop_back();
+	} else {
+		n = (uint32_t)cut.nodes.size();
+		cut.nodes.push_back(select_cut_node{.stamp = 0});
+	}
+
+	select_cut_node &node = cut.nodes[n];
+	node.ent = {code, DBL_MAX};
+	node.res = SELECT_CULLED;
+	node.due[SELECT_CLOCK_EYE] = -DBL_MAX;
+	node.due[SELECT_CLOCK_FRUSTUM] = -DBL_MAX;
+	node.visible = SELECT_NO_NODE;
+	node.split = false;
+
+	select_cut_map_insert(cut.map, tile_code_pack(code), n);
+
+	return n;
+}
+
+static void select_cut_free(SelectionCut &cut, uint32_t n)
+{
+	select_cut_node &node = cut.nodes[n];
+	node.split = false;
+	node.res = SELECT_CULLED;
+	select_cut_update_visible(cut, n);
+
+	select_cut_map_erase(cut.map, select_cut_lookup(cut.map, tile_code_pack(node.ent.code)));
+
+	++cut.nodes[n].stamp;
+	cut.free_nodes.push_back(n);
+}
+
+/// @brief Whether any clock has passed the node's due
+static bool select_cut_due(const SelectionCut &cut, const select_cut_node &node)
+{
+	for (int c = 0; c < SELECT_CLOCK_COUNT; ++c) {
+		if (node.due[c] < cut.motion[c])
+			return true;
+	}
+	return false;
+}
+
+static void select_cut_push_due(SelectionCut &cut, uint32_t n)
+{
+	for (int c = 0; c < SELECT_CLOCK_COUNT; ++c) {
+		if (cut.nodes[n].due[c] < DBL_MAX)
+			select_cut_push(cut, cut.dues[c], n, cut.nodes[n].due[c]);
+	}
+}
+
+/// @brief Makes the node due now, for a change the clocks do not cover
+static void select_cut_invalidate(SelectionCut &cut, uint32_t n)
+{
+	cut.nodes[n].due[SELECT_CLOCK_EYE] = -DBL_MAX;
+	select_cut_push(cut, cut.dues[SELECT_CLOCK_EYE], n, -DBL_MAX);
+}
+
+struct select_cut_test_t
+{
+	selection_entry_t ent;
+	select_result_t res;
+	double margin[SELECT_CLOCK_COUNT];
+};
+
+static select_cut_test_t select_cut_test(const select_tiles_params *params, TileCode code)
+{
+	select_cut_test_t test;
+	test.ent = {code, DBL_MAX};
+	test.res = select_tile_test_margin(params, code, &test.ent, test.margin);
+	return test;
+}
+
+/// @brief Stores a new test of the node, and queues it for when the result 
+/// could next change
+static void select_cut_set_test(SelectionCut &cut, uint32_t n, const select_cut_test_t &test)
+{
+	select_cut_node &node = cut.nodes[n];
+	node.ent = test.ent;
+	node.res = test.res;
+	for (int c = 0; c < SELECT_CLOCK_COUNT; ++c)
+		node.due[c] = cut.motion[c] + test.margin[c];
+	++node.stamp;
+	++cut.tests;
+
+	select_cut_push_due(cut, n);
+}
+
+// Tests that are due in the same frame are independent, so once there are 
+// enough of them they are spread over the thread pool in tasks of this many
+static constexpr size_t SELECT_TESTS_PER_TASK = 128;
+
+static void select_cut_test_batch(
+	const select_tiles_params *params, 
+	const select_cut_queued *due, 
+	select_cut_test_t *tests,
+	size_t count)
+{
+	size_t task_count = count/SELECT_TESTS_PER_TASK;
+
+	if (task_count < 2) {
+		for (size_t i = 0; i < count; ++i)
+			tests[i] = select_cut_test(params, tile_code_unpack(due[i].code));
+		return;
+	}
+
+	struct select_test_tasks_t
+	{
+		const select_tiles_params *params;
+		const select_cut_queued *due;
+		select_cut_test_t *tests;
+		size_t count;
+		size_t task_count;
+		std::atomic_size_t next;
+		std::atomic_int ctr;
+		std::atomic_bool done;
+	} tasks = {
+		.params = params,
+		.due = due,
+		.tests = tests,
+		.count = count,
+		.task_count = task_count,
+		.next = 0,
+		.ctr = (int)task_count,
+		.done = false,
+	};
+
+	select_test_tasks_t *p_tasks = &tasks;
+
+	for (size_t i = 0; i < task_count; ++i) {
+		g_schedule_task([p_tasks](){
+			size_t k = p_tasks->next++;
+			size_t begin = k*p_tasks->count/p_tasks->task_count;
+			size_t end = (k + 1)*p_tasks->count/p_tasks->task_count;
+
+			for (size_t i = begin; i < end; ++i) {
+				TileCode code = tile_code_unpack(p_tasks->due[i].code);
+				p_tasks->tests[i] = select_cut_test(p_tasks->params, code);
+			}
+
+			int value = p_tasks->ctr.fetch_sub(1);
+			if (value <= 1) {
+				p_tasks->done.store(true);
+				p_tasks->done.notify_one();
+			}
+		});
+	}
+
+	tasks.done.wait(false);
+}
+
+static void select_cut_queue_split(SelectionCut &cut, uint32_t n)
+{
+	const select_cut_node &node = cut.nodes[n];
+	if (!node.split && node.res == SELECT_REFINE)
+		select_cut_push(cut, cut.splits, n, -select_error(node.ent, node.res));
+}
+
+/// @brief Queues the node as a merge candidate if its children are leaves
+static void select_cut_queue_merge(SelectionCut &cut, uint32_t n)
+{
+	if (n == SELECT_NO_NODE || !cut.nodes[n].split)
+		return;
+
+	for (uint8_t i = 0; i < 4; ++i) {
+		if (cut.nodes[select_cut_child(cut, n, i)].split)
+			return;
+	}
+
+	const select_cut_node &node = cut.nodes[n];
+	select_cut_push(cut, cut.merges, n, select_error(node.ent, node.res));
+}
+
+/// @brief Frees everything below the node, which becomes a leaf
+/// @param due - Set to the earliest due of the children
+static void select_cut_collapse(
+	SelectionCut &cut, 
+	uint32_t n, 
+	frame_vector<uint32_t> &stack,
+	double due[SELECT_CLOCK_COUNT])
+{
+	for (int k = 0; k < SELECT_CLOCK_COUNT; ++k)
+		due[k] = DBL_MAX;
+
+	stack.clear();
+	for (uint8_t i = 0; i < 4; ++i) {
+		uint32_t c = select_cut_child(cut, n, i);
+		for (int k = 0; k < SELECT_CLOCK_COUNT; ++k)
+			due[k] = std::min(due[k], cut.nodes[c].due[k]);
+		stack.push_back(c);
+	}
+
+	while (!stack.empty()) {
+		uint32_t c = stack.back();
+		stack.pop_back();
+
+		if (cut.nodes[c].split) {
+			for (uint8_t i = 0; i < 4; ++i)
+				stack.push_back(select_cut_child(cut, c, i));
+		}
+
+		select_cut_free(cut, c);
+	}
+
+	cut.nodes[n].split = false;
+	select_cut_update_visible(cut, n);
+	++cut.merges_done;
+}
+
+/// @brief Collapses the node, which then waits on its children as well as
+/// itself
+static void select_cut_merge(SelectionCut &cut, uint32_t n, frame_vector<uint32_t> &stack)
+{
+	double due[SELECT_CLOCK_COUNT];
+	select_cut_collapse(cut, n, stack, due);
+
+	select_cut_node &node = cut.nodes[n];
+	for (int c = 0; c < SELECT_CLOCK_COUNT; ++c)
+		node.due[c] = std::min(node.due[c], due[c]);
+	select_cut_push_due(cut, n);
+}
+
+/// @brief Same fallback as select_tiles_rec: once every child of a node is
+/// culled, the node is selected itself
+static void select_cut_fallback(SelectionCut &cut, uint32_t n, frame_vector<uint32_t> &stack)
+{
+	uint32_t p = select_cut_parent(cut, n);
+	if (p == SELECT_NO_NODE)
+		return;
+
+	// Siblings that are due are tested later in the frame, and check again
+	for (uint8_t i = 0; i < 4; ++i) {
+		const select_cut_node &c = cut.nodes[select_cut_child(cut, p, i)];
+		if (c.split || c.res != SELECT_CULLED || select_cut_due(cut, c))
+			return;
+	}
+
+	// Until one of the children could come into view
+	select_cut_merge(cut, p, stack);
+
+	select_cut_queue_merge(cut, select_cut_parent(cut, p));
+}
+
+/// @brief Splits a leaf that needs refinement if any of its children are 
+/// visible and they fit in the budget.  Otherwise it is tested again once
+/// one of the children could change, and waits for room if that is all it
+/// needs.
+static void select_cut_try_split(
+	SelectionCut &cut, 
+	const select_tiles_params *params, 
+	uint32_t n)
+{
+	TileCode code = cut.nodes[n].ent.code;
+
+	select_cut_test_t tests[4];
+	size_t visible = 0;
+
+	for (uint8_t i = 0; i < 4; ++i) {
+		tests[i] = select_cut_test(params, tile_code_refine(code, (tile_quadrant_t)i));
+		visible += tests[i].res != SELECT_CULLED;
+	}
+
+	if (!visible || cut.visible.size() - 1 + visible > params->max_tiles) {
+		select_cut_node &node = cut.nodes[n];
+		for (int c = 0; c < SELECT_CLOCK_COUNT; ++c) {
+			for (uint8_t i = 0; i < 4; ++i)
+				node.due[c] = std::min(node.due[c], cut.motion[c] + tests[i].margin[c]);
+		}
+		cut.tests += 4;
+		select_cut_push_due(cut, n);
+
+		if (visible) {
+			select_cut_push(cut, cut.waiting[visible - 1], n, 
+				   -select_error(node.ent, node.res));
+		}
+		return;
+	}
+
+	cut.nodes[n].split = true;
+	select_cut_update_visible(cut, n);
+
+	for (uint8_t i = 0; i < 4; ++i) {
+		uint32_t c = select_cut_alloc(cut, tests[i].ent.code);
+		select_cut_set_test(cut, c, tests[i]);
+		select_cut_update_visible(cut, c);
+		select_cut_queue_split(cut, c);
+	}
+
+	select_cut_queue_merge(cut, n);
+	++cut.splits_done;
+}
+
+/// @brief Advances the clocks by the change from the last frame to this one.
+/// See select_tile_test_margin.
+static void select_cut_motion(SelectionCut &cut, const select_tiles_params &params)
+{
+	double dn = 0, dd = 0;
+	for (int i = 0; i < 6; ++i) {
+		const plane_t &a = cut.planes[i];
+		const plane_t &b = params.frust.planes[i];
+		dn = std::max(dn, length(b.n - a.n));
+		dd = std::max(dd, fabs(b.d - a.d));
+	}
+
+	cut.motion[SELECT_CLOCK_EYE] += length(params.origin - cut.origin);
+	cut.motion[SELECT_CLOCK_FRUSTUM] += dn + dd;
+}
+
+// @brief Updates the cut kept from the previous frame instead of selecting 
+// from the roots.
+//
+// Each test gives how far the camera and the frustum can move before its 
+// result could change (select_tile_test_margin).  Tiles are only tested 
+// again once the clocks pass that, or when their min/max entry changes, and 
+// anything else is left as it was.  Then:
+// - A node that no longer needs refinement takes the place of its subtree.
+// - A node whose children are all culled becomes a leaf, which matches the
+//   fallback in select_tiles_rec.
+// - If the cut no longer fits in max_tiles, the siblings with the lowest 
+//   screen-space error are merged.
+// - Leaves that need refinement are split, highest error first, while their
+//   visible children still fit.  Those that do not fit wait for room.
+//
+// Once the splits have caught up, the tiles are the ones select_tiles gives
+// when the budget is not reached.  Splits are ordered by the error of each
+// tile's last test rather than the current one, so over the budget the 
+// result only approximates select_tiles_greedy.
+void select_tiles_incremental(
+	select_tiles_params& params,
+	SelectionCut& cut,
+	std::vector<tile_code_t>& tiles
+)
+{
+	params.res = std::max(params.res, 1e-5);
+
+	const select_tiles_params *p_params = &params;
+
+	frame_allocator<uint32_t> alloc (params.arena);
+	frame_vector<uint32_t> stack (alloc);
+
+	cut.tests = 0;
+	cut.splits_done = 0;
+	cut.merges_done = 0;
+
+	if (!cut.map.size) {
+		select_cut_clear(cut);
+
+		for (uint8_t f = 0; f < CUBE_FACES; ++f) {
+			TileCode code = {
+				.face = f,
+				.zoom = 0,
+				.idx = 0
+			};
+
+			uint32_t n = select_cut_alloc(cut, code);
+			select_cut_set_test(cut, n, select_cut_test(p_params, code));
+			select_cut_update_visible(cut, n);
+			select_cut_queue_split(cut, n);
+		}
+	} else {
+		select_cut_motion(cut, params);
+
+		if (cut.res != params.res || 
+			cut.max_mmt_dist != params.max_mmt_dist ||
+			cut.occluder_radius != params.occluder_radius) {
+			for (const select_cut_bucket &b : cut.map.buckets) {
+				if (b.dist)
+					select_cut_invalidate(cut, b.node);
+			}
+		}
+	}
+
+	cut.origin = params.origin;
+	for (int i = 0; i < 6; ++i)
+		cut.planes[i] = params.frust.planes[i];
+
+	cut.res = params.res;
+	cut.max_mmt_dist = params.max_mmt_dist;
+	cut.occluder_radius = params.occluder_radius;
+
+	// A new min/max entry changes the tiles at and below it that have none
+	// of their own
+	for (size_t i = 0; i < params.mmt_change_count; ++i) {
+		uint32_t top = select_cut_find(cut, params.mmt_changes[i]);
+		if (top == SELECT_NO_NODE)
+			continue;
+
+		stack.clear();
+		stack.push_back(top);
+
+		while (!stack.empty()) {
+			uint32_t n = stack.back();
+			stack.pop_back();
+
+			tile_code_t code = tile_code_pack(cut.nodes[n].ent.code);
+			if (n != top && mmt_contains(params.mmt, code))
+				continue;
+
+			select_cut_invalidate(cut, n);
+
+			// Entries at zoom 0 are only used by the root itself
+			if (cut.nodes[n].split && cut.nodes[top].ent.code.zoom) {
+				for (uint8_t q = 0; q < 4; ++q)
+					stack.push_back(select_cut_child(cut, n, q));
+			}
+		}
+	}
+
+	//-----------------------------------------------------------------------------
+	// Test again what could have changed
+
+	frame_vector<select_cut_queued> due (frame_allocator<select_cut_queued>(params.arena));
+
+	for (int c = 0; c < SELECT_CLOCK_COUNT; ++c) {
+		std::vector<select_cut_queued> &heap = cut.dues[c];
+
+		while (!heap.empty() && heap.front().key < cut.motion[c]) {
+			select_cut_queued q = select_cut_pop(heap);
+			if (select_cut_current(cut, q))
+				due.push_back(q);
+		}
+	}
+
+	// Parents first, so that a subtree that is merged is not tested
+	std::sort(due.begin(), due.end(), [](const select_cut_queued &a, const select_cut_queued &b) {
+		uint8_t za = tile_code_zoom(a.code), zb = tile_code_zoom(b.code);
+		return za != zb ? za < zb : a.code < b.code;
+	});
+
+	// A node queued more than once for the same test
+	due.erase(std::unique(due.begin(), due.end(), [](const select_cut_queued &a, const select_cut_queued &b) {
+		return a.node == b.node && a.stamp == b.stamp;
+	}), due.end());
+
+	frame_vector<select_cut_test_t> tests (due.size(), frame_allocator<select_cut_test_t>(params.arena));
+	select_cut_test_batch(p_params, due.data(), tests.data(), due.size());
+
+	for (size_t i = 0; i < due.size(); ++i) {
+		const select_cut_queued &q = due[i];
+
+		// Freed by a merge above it, or already tested
+		if (!select_cut_current(cut, q))
+			continue;
+
+		uint32_t n = q.node;
+		select_cut_set_test(cut, n, tests[i]);
+
+		if (cut.nodes[n].split) {
+			if (cut.nodes[n].res == SELECT_REFINE) {
+				// Its error changed
+				select_cut_queue_merge(cut, n);
+				continue;
+			}
+
+			double unused[SELECT_CLOCK_COUNT];
+			select_cut_collapse(cut, n, stack, unused);
+			select_cut_queue_merge(cut, select_cut_parent(cut, n));
+		}
+
+		select_cut_update_visible(cut, n);
+
+		if (cut.nodes[n].res == SELECT_CULLED)
+			select_cut_fallback(cut, n, stack);
+		else
+			select_cut_queue_split(cut, n);
+	}
+
+	//-----------------------------------------------------------------------------
+	// Merge
+
+	// Tiles that were culled may have come into view.  Merge the siblings
+	// with the lowest error until the cut fits in max_tiles again.
+	while (cut.visible.size() > params.max_tiles && !cut.merges.empty()) {
+		select_cut_queued q = select_cut_pop(cut.merges);
+		uint32_t n = q.node;
+
+		if (!select_cut_current(cut, q) || !cut.nodes[n].split)
+			continue;
+
+		size_t visible = 0;
+		bool leaves = true;
+		for (uint8_t i = 0; i < 4; ++i) {
+			const select_cut_node &c = cut.nodes[select_cut_child(cut, n, i)];
+			leaves &= !c.split;
+			visible += c.res != SELECT_CULLED;
+		}
+
+		if (!leaves)
+			continue;
+
+		// Waits for room to split again, or for the children to change
+		select_cut_merge(cut, n, stack);
+		const select_cut_node &node = cut.nodes[n];
+		select_cut_push(cut, cut.waiting[visible - 1], n, -select_error(node.ent, node.res));
+
+		select_cut_queue_merge(cut, select_cut_parent(cut, n));
+	}
+
+	//-----------------------------------------------------------------------------
+	// Split
+
+	size_t max_splits = params.max_tiles > SIZE_MAX/SELECT_MAX_SPLITS_PER_TILE ? 
+		SIZE_MAX : SELECT_MAX_SPLITS_PER_TILE*params.max_tiles;
+
+	auto splittable = [&](std::vector<select_cut_queued> &heap) {
+		while (!heap.empty()) {
+			const select_cut_queued &q = heap.front();
+			const select_cut_node &node = cut.nodes[q.node];
+
+			if (select_cut_current(cut, q) && !node.split && node.res == SELECT_REFINE)
+				return true;
+
+			select_cut_pop(heap);
+		}
+		return false;
+	};
+
+	for (size_t attempts = 0; attempts < max_splits; ++attempts) {
+		size_t count = cut.visible.size();
+		size_t room = params.max_tiles > count ? params.max_tiles - count : 0;
+
+		// Largest error among the new candidates, and those waiting for no 
+		// more room than there is
+		std::vector<select_cut_queued> *best = nullptr;
+
+		if (splittable(cut.splits))
+			best = &cut.splits;
+
+		for (size_t k = 0; k < 4 && k <= room; ++k) {
+			if (splittable(cut.waiting[k]) && (!best || 
+				select_cut_queued_after(best->front(), cut.waiting[k].front())))
+				best = &cut.waiting[k];
+		}
+
+		if (!best)
+			break;
+
+		select_cut_try_split(cut, p_params, select_cut_pop(*best).node);
+	}
+
+	for (std::vector<select_cut_queued> &d : cut.dues)
+		select_cut_compact(cut, d);
+	select_cut_compact(cut, cut.splits);
+	for (std::vector<select_cut_queued> &w : cut.waiting)
+		select_cut_compact(cut, w);
+	select_cut_compact(cut, cut.merges);
+
+	frame_vector<selection_entry_t> selection (frame_allocator<selection_entry_t>(params.arena));
+	selection.reserve(cut.visible.size());
+
+	for (uint32_t n : cut.visible)
+		selection.push_back(cut.nodes[n].ent);
+
+	select_tiles_finish(params, selection, tiles);
+}
+
+// Rough test against a bounding sphere of the tile, which is much cheaper 
+// than the box.  Refined tiles that would be culled are dropped.
+static select_result_t select_tile_estimate(
+	const select_tiles_params *params,
+	TileCode code,
+	selection_entry_t *p_ent)
+{
+	mmt_result_t mmt_res = mmt_minmax(params->mmt, tile_code_pack(code));
+
+	aabb2_t rect = morton_u64_to_rect_f64(code.idx, code.zoom);
+	glm::dvec3 ll = cube_to_globe(code.face, rect.ll());
+	glm::dvec3 ur = cube_to_globe(code.face, rect.ur());
+	glm::dvec3 mid = cube_to_globe(code.face, 0.5*(rect.ll() + rect.ur()));
+
+	double h_mid = 0.5*((double)mmt_res.min + (double)mmt_res.max);
+	mid *= 1.0 + h_mid;
+
+	double radius = 0.5*length(ur - ll)*(1.0 + (double)mmt_res.max) + 
+		0.5*((double)mmt_res.max - (double)mmt_res.min);
+
+	for (uint8_t i = 0; i < 6; ++i) {
+		const plane_t &pl = params->frust.planes[i];
+		if (dot(pl.n, mid) - pl.d > radius)
+			return SELECT_CULLED;
+	}
+
+	// Across the tile at the height of the camera, and above or below it
+	double r_eye = length(params->origin);
+	double h = std::max(length(normalize(mid)*r_eye - params->origin) - 
+		0.5*length(ur - ll)*r_eye, 0.0);
+	double v = std::max({r_eye - 1.0 - (double)mmt_res.max, 1.0 + (double)mmt_res.min - r_eye, 0.0});
+
+	return select_tile_resolve(params, code, mmt_res.dist, h*h + v*v, p_ent);
+}
+
+// The selected leaves of the cut are refined further where the other 
+// camera would need it.  Tiles are only estimated rather than tested, and 
+// nothing is merged, since coarser tiles are already loaded.
+void select_tiles_predict(
+	const select_tiles_params& params,
+	const SelectionCut& cut,
+	std::vector<tile_code_t>& tiles
+)
+{
+	const select_tiles_params *p_params = &params;
+
+	frame_vector<TileCode> stack (frame_allocator<TileCode>(params.arena));
+	frame_vector<selection_entry_t> selection (frame_allocator<selection_entry_t>(params.arena));
+
+	for (uint32_t n : cut.visible) {
+		const select_cut_node &node = cut.nodes[n];
+
+		// The leaf itself is already selected
+		selection_entry_t ent;
+		if (node.res != SELECT_REFINE && 
+			select_tile_estimate(p_params, node.ent.code, &ent) != SELECT_REFINE)
+			continue;
+
+		stack.clear();
+		for (uint8_t k = 0; k < 4; ++k)
+			stack.push_back(tile_code_refine(node.ent.code, (tile_quadrant_t)k));
+
+		while (!stack.empty() && selection.size() < params.max_tiles) {
+			TileCode code = stack.back();
+			stack.pop_back();
+
+			selection_entry_t ent;
+			select_result_t res = select_tile_estimate(p_params, code, &ent);
+
+			if (res == SELECT_REFINE && code.zoom < 23) {
+				for (uint8_t k = 0; k < 4; ++k)
+					stack.push_back(tile_code_refine(code, (tile_quadrant_t)k));
+			} else if (res != SELECT_CULLED) {
+				selection.push_back(ent);
+			}
+		}
+	}
+
+	select_tiles_finish(params, selection, tiles);
+}
+
+void select_tiles_recursive(
+	select_tiles_params& params,
+	std::vector<tile_code_t>& tiles
+)
+{
+	params.res = std::max(params.res, 1e-5);
+
+	frame_vector<selection_entry_t> selection (params.arena);
+
+	for (uint8_t f = 0; f < CUBE_FACES; ++f) {
+		TileCode code = {
+			.face = f,
+			.zoom = 0,
+			.idx = 0
+		};
+		select_tiles_rec(selection, &params, code);
+	}
+
+	select_tiles_finish(params, selection, tiles);
+}
+
+void select_tiles_serial(
+	select_tiles_params& params,
+	std::vector<tile_code_t>& tiles
+)
+{
+	params.res = std::max(params.res, 1e-5);
+
+	frame_allocator<selection_entry_t> alloc (params.arena);
+
+	// One tree per face, continuing the six roots
+	select_tree_t top (alloc);
+	frame_vector<select_tree_t> subtrees (alloc);
+	subtrees.reserve(CUBE_FACES);
+
+	for (uint8_t f = 0; f < CUBE_FACES; ++f) {
+		TileCode code = {
+			.face = f,
+			.zoom = 0,
+			.idx = 0
+		};
+		top.push_back(select_tree_node(code));
+		top.back().subtree = f;
+
+		subtrees.emplace_back(alloc);
+		select_tree_bfs(subtrees.back(), &params, code);
+
+		top.back().ent = subtrees.back()[0].ent;
+		top.back().res = subtrees.back()[0].res;
+	}
+
+	frame_vector<selection_entry_t> selection (alloc);
+
+	for (select_tree_t &tree : subtrees)
+		select_tree_resolve(tree, nullptr, selection);
+
+	if (selection.size() > params.max_tiles) {
+		selection.clear();
+		select_trees_greedy(params, top, subtrees.data(), selection);
+	}
+
+	select_tiles_finish(params, selection, tiles);
+}
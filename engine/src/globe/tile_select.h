@@ -0,0 +1,210 @@
+#ifndef TILE_SELECT_H
+#define TILE_SELECT_H
+
+#include <ev2/globe/tiling.h>
+#include <ev2/utils/geometry.h>
+
+#include "minmax_tree.h"
+#include "utils/frame_arena.h"
+
+#include <vector>
+
+struct BoxDebugView;
+
+struct selection_entry_t
+{
+	TileCode code;
+	double dist;
+};
+
+enum select_result_t
+{
+	SELECT_CULLED,
+	SELECT_LEAF,
+	SELECT_REFINE
+};
+
+struct select_cut_bucket
+{
+	tile_code_t key;
+	uint32_t node;
+	// Distance from the home bucket plus one, or zero if the bucket is empty
+	uint32_t dist;
+};
+
+// @brief Robin hood hash map from tile codes to nodes of the cut.  Grows by 
+// doubling and keeps its buckets when emptied, so a cut that has stopped 
+// growing does not allocate.
+struct select_cut_map
+{
+	std::vector<select_cut_bucket> buckets;
+	size_t size;
+};
+
+// @brief What the tests of the incremental selector depend on.  Each one 
+// accumulates a bound on how far those tests have moved.
+enum select_clock_t
+{
+	// Distance moved by the camera, for the horizon and distance tests
+	SELECT_CLOCK_EYE,
+	// Change in the frustum planes
+	SELECT_CLOCK_FRUSTUM,
+	SELECT_CLOCK_COUNT
+};
+
+struct select_cut_node
+{
+	// Result of the last test
+	selection_entry_t ent;
+	select_result_t res;
+	// Reading of each clock at which the last test could first give another
+	// result, or sooner if a split waits on the children
+	double due[SELECT_CLOCK_COUNT];
+	// Changed whenever the node is tested or freed, so that queued entries 
+	// for an older state are skipped
+	uint32_t stamp;
+	// Position in SelectionCut::visible, if selected
+	uint32_t visible;
+	// Whether the four children are in the cut
+	bool split;
+};
+
+// Queued node of the cut, ordered by key
+struct select_cut_queued
+{
+	double key;
+	tile_code_t code;
+	uint32_t node;
+	uint32_t stamp;
+};
+
+// @brief Quadtree kept between frames by the incremental selector.  It 
+// always covers all six faces.  Its leaves are the selection, except culled
+// ones, which are kept so that they are not tested again.
+//
+// A test is only repeated once the camera has moved far enough that its
+// result could have changed, or when the min/max entry of the tile has.
+struct SelectionCut
+{
+	select_cut_map map;
+	// Nodes the map points to, and the ones free for reuse
+	std::vector<select_cut_node> nodes;
+	std::vector<uint32_t> free_nodes;
+
+	// Selected leaves
+	std::vector<uint32_t> visible;
+
+	// Heaps of nodes to test again, by due on each clock
+	std::vector<select_cut_queued> dues[SELECT_CLOCK_COUNT];
+	// Leaves to split, by screen-space error.  Those whose visible children
+	// did not fit wait in waiting[n - 1] until n - 1 more tiles fit.
+	std::vector<select_cut_queued> splits;
+	std::vector<select_cut_queued> waiting[4];
+	// Nodes whose children are all leaves, by screen-space error
+	std::vector<select_cut_queued> merges;
+
+	// Clocks, and the camera they were last advanced to
+	double motion[SELECT_CLOCK_COUNT];
+	glm::dvec3 origin;
+	plane_t planes[6];
+
+	// Parameters every test depends on.  The cut is tested again if they
+	// change.
+	double res;
+	int max_mmt_dist;
+	double occluder_radius;
+
+	// Work done by the last update
+	size_t tests;
+	size_t splits_done;
+	size_t merges_done;
+};
+
+// @brief Empties the cut, so that the next incremental selection starts 
+// from the roots.  Keeps its memory.
+extern void select_cut_clear(SelectionCut& cut);
+
+struct select_tiles_params
+{
+	const mmt_tree *mmt;
+	// Selected tile bounds are added here if not null
+	BoxDebugView *boxes;
+
+	size_t max_tiles;
+	// Tiles are not refined past this many levels below their nearest
+	// min/max entry
+	int max_mmt_dist;
+	double cull_radius;
+	// Radius of a sphere that no terrain goes below.  Tiles hidden behind it
+	// are culled.
+	double occluder_radius;
+	frustum_t frust;
+	aabb3_t frust_box;
+	glm::dvec3 origin;
+	double res;
+
+	// Optional.  Temporaries are allocated here instead of on the heap.
+	frame_arena *arena;
+
+	// Keys of min/max entries inserted or changed since the last incremental
+	// selection, whose tiles it has to test again
+	const uint64_t *mmt_changes;
+	size_t mmt_change_count;
+};
+
+extern obb_t tile_obb(TileCode code, double min, double max);
+
+/// @brief Largest occluder_radius the loaded min/max values allow
+extern double tile_occluder_radius(const mmt_tree *mmt);
+
+// @brief Select tiles within camera frustum based on loaded terrain
+// @note The resulting tiles are sorted by distance from the camera.  At most
+// max_tiles are selected, and they always cover the visible surface.
+extern void select_tiles(
+	select_tiles_params& params,
+	std::vector<tile_code_t>& tiles
+);
+
+// @brief Updates the cut kept from the previous frame instead of selecting
+// from the roots.  Only tiles whose tests could have changed are tested 
+// again, so a frame costs about as much as what changed in it.  Under the
+// budget, the tiles are those select_tiles gives.
+extern void select_tiles_incremental(
+	select_tiles_params& params,
+	SelectionCut& cut,
+	std::vector<tile_code_t>& tiles
+);
+
+// @brief Tiles finer than the cut's that the camera in params would need,
+// such as a camera predicted a few frames ahead, so that they can be loaded
+// before they are needed.  Cheap enough to run every frame: tiles are only
+// estimated from their bounding spheres, below the tiles the cut selects.
+// @note At most max_tiles are given, nearest first.
+extern void select_tiles_predict(
+	const select_tiles_params& params,
+	const SelectionCut& cut,
+	std::vector<tile_code_t>& tiles
+);
+
+// @brief Refines the tiles with the largest screen-space error first, until
+// the budget is spent.  select_tiles gives the same tiles when it goes over
+// max_tiles, from the tree it already explored.
+extern void select_tiles_greedy(
+	select_tiles_params& params,
+	std::vector<tile_code_t>& tiles
+);
+
+// @brief Single-threaded version of select_tiles
+extern void select_tiles_serial(
+	select_tiles_params& params,
+	std::vector<tile_code_t>& tiles
+);
+
+// @brief Single-threaded depth-first selection, one tile at a time.  Only
+// kept as a reference for select_tiles.
+extern void select_tiles_recursive(
+	select_tiles_params& params,
+	std::vector<tile_code_t>& tiles
+);
+
+#endif // TILE_SELECT_H
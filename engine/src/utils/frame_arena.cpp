@@ -0,0 +1,96 @@
+#include "utils/frame_arena.h"
+#include "utils/common.h"
+
+#include <cstdlib>
+#include <algorithm>
+#include <new>
+
+// Heap blocks start with this, and the allocation follows at max_align_t, or
+// as far past it as a larger alignment needs
+struct frame_overflow
+{
+	alignas(std::max_align_t) void *next;
+};
+
+void frame_arena_init(frame_arena *arena, size_t capacity)
+{
+	arena->base = capacity ? static_cast<uint8_t*>(malloc(capacity)) : nullptr;
+	arena->capacity = arena->base ? capacity : 0;
+	arena->used = 0;
+	arena->high_water = 0;
+	arena->overflow = nullptr;
+	arena->heap_allocs = arena->base ? 1 : 0;
+}
+
+static void frame_arena_free_overflow(frame_arena *arena)
+{
+	for (void *block = arena->overflow; block;) {
+		void *next = static_cast<frame_overflow*>(block)->next;
+		free(block);
+		block = next;
+	}
+	arena->overflow = nullptr;
+}
+
+void frame_arena_destroy(frame_arena *arena)
+{
+	frame_arena_free_overflow(arena);
+	free(arena->base);
+	arena->base = nullptr;
+	arena->capacity = 0;
+}
+
+void frame_arena_reset(frame_arena *arena)
+{
+	arena->high_water = std::max(arena->high_water, arena->used.load());
+
+	frame_arena_free_overflow(arena);
+
+	if (arena->high_water > arena->capacity) {
+		// Some slack, so that a frame slightly larger than the last one does
+		// not go to the heap again
+		size_t capacity = align_up_pow2(arena->high_water + arena->high_water/4, 4096);
+
+		free(arena->base);
+		arena->base = static_cast<uint8_t*>(malloc(capacity));
+		arena->capacity = arena->base ? capacity : 0;
+		++arena->heap_allocs;
+	}
+
+	arena->used = 0;
+}
+
+void *frame_arena_alloc(frame_arena *arena, size_t size, size_t align)
+{
+	// The base is only aligned for max_align_t, so the address is aligned 
+	// rather than the offset
+	uintptr_t base = reinterpret_cast<uintptr_t>(arena->base);
+
+	size_t cur = arena->used.load(std::memory_order_relaxed);
+	size_t start, end;
+	do {
+		start = align_up_pow2(base + cur, align) - base;
+		end = start + size;
+	} while (!arena->used.compare_exchange_weak(cur, end, std::memory_order_relaxed));
+
+	if (end <= arena->capacity)
+		return arena->base + start;
+
+	// Still counted in used, so the next reset makes room for it
+	size_t header = sizeof(frame_overflow);
+	size_t pad = align > alignof(std::max_align_t) ? align - alignof(std::max_align_t) : 0;
+	void *block = malloc(header + pad + size);
+	if (!block)
+		throw std::bad_alloc();
+
+	++arena->heap_allocs;
+
+	{
+		std::lock_guard<std::mutex> lock(arena->overflow_mut);
+		static_cast<frame_overflow*>(block)->next = arena->overflow;
+		arena->overflow = block;
+	}
+
+	uintptr_t data = reinterpret_cast<uintptr_t>(block) + header;
+	return reinterpret_cast<void*>(align_up_pow2(data, align));
+}
@@ -0,0 +1,104 @@
+#ifndef EV2_FRAME_ARENA_H
+#define EV2_FRAME_ARENA_H
+
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <new>
+
+#include <cstddef>
+#include <cstdint>
+
+// @brief Linear allocator for memory that only lives until the end of a
+// frame.  Allocation is a single atomic add, so worker threads can share it,
+// and nothing is freed until frame_arena_reset.
+//
+// What does not fit is taken from the heap, and the next reset grows the
+// arena to the most a frame has used, so once the frames stop growing the
+// arena stops calling malloc.
+struct frame_arena
+{
+	uint8_t *base;
+	size_t capacity;
+	std::atomic_size_t used;
+
+	// Most used in any frame, including what went to the heap
+	size_t high_water;
+
+	std::mutex overflow_mut;
+	// Heap blocks taken this frame, linked through their first bytes
+	void *overflow;
+
+	// Calls to malloc made by the arena since it was created, including for
+	// its own growth
+	std::atomic_size_t heap_allocs;
+};
+
+extern void frame_arena_init(frame_arena *arena, size_t capacity);
+extern void frame_arena_destroy(frame_arena *arena);
+
+// @brief Frees everything allocated since the last reset.  Containers using
+// the arena must not outlive this.
+extern void frame_arena_reset(frame_arena *arena);
+
+extern void *frame_arena_alloc(frame_arena *arena, size_t size, size_t align);
+
+// @brief Standard allocator over a frame_arena.  Without an arena it uses
+// the heap, so that containers can be shared with code that runs outside of
+// a frame.
+template<typename T>
+struct frame_allocator
+{
+	typedef T value_type;
+
+	frame_arena *arena;
+
+	frame_allocator() : arena(nullptr) {}
+	frame_allocator(frame_arena *arena) : arena(arena) {}
+
+	template<typename U>
+	frame_allocator(const frame_allocator<U> &other) : arena(other.arena) {}
+
+	// Types aligned past what plain new gives need the aligned overloads
+	static constexpr bool over_aligned = 
+		alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+	T *allocate(size_t n) {
+		if (arena)
+			return static_cast<T*>(frame_arena_alloc(arena, n*sizeof(T), alignof(T)));
+		if constexpr (over_aligned)
+			return static_cast<T*>(::operator new(n*sizeof(T), std::align_val_t(alignof(T))));
+		else
+			return static_cast<T*>(::operator new(n*sizeof(T)));
+	}
+
+	void deallocate(T *p, size_t n) {
+		if (arena)
+			return;
+		if constexpr (over_aligned)
+			::operator delete(p, std::align_val_t(alignof(T)));
+		else
+			::operator delete(p);
+	}
+
+	template<typename U>
+	bool operator==(const frame_allocator<U> &other) const {
+		return arena == other.arena;
+	}
+};
+
+template<typename T>
+using frame_vector = std::vector<T, frame_allocator<T>>;
+
+template<typename K, typename V>
+using frame_unordered_map = std::unordered_map<K, V, std::hash<K>, std::equal_to<K>,
+	frame_allocator<std::pair<const K, V>>>;
+
+template<typename K>
+using frame_unordered_set = std::unordered_set<K, std::hash<K>, std::equal_to<K>,
+	frame_allocator<K>>;
+
+#endif // EV2_FRAME_ARENA_H
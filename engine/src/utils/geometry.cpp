@@ -4,6 +4,9 @@
 #include <complex>
 
 #include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <cassert>
 
 void geometry::mesh_s2(uint32_t ntht, uint32_t nphi, 
 					   std::vector<vertex3d>& verts, 
@@ -123,6 +126,281 @@ extern bool intersects(const obb_t &A, const aabb3_t &B)
 	return obb_aabb_intersects_origin(sB, A.T, A.S, O);
 }
 
+//------------------------------------------------------------------------------
+// OBB batches
+
+void obb_batch_pack(obb_batch_t &batch, const obb_t *boxes, size_t count)
+{
+	assert(count > 0 && count <= OBB_BATCH_WIDTH);
+
+	for (size_t i = 0; i < OBB_BATCH_WIDTH; ++i) {
+		const obb_t &box = boxes[std::min(i, count - 1)];
+
+		for (int j = 0; j < 3; ++j) {
+			for (int k = 0; k < 3; ++k) 
+				batch.T[j][k][i] = box.T[j][k];
+
+			batch.O[j][i] = box.O[j];
+			batch.S[j][i] = box.S[j];
+		}
+	}
+}
+
+uint32_t obb_batch_cull(const obb_batch_t &batch, 
+						const plane_t *planes, size_t plane_count)
+{
+	uint32_t mask = 0;
+
+#ifdef __AVX2__
+	static_assert(OBB_BATCH_WIDTH == 4);
+
+	const __m256d sign = _mm256_set1_pd(-0.0);
+
+	__m256d T[3][3], O[3], S[3];
+	for (int j = 0; j < 3; ++j) {
+		for (int k = 0; k < 3; ++k)
+			T[j][k] = _mm256_loadu_pd(batch.T[j][k]);
+		O[j] = _mm256_loadu_pd(batch.O[j]);
+		S[j] = _mm256_loadu_pd(batch.S[j]);
+	}
+
+	for (size_t p = 0; p < plane_count; ++p) {
+		__m256d n[3] = {
+			_mm256_set1_pd(planes[p].n.x),
+			_mm256_set1_pd(planes[p].n.y),
+			_mm256_set1_pd(planes[p].n.z),
+		};
+
+		// Projected radius of the box onto the plane normal
+		__m256d r = _mm256_setzero_pd();
+		for (int j = 0; j < 3; ++j) {
+			__m256d nj = _mm256_add_pd(_mm256_add_pd(
+				_mm256_mul_pd(n[0], T[j][0]),
+				_mm256_mul_pd(n[1], T[j][1])),
+				_mm256_mul_pd(n[2], T[j][2]));
+			r = _mm256_add_pd(r, _mm256_andnot_pd(sign, _mm256_mul_pd(S[j], nj)));
+		}
+
+		__m256d s = _mm256_add_pd(_mm256_add_pd(
+			_mm256_mul_pd(n[0], O[0]),
+			_mm256_mul_pd(n[1], O[1])),
+			_mm256_mul_pd(n[2], O[2]));
+		s = _mm256_sub_pd(s, _mm256_set1_pd(planes[p].d));
+
+		mask |= (uint32_t)_mm256_movemask_pd(_mm256_cmp_pd(s, r, _CMP_GT_OQ));
+	}
+#else
+	for (size_t i = 0; i < OBB_BATCH_WIDTH; ++i) {
+		for (size_t p = 0; p < plane_count; ++p) {
+			const plane_t &pl = planes[p];
+
+			double r = 0;
+			for (int j = 0; j < 3; ++j) {
+				double nj = pl.n.x*batch.T[j][0][i] + pl.n.y*batch.T[j][1][i] + 
+					pl.n.z*batch.T[j][2][i];
+				r += fabs(batch.S[j][i]*nj);
+			}
+
+			double s = pl.n.x*batch.O[0][i] + pl.n.y*batch.O[1][i] + 
+				pl.n.z*batch.O[2][i] - pl.d;
+
+			if (s > r) {
+				mask |= 1u << i;
+				break;
+			}
+		}
+	}
+#endif
+
+	return mask;
+}
+
+void obb_batch_dist_sq(const obb_batch_t &batch, glm::dvec3 v, double *out)
+{
+#ifdef __AVX2__
+	const __m256d sign = _mm256_set1_pd(-0.0);
+
+	__m256d w[3];
+	for (int k = 0; k < 3; ++k)
+		w[k] = _mm256_sub_pd(_mm256_set1_pd(v[k]), _mm256_loadu_pd(batch.O[k]));
+
+	__m256d d = _mm256_setzero_pd();
+	for (int j = 0; j < 3; ++j) {
+		__m256d l = _mm256_add_pd(_mm256_add_pd(
+			_mm256_mul_pd(w[0], _mm256_loadu_pd(batch.T[j][0])),
+			_mm256_mul_pd(w[1], _mm256_loadu_pd(batch.T[j][1]))),
+			_mm256_mul_pd(w[2], _mm256_loadu_pd(batch.T[j][2])));
+
+		l = _mm256_sub_pd(_mm256_andnot_pd(sign, l), 
+					_mm256_andnot_pd(sign, _mm256_loadu_pd(batch.S[j])));
+		l = _mm256_max_pd(l, _mm256_setzero_pd());
+
+		d = _mm256_add_pd(d, _mm256_mul_pd(l, l));
+	}
+
+	_mm256_storeu_pd(out, d);
+#else
+	for (size_t i = 0; i < OBB_BATCH_WIDTH; ++i) {
+		double w[3] = {
+			v.x - batch.O[0][i], 
+			v.y - batch.O[1][i], 
+			v.z - batch.O[2][i]
+		};
+
+		double d = 0;
+		for (int j = 0; j < 3; ++j) {
+			double l = w[0]*batch.T[j][0][i] + w[1]*batch.T[j][1][i] + 
+				w[2]*batch.T[j][2][i];
+			l = fabs(l) - fabs(batch.S[j][i]);
+			if (l > 0)
+				d += l*l;
+		}
+		out[i] = d;
+	}
+#endif
+}
+
+//------------------------------------------------------------------------------
+// Morton codes
+
+static_assert(sizeof(aabb2_t) == 4*sizeof(double));
+
+#ifdef __AVX2__
+/// @brief Spreads the lower 32 bits of each lane to the even bits
+static inline __m256i morton_spread_epi64(__m256i v)
+{
+	v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi64(v, 16)), 
+					  _mm256_set1_epi64x(0x0000FFFF0000FFFF));
+	v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi64(v, 8)), 
+					  _mm256_set1_epi64x(0x00FF00FF00FF00FF));
+	v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi64(v, 4)), 
+					  _mm256_set1_epi64x(0x0F0F0F0F0F0F0F0F));
+	v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi64(v, 2)), 
+					  _mm256_set1_epi64x(0x3333333333333333));
+	v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi64(v, 1)), 
+					  _mm256_set1_epi64x(0x5555555555555555));
+	return v;
+}
+
+/// @brief Inverse of morton_spread_epi64; gathers the even bits of each lane
+static inline __m256i morton_compact_epi64(__m256i v)
+{
+	v = _mm256_and_si256(v, _mm256_set1_epi64x(0x5555555555555555));
+	v = _mm256_and_si256(_mm256_or_si256(v, _mm256_srli_epi64(v, 1)), 
+					  _mm256_set1_epi64x(0x3333333333333333));
+	v = _mm256_and_si256(_mm256_or_si256(v, _mm256_srli_epi64(v, 2)), 
+					  _mm256_set1_epi64x(0x0F0F0F0F0F0F0F0F));
+	v = _mm256_and_si256(_mm256_or_si256(v, _mm256_srli_epi64(v, 4)), 
+					  _mm256_set1_epi64x(0x00FF00FF00FF00FF));
+	v = _mm256_and_si256(_mm256_or_si256(v, _mm256_srli_epi64(v, 8)), 
+					  _mm256_set1_epi64x(0x0000FFFF0000FFFF));
+	v = _mm256_and_si256(_mm256_or_si256(v, _mm256_srli_epi64(v, 16)), 
+					  _mm256_set1_epi64x(0x00000000FFFFFFFF));
+	return v;
+}
+
+/// @brief Converts four 64 bit lanes holding values < 2^31 to doubles
+static inline __m256d morton_cvt_epi64_pd(__m256i v)
+{
+	const __m256i perm = _mm256_setr_epi32(0, 2, 4, 6, 0, 0, 0, 0);
+	__m128i lo = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(v, perm));
+	return _mm256_cvtepi32_pd(lo);
+}
+#endif
+
+void morton_u64_batch(const double *x, const double *y, size_t count, 
+					  int level, uint64_t *out)
+{
+	assert(level <= 28);
+
+	size_t i = 0;
+
+#ifdef __AVX2__
+	const __m256d w = _mm256_set1_pd((double)(0x1 << level));
+	const __m128i mask = _mm_set1_epi32((0x1 << level) - 1);
+
+	for (; i + 4 <= count; i += 4) {
+		__m128i ix = _mm256_cvttpd_epi32(_mm256_mul_pd(_mm256_loadu_pd(x + i), w));
+		__m128i iy = _mm256_cvttpd_epi32(_mm256_mul_pd(_mm256_loadu_pd(y + i), w));
+
+		__m256i px = _mm256_cvtepu32_epi64(_mm_and_si128(ix, mask));
+		__m256i py = _mm256_cvtepu32_epi64(_mm_and_si128(iy, mask));
+
+		__m256i code = _mm256_or_si256(
+			morton_spread_epi64(px), 
+			_mm256_slli_epi64(morton_spread_epi64(py), 1)
+		);
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), code);
+	}
+#endif
+
+	for (; i < count; ++i) {
+		out[i] = morton_u64(x[i], y[i], level);
+	}
+}
+
+void morton_u64_to_rect_f64_batch(const uint64_t *index, const uint8_t *level, 
+								  size_t count, aabb2_t *out)
+{
+#ifndef NDEBUG
+	for (size_t k = 0; k < count; ++k)
+		assert(level[k] <= 28);
+#endif
+
+	size_t i = 0;
+
+#ifdef __AVX2__
+	const __m256i one = _mm256_set1_epi64x(1);
+	const __m256i bias = _mm256_set1_epi64x(1023);
+
+	for (; i + 4 <= count; i += 4) {
+		int32_t lvl_bytes;
+		memcpy(&lvl_bytes, level + i, sizeof(lvl_bytes));
+
+		__m256i lvl = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(lvl_bytes));
+		__m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(index + i));
+
+		// keep only the 2*level bits that belong to the code
+		__m256i mask = _mm256_sub_epi64(
+			_mm256_sllv_epi64(one, _mm256_add_epi64(lvl, lvl)), one);
+		idx = _mm256_and_si256(idx, mask);
+
+		__m256d px = morton_cvt_epi64_pd(morton_compact_epi64(idx));
+		__m256d py = morton_cvt_epi64_pd(morton_compact_epi64(_mm256_srli_epi64(idx, 1)));
+
+		// h = 2^-level, built directly from the exponent bits
+		__m256d h = _mm256_castsi256_pd(
+			_mm256_slli_epi64(_mm256_sub_epi64(bias, lvl), 52));
+
+		__m256d min_x = _mm256_mul_pd(px, h);
+		__m256d min_y = _mm256_mul_pd(py, h);
+		__m256d max_x = _mm256_add_pd(min_x, h);
+		__m256d max_y = _mm256_add_pd(min_y, h);
+
+		// transpose to {min.x, min.y, max.x, max.y} per rect
+		__m256d t0 = _mm256_unpacklo_pd(min_x, min_y);
+		__m256d t1 = _mm256_unpackhi_pd(min_x, min_y);
+		__m256d t2 = _mm256_unpacklo_pd(max_x, max_y);
+		__m256d t3 = _mm256_unpackhi_pd(max_x, max_y);
+
+		double *dst = reinterpret_cast<double*>(out + i);
+
+		_mm256_storeu_pd(dst + 0,  _mm256_permute2f128_pd(t0, t2, 0x20));
+		_mm256_storeu_pd(dst + 4,  _mm256_permute2f128_pd(t1, t3, 0x20));
+		_mm256_storeu_pd(dst + 8,  _mm256_permute2f128_pd(t0, t2, 0x31));
+		_mm256_storeu_pd(dst + 12, _mm256_permute2f128_pd(t1, t3, 0x31));
+	}
+#endif
+
+	for (; i < count; ++i) {
+		out[i] = morton_u64_to_rect_f64(index[i], level[i]);
+	}
+}
+
+//------------------------------------------------------------------------------
+// Meshes
+
 void geometry::mesh_torus(float R1, float R2, uint32_t ntht1, uint32_t ntht2,  
 						  std::vector<vertex3d>& verts, 
 						  std::vector<uint32_t>& indices)
@@ -0,0 +1,189 @@
+#include "utils/page_alloc.h"
+#include "utils/common.h"
+
+#include <ev2/utils/log.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+
+// From numaif.h, which is only there with libnuma installed
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+// Nodes the mask passed to mbind has room for, which is the most the kernel
+// can be configured with
+static constexpr int PAGE_ALLOC_MAX_NODES = 1024;
+
+static size_t os_page_size(void)
+{
+	static const size_t size = (size_t)sysconf(_SC_PAGESIZE);
+	return size;
+}
+
+static bool map_hugetlb(page_region *reg, size_t size)
+{
+#ifdef MAP_HUGETLB
+	size = align_up_pow2(size, PAGE_ALLOC_HUGE_SIZE);
+
+	// Not MAP_NORESERVE; without a reservation a fault fails with SIGBUS 
+	// once the pool runs out, rather than here
+	void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, 
+				  MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if (mem == MAP_FAILED)
+		return false;
+
+	reg->mapping = mem;
+	reg->mapping_size = size;
+	reg->base = static_cast<uint8_t*>(mem);
+	reg->granularity = PAGE_ALLOC_HUGE_SIZE;
+	reg->flags |= PAGE_ALLOC_HUGETLB;
+	return true;
+#else
+	return false;
+#endif
+}
+
+static bool map_normal(page_region *reg, size_t size, bool thp)
+{
+	size = align_up_pow2(size, os_page_size());
+
+	// Over-reserve so that the region can start on a huge page boundary
+	size_t mapping_size = thp ? size + PAGE_ALLOC_HUGE_SIZE : size;
+
+	void *mem = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, 
+				  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (mem == MAP_FAILED)
+		return false;
+
+	reg->mapping = mem;
+	reg->mapping_size = mapping_size;
+	reg->base = reinterpret_cast<uint8_t*>(
+		align_up_pow2(reinterpret_cast<uintptr_t>(mem), thp ? PAGE_ALLOC_HUGE_SIZE : 1));
+	reg->granularity = os_page_size();
+
+#ifdef MADV_HUGEPAGE
+	if (thp && !madvise(reg->base, size, MADV_HUGEPAGE))
+		reg->flags |= PAGE_ALLOC_THP;
+#endif
+
+	return true;
+}
+
+int page_region_reserve(page_region *reg, const page_region_params *params)
+{
+	*reg = {};
+	reg->size = params->size;
+	reg->numa_node = PAGE_ALLOC_NODE_ANY;
+
+	bool mapped = (params->flags & PAGE_ALLOC_HUGETLB) && map_hugetlb(reg, params->size);
+
+	if (!mapped) {
+		bool thp = params->flags & (PAGE_ALLOC_HUGETLB | PAGE_ALLOC_THP);
+		if (!map_normal(reg, params->size, thp))
+			return -1;
+	}
+
+	if ((params->flags & ~reg->flags) != 0)
+		log_info("page_region_reserve : asked for flags %x, got %x", 
+		   params->flags, reg->flags);
+
+	if (params->numa_node >= PAGE_ALLOC_MAX_NODES) {
+		log_warn("page_region_reserve : node %d is past the last node, %d", 
+				 params->numa_node, PAGE_ALLOC_MAX_NODES - 1);
+	} else if (params->numa_node >= 0) {
+		static constexpr int bits = 8*sizeof(unsigned long);
+
+		unsigned long mask[PAGE_ALLOC_MAX_NODES/bits] = {};
+		mask[params->numa_node/bits] = 1ul << (params->numa_node % bits);
+
+		// The kernel reads one bit less than maxnode says
+		long res = syscall(SYS_mbind, reg->base, reg->size, MPOL_PREFERRED, 
+					 mask, (unsigned long)PAGE_ALLOC_MAX_NODES + 1, 0);
+		if (res == 0)
+			reg->numa_node = params->numa_node;
+		else
+			log_warn("page_region_reserve : could not bind to node %d", 
+					 params->numa_node);
+	}
+
+	return 0;
+}
+
+void page_region_release(page_region *reg)
+{
+	if (reg->mapping)
+		munmap(reg->mapping, reg->mapping_size);
+	*reg = {};
+}
+
+int page_region_commit(page_region *reg, size_t offset, size_t size)
+{
+	return 0;
+}
+
+void page_region_decommit(page_region *reg, size_t offset, size_t size)
+{
+	madvise(reg->base + offset, size, MADV_DONTNEED);
+}
+
+int page_alloc_current_node(void)
+{
+	unsigned cpu, node;
+	if (syscall(SYS_getcpu, &cpu, &node, nullptr) < 0)
+		return PAGE_ALLOC_NODE_ANY;
+	return (int)node;
+}
+
+#else // _WIN32
+
+// Large pages need a privilege most processes do not have, and NUMA 
+// placement a different reservation call, so regions are always plain here
+
+int page_region_reserve(page_region *reg, const page_region_params *params)
+{
+	*reg = {};
+	reg->size = params->size;
+	reg->numa_node = PAGE_ALLOC_NODE_ANY;
+
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	reg->granularity = info.dwPageSize;
+
+	reg->mapping = VirtualAlloc(nullptr, params->size, MEM_RESERVE, PAGE_NOACCESS);
+	reg->mapping_size = params->size;
+	reg->base = static_cast<uint8_t*>(reg->mapping);
+
+	return reg->mapping ? 0 : -1;
+}
+
+void page_region_release(page_region *reg)
+{
+	if (reg->mapping)
+		VirtualFree(reg->mapping, 0, MEM_RELEASE);
+	*reg = {};
+}
+
+int page_region_commit(page_region *reg, size_t offset, size_t size)
+{
+	return VirtualAlloc(reg->base + offset, size, MEM_COMMIT, PAGE_READWRITE) ? 0 : -1;
+}
+
+void page_region_decommit(page_region *reg, size_t offset, size_t size)
+{
+	VirtualFree(reg->base + offset, size, MEM_DECOMMIT);
+}
+
+int page_alloc_current_node(void)
+{
+	return PAGE_ALLOC_NODE_ANY;
+}
+
+#endif // _WIN32
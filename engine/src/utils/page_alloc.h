@@ -0,0 +1,60 @@
+#ifndef EV2_PAGE_ALLOC_H
+#define EV2_PAGE_ALLOC_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Size of the huge pages asked for by PAGE_ALLOC_HUGETLB and PAGE_ALLOC_THP
+static constexpr size_t PAGE_ALLOC_HUGE_SIZE = 2*1024*1024;
+
+enum page_alloc_flags : uint32_t
+{
+	// Explicit huge pages from the system's reserved pool.  Falls back to
+	// PAGE_ALLOC_THP when there are not enough of them.
+	PAGE_ALLOC_HUGETLB = 0x1,
+	// Asks the kernel to back the region with transparent huge pages
+	PAGE_ALLOC_THP = 0x2,
+};
+
+// No node is asked for; memory goes to the node of the thread that first 
+// writes to it
+static constexpr int PAGE_ALLOC_NODE_ANY = -1;
+
+struct page_region_params
+{
+	size_t size;
+	uint32_t flags;
+	int numa_node;
+};
+
+// @brief Address range reserved up front and committed a piece at a time
+struct page_region
+{
+	uint8_t *base;
+	size_t size;
+	// Offsets and sizes passed to commit and decommit must be multiples of 
+	// this
+	size_t granularity;
+	// What was actually obtained, which may be less than was asked for
+	uint32_t flags;
+	int numa_node;
+
+	void *mapping;
+	size_t mapping_size;
+};
+
+extern int page_region_reserve(page_region *reg, const page_region_params *params);
+extern void page_region_release(page_region *reg);
+
+// @brief Makes a range usable.  Memory is only taken from the system when 
+// first written to.
+extern int page_region_commit(page_region *reg, size_t offset, size_t size);
+
+// @brief Returns the memory of a range to the system.  The range can be 
+// committed again later.
+extern void page_region_decommit(page_region *reg, size_t offset, size_t size);
+
+// @return NUMA node of the calling thread, or PAGE_ALLOC_NODE_ANY if unknown
+extern int page_alloc_current_node(void);
+
+#endif // EV2_PAGE_ALLOC_H
@@ -4,7 +4,8 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
-#include <queue>
+#include <vector>
+#include <algorithm>
 //#include <atomic>
 
 struct ThreadPool
@@ -17,7 +18,35 @@ struct ThreadPool
 	std::mutex m_sync;
 	std::condition_variable m_cv;
 
-	std::queue<std::function<void(void)>> m_queue;
+	// Ring buffer rather than std::queue, whose deque allocates and frees a 
+	// block every few tasks
+	std::vector<std::function<void(void)>> m_queue;
+	size_t m_head = 0;
+	size_t m_count = 0;
+
+	void push(std::function<void(void)> &&task)
+	{
+		if (m_count == m_queue.size()) {
+			std::vector<std::function<void(void)>> grown (std::max(2*m_count, (size_t)64));
+			for (size_t i = 0; i < m_count; ++i)
+				grown[i] = std::move(m_queue[(m_head + i) % m_queue.size()]);
+
+			m_queue = std::move(grown);
+			m_head = 0;
+		}
+
+		m_queue[(m_head + m_count) % m_queue.size()] = std::move(task);
+		++m_count;
+	}
+
+	std::function<void(void)> pop()
+	{
+		std::function<void(void)> task = std::move(m_queue[m_head]);
+		m_queue[m_head] = nullptr;
+		m_head = (m_head + 1) % m_queue.size();
+		--m_count;
+		return task;
+	}
 
 	void thread_func() 
 	{
@@ -27,13 +56,12 @@ struct ThreadPool
 			std::unique_lock<std::mutex> lock(m_sync);
 			--m_num_active;
 			m_cv.wait(lock, [&](){
-				return m_terminate || !m_queue.empty();
+				return m_terminate || m_count;
 			});
 
-			if (m_terminate && m_queue.empty()) return;
+			if (m_terminate && !m_count) return;
 
-			task = std::move(m_queue.front());
-			m_queue.pop();
+			task = pop();
 			++m_num_active;
 			lock.unlock();
 
@@ -46,7 +74,7 @@ public:
 		std::unique_lock<std::mutex> lock(m_sync);
 		if (m_terminate)
 			return false;
-		m_queue.push(std::move(task));
+		push(std::move(task));
 		lock.unlock();
 
 		m_cv.notify_one();
@@ -0,0 +1,99 @@
+#include <ev2/utils/log.h>
+#include <ev2/globe/test_source.h>
+
+#include "globe/tile_pyramid.h"
+#include "globe/terrain.h"
+
+// std
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static void usage(const char *name)
+{
+	printf(
+		"usage: %s [-o path] [-j threads] max_zoom [face/zoom/idx ...]\n"
+		"\n"
+		"Bakes the test source into a tile pyramid file, down to max_zoom below\n"
+		"each of the given tiles, or over all six faces if there are none.\n"
+		"The default path is ev2_terrain.pyramid, which the globe loads from\n"
+		"its working directory.\n", name);
+}
+
+static bool parse_tile(const char *str, uint64_t *p_code)
+{
+	unsigned face, zoom;
+	unsigned long long idx;
+	if (sscanf(str, "%u/%u/%llu", &face, &zoom, &idx) != 3 || 
+		face >= CUBE_FACES || zoom > TILE_CODE_ZOOM_MASK)
+		return false;
+
+	*p_code = tile_code_pack(TileCode{
+		.face = (uint8_t)face, 
+		.zoom = (uint8_t)zoom, 
+		.idx = idx
+	});
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	tp_bake_params params = {};
+	params.path = TERRAIN_PYRAMID_PATH;
+
+	std::vector<uint64_t> roots;
+	int max_zoom = -1;
+
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+			params.path = argv[++i];
+		} else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+			params.threads = (uint32_t)atoi(argv[++i]);
+		} else if (max_zoom < 0) {
+			max_zoom = atoi(argv[i]);
+		} else {
+			uint64_t code;
+			if (!parse_tile(argv[i], &code)) {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			roots.push_back(code);
+		}
+	}
+
+	if (max_zoom < 0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	ds_context *ds;
+	if (test_data_source_init(&ds)) {
+		log_error("Failed to create data source");
+		return EXIT_FAILURE;
+	}
+
+	params.ds = ds;
+	params.max_zoom = (uint8_t)max_zoom;
+	params.roots = roots.data();
+	params.root_count = roots.size();
+
+	auto t0 = std::chrono::steady_clock::now();
+
+	tp_bake_stats stats;
+	int err = tp_bake(&params, &stats);
+
+	double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+	ds_context_destroy(ds);
+
+	if (err) 
+		return EXIT_FAILURE;
+
+	printf("%s : %zu tiles loaded, %zu downsampled, %.1f MB in %.2f s (%.1f tiles/s)\n",
+		params.path, stats.loaded, stats.downsampled, (double)stats.bytes/(1024.0*1024.0), 
+		sec, (double)(stats.loaded + stats.downsampled)/sec);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,246 @@
+#include "bench.h"
+
+#include "globe/async_lru_cache.h"
+
+#include <ev2/globe/tiling.h>
+
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <random>
+#include <thread>
+
+static constexpr size_t ALC_BENCH_CAPACITY = 4096;
+static constexpr size_t ALC_BENCH_PAGE_SIZE = 32;
+static constexpr size_t ALC_BENCH_FRAMES = 2048;
+static constexpr size_t ALC_BENCH_KEYS_PER_FRAME = 1024;
+
+// The list + unordered_map layout alc_table used before, for comparison
+struct list_lru
+{
+	std::list<uint32_t> lru;
+	std::unordered_map<uint64_t, std::list<uint32_t>::iterator> map;
+	std::vector<uint32_t> free_slots;
+	std::vector<uint64_t> slot_keys;
+
+	explicit list_lru(size_t capacity) : slot_keys(capacity) {
+		for (size_t i = capacity; i-- > 0;)
+			free_slots.push_back((uint32_t)i);
+	}
+
+	uint32_t get(uint64_t key) {
+		auto it = map.find(key);
+		if (it != map.end()) {
+			lru.splice(lru.begin(), lru, it->second);
+			return *it->second;
+		}
+
+		uint32_t slot;
+		if (free_slots.empty()) {
+			slot = lru.back();
+			lru.pop_back();
+			map.erase(slot_keys[slot]);
+		} else {
+			slot = free_slots.back();
+			free_slots.pop_back();
+		}
+
+		lru.push_front(slot);
+		map[key] = lru.begin();
+		slot_keys[slot] = key;
+		return slot;
+	}
+};
+
+static int bench_page_create(void *, uint32_t, alc_page_handle_t *p_handle)
+{
+	*p_handle = 0;
+	return 0;
+}
+
+static int bench_page_destroy(void *, alc_page_handle_t)
+{
+	return 0;
+}
+
+// Frames of tile requests from a square of tiles that drifts over a face, 
+// like the camera moving over terrain.  The table holds a square of about 64
+// tiles on a side, so narrower squares mostly hit.
+static std::vector<uint64_t> key_stream(int width)
+{
+	static constexpr int zoom = 12;
+	double side = (double)width/(double)(1 << zoom);
+
+	std::mt19937_64 rng(99);
+	std::uniform_real_distribution<double> dist(0.0, side);
+
+	std::vector<uint64_t> keys;
+	keys.reserve(ALC_BENCH_FRAMES*ALC_BENCH_KEYS_PER_FRAME);
+
+	for (size_t f = 0; f < ALC_BENCH_FRAMES; ++f) {
+		double t = (double)f/(double)ALC_BENCH_FRAMES;
+		glm::dvec2 origin = glm::dvec2(0.05 + 0.8*t, 0.05 + 0.4*t);
+
+		for (size_t i = 0; i < ALC_BENCH_KEYS_PER_FRAME; ++i) {
+			TileCode code = {
+				.face = 0,
+				.zoom = zoom,
+				.idx = morton_u64(origin.x + dist(rng), origin.y + dist(rng), zoom),
+			};
+			keys.push_back(tile_code_pack(code));
+		}
+	}
+
+	return keys;
+}
+
+static void bench_alc_stream(int width)
+{
+	std::vector<uint64_t> keys = key_stream(width);
+
+	alc_params params = {
+		.capacity = ALC_BENCH_CAPACITY,
+		.page_size = ALC_BENCH_PAGE_SIZE,
+		.usr = nullptr,
+		.page_create = bench_page_create,
+		.page_destroy = bench_page_destroy,
+	};
+
+	alc_table *alc;
+	if (alc_create(&alc, &params) < 0) {
+		printf("failed to create table\n");
+		return;
+	}
+
+	// Warm up, so every page exists and the table is full
+	for (uint64_t key : keys) {
+		alc_result res = alc_get(alc, key);
+		if (res.needs_load)
+			res.p_ent->state.store(alc_state_pack({
+				.status = ALC_STATUS_READY, .flags = 0, .gen = 0, .refs = 0
+			}));
+	}
+
+	size_t n = keys.size();
+	size_t hits = 0;
+
+	size_t allocs = bench_alloc_count();
+	double t0 = bench_now();
+	for (uint64_t key : keys) {
+		alc_result res = alc_get(alc, key);
+		hits += res.is_ready;
+		if (res.needs_load)
+			res.p_ent->state.store(alc_state_pack({
+				.status = ALC_STATUS_READY, .flags = 0, .gen = 0, .refs = 0
+			}));
+	}
+	double t1 = bench_now();
+	size_t get_allocs = bench_alloc_count() - allocs;
+
+	allocs = bench_alloc_count();
+	double t2 = bench_now();
+	for (uint64_t key : keys) {
+		if (alc_entry *ent = alc_acquire(alc, key))
+			alc_release(ent);
+	}
+	double t3 = bench_now();
+
+	// What find_best does for each ancestor
+	for (uint64_t key : keys) {
+		alc_index idx = alc_find(alc, tile_code_coarsen(key));
+		if (idx.is_valid())
+			alc_touch(alc, idx);
+	}
+	double t4 = bench_now();
+	size_t other_allocs = bench_alloc_count() - allocs;
+
+	alc_destroy(alc);
+
+	list_lru ref (ALC_BENCH_CAPACITY);
+	for (uint64_t key : keys)
+		bench_keep(ref.get(key));
+
+	allocs = bench_alloc_count();
+	double t5 = bench_now();
+	for (uint64_t key : keys)
+		bench_keep(ref.get(key));
+	double t6 = bench_now();
+	size_t ref_allocs = bench_alloc_count() - allocs;
+
+	printf("%d tiles wide, %zu requests, %.1f%% hits\n", 
+		width, n, 100.0*(double)hits/(double)n);
+	printf("%20s %10s %12s\n", "", "ns/op", "allocs/op");
+	printf("%20s %10.1f %12.3f\n", "list lru get",
+		1e9*(t6 - t5)/(double)n, (double)ref_allocs/(double)n);
+	printf("%20s %10.1f %12.3f\n", "alc_get",
+		1e9*(t1 - t0)/(double)n, (double)get_allocs/(double)n);
+	printf("%20s %10.1f %12s\n", "acquire/release", 1e9*(t3 - t2)/(double)n, "");
+	printf("%20s %10.1f %12s\n", "find/touch", 1e9*(t4 - t3)/(double)n, "");
+	printf("%20s %10s %12.3f\n", "acquire, find", "", (double)other_allocs/(double)(2*n));
+}
+
+// Every thread replays the whole stream against one table, like worker 
+// threads looking up the same visible tiles
+static double bench_alc_threads(const std::vector<uint64_t> &keys, 
+								size_t shard_count, unsigned thread_count)
+{
+	alc_params params = {
+		.capacity = ALC_BENCH_CAPACITY,
+		.page_size = ALC_BENCH_PAGE_SIZE,
+		.shard_count = shard_count,
+		.usr = nullptr,
+		.page_create = bench_page_create,
+		.page_destroy = bench_page_destroy,
+	};
+
+	alc_table *alc;
+	if (alc_create(&alc, &params) < 0)
+		return 0;
+
+	auto run = [&](unsigned t) {
+		// Start each thread at a different point, so they do not move in 
+		// lockstep
+		size_t n = keys.size();
+		for (size_t i = 0; i < n; ++i) {
+			uint64_t key = keys[(i + t*n/thread_count) % n];
+
+			alc_result res = alc_get(alc, key);
+			if (res.needs_load && alc_state_set_queued(&res.p_ent->state, res.gen) &&
+				alc_state_set_loading(&res.p_ent->state, res.gen))
+				alc_state_set_ready(&res.p_ent->state, res.gen);
+
+			// What find_best does for the parent
+			bench_keep(alc_touch_ready(alc, tile_code_coarsen(key)));
+		}
+	};
+
+	std::vector<std::thread> threads;
+
+	double t0 = bench_now();
+	for (unsigned t = 0; t < thread_count; ++t)
+		threads.emplace_back(run, t);
+	for (std::thread &th : threads)
+		th.join();
+	double t1 = bench_now();
+
+	alc_destroy(alc);
+
+	return 1e9*(t1 - t0)/(double)(keys.size()*thread_count);
+}
+
+void bench_alc(void)
+{
+	// Slow and fast camera motion
+	bench_alc_stream(48);
+	bench_alc_stream(96);
+
+	std::vector<uint64_t> keys = key_stream(48);
+	unsigned thread_count = std::max(std::thread::hardware_concurrency(), 2u);
+
+	printf("%u threads, get + touch_ready\n", thread_count);
+	printf("%20s %10s\n", "shards", "ns/op");
+	for (size_t shards : {1, 4, 16}) {
+		printf("%20zu %10.1f\n", shards, 
+			bench_alc_threads(keys, shards, thread_count));
+	}
+}
@@ -0,0 +1,49 @@
+#include "bench.h"
+
+#include <atomic>
+#include <new>
+#include <cstdlib>
+
+// Counts every global allocation made by the benchmark process
+
+static std::atomic_size_t g_alloc_count = 0;
+
+size_t bench_alloc_count(void)
+{
+	return g_alloc_count.load(std::memory_order_relaxed);
+}
+
+void *operator new(size_t size)
+{
+	g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+
+	if (void *ptr = malloc(size ? size : 1))
+		return ptr;
+
+	throw std::bad_alloc();
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+	free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+	free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept
+{
+	free(ptr);
+}
@@ -0,0 +1,40 @@
+#ifndef EV2_BENCH_H
+#define EV2_BENCH_H
+
+#include <chrono>
+#include <cstdio>
+
+struct bench_entry
+{
+	const char *name;
+	void (*fn)(void);
+};
+
+static inline double bench_now()
+{
+	auto tpt = std::chrono::steady_clock::now();
+	return (double)tpt.time_since_epoch().count()*1e-9;
+}
+
+/// @brief Keeps the compiler from discarding a computed value
+template<typename T>
+static inline void bench_keep(const T &val)
+{
+	asm volatile("" : : "g"(&val) : "memory");
+}
+
+/// @return Number of operator new calls so far
+extern size_t bench_alloc_count(void);
+
+extern void bench_morton(void);
+extern void bench_select(void);
+extern void bench_alc(void);
+extern void bench_replay(void);
+extern void bench_quant(void);
+extern void bench_upload(void);
+extern void bench_disk(void);
+extern void bench_frame(void);
+extern void bench_terrain(void);
+extern void bench_sample(void);
+
+#endif // EV2_BENCH_H
@@ -0,0 +1,30 @@
+#ifndef EV2_BENCH_CAMERA_PATH_H
+#define EV2_BENCH_CAMERA_PATH_H
+
+#include "globe/tile_select.h"
+
+#include <vector>
+
+struct bench_camera
+{
+	glm::dvec3 pos;
+	glm::dvec3 target;
+};
+
+/// @brief Descent from orbit to near the surface while flying along a great
+/// circle, looking ahead at the horizon.
+extern std::vector<bench_camera> bench_descent_path(size_t frames);
+
+/// @brief Fast flight low over the surface, so that most tiles are new every
+/// frame.
+extern std::vector<bench_camera> bench_flyover_path(size_t frames);
+
+/// @brief Same frustum setup as globe_update, with the far plane at the 
+/// horizon
+extern select_tiles_params bench_camera_params(
+	const mmt_tree *mmt, 
+	const bench_camera &cam,
+	size_t max_tiles
+);
+
+#endif // EV2_BENCH_CAMERA_PATH_H
@@ -0,0 +1,93 @@
+#include "bench.h"
+
+#include "globe/disk_cache.h"
+
+#include <ev2/globe/test_source.h>
+#include <ev2/globe/tiling.h>
+
+#include <vector>
+#include <cstdio>
+
+static constexpr const char *DISK_BENCH_PATH = "ev2_bench_tiles.cache";
+static constexpr size_t DISK_BENCH_TILES = 128;
+static constexpr uint8_t DISK_BENCH_ZOOM = 6;
+
+static int never_cancelled(struct ds_token *)
+{
+	return 0;
+}
+
+// Tiles as tc_load would load them on a cold start, then as they are read
+// back from the file on a warm one
+void bench_disk(void)
+{
+	ds_context *ds;
+	if (test_data_source_init(&ds)) {
+		printf("failed to create data source\n");
+		return;
+	}
+
+	static const ds_token_vtbl vtbl = {.is_cancelled = never_cancelled};
+	ds_token tok = {.usr = nullptr, .vtbl = &vtbl};
+
+	std::vector<float> tile(TILE_SIZE);
+	ds_buf buf = {.dst = tile.data(), .size = TILE_SIZE*sizeof(float)};
+
+	dc_params params = {
+		.path = DISK_BENCH_PATH,
+		.tile_size = buf.size,
+		.capacity = 2*DISK_BENCH_TILES*buf.size,
+		.version = 1,
+	};
+
+	remove(DISK_BENCH_PATH);
+
+	dc_cache *dc;
+	if (dc_open(&dc, &params) < 0) {
+		printf("failed to open %s\n", DISK_BENCH_PATH);
+		ds_context_destroy(ds);
+		return;
+	}
+
+	auto code = [](size_t i) {
+		return tile_code_pack(TileCode{
+			.face = (uint8_t)(i % 6),
+			.zoom = DISK_BENCH_ZOOM,
+			.idx = i*37
+		});
+	};
+
+	double t0 = bench_now();
+	for (size_t i = 0; i < DISK_BENCH_TILES; ++i) {
+		ds->vtbl.loader(ds->usr, code(i), &buf, &tok);
+		dc_write(dc, code(i), buf.dst, buf.size);
+	}
+	double t1 = bench_now();
+
+	// Waits for the writes
+	dc_close(dc);
+
+	if (dc_open(&dc, &params) < 0) {
+		printf("failed to reopen %s\n", DISK_BENCH_PATH);
+		ds_context_destroy(ds);
+		return;
+	}
+
+	size_t hits = 0;
+	double t3 = bench_now();
+	for (size_t i = 0; i < DISK_BENCH_TILES; ++i)
+		hits += dc_read(dc, code(i), buf.dst, buf.size);
+	double t4 = bench_now();
+
+	dc_stats stats = dc_get_stats(dc);
+	dc_close(dc);
+	ds_context_destroy(ds);
+	remove(DISK_BENCH_PATH);
+
+	double n = (double)DISK_BENCH_TILES;
+	printf("%zu tiles of %zu KB, %zu read back, %zu dropped\n", DISK_BENCH_TILES,
+		buf.size/1024, hits, stats.dropped);
+	printf("%20s %12s\n", "", "tiles/s");
+	printf("%20s %12.0f\n", "data source", n/(t1 - t0));
+	printf("%20s %12.0f\n", "disk cache", n/(t4 - t3));
+}
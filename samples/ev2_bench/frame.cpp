@@ -0,0 +1,109 @@
+#include "bench.h"
+#include "camera_path.h"
+
+#include "globe/tile_select.h"
+#include "utils/frame_arena.h"
+
+#include <vector>
+#include <algorithm>
+
+static constexpr size_t FRAME_BENCH_FRAMES = 120;
+static constexpr size_t FRAME_BENCH_MAX_TILES = 512;
+// Frames before counting, while the cut converges and the arena grows
+static constexpr size_t FRAME_BENCH_WARMUP = 30;
+// How far ahead the prefetch predicts the camera
+static constexpr size_t FRAME_BENCH_PREDICT = 15;
+
+struct frame_bench_result
+{
+	double allocs_per_frame;
+	size_t arena_heap_allocs;
+	size_t arena_bytes;
+};
+
+// The selection work globe_update does each frame: the incremental cut for
+// the view, the tiles the cut would change for the predicted camera, and the
+// per-tile temporaries
+static frame_bench_result run_frames(
+	const mmt_tree *mmt,
+	const std::vector<bench_camera> &path,
+	frame_arena *arena
+)
+{
+	SelectionCut cut = {};
+	std::vector<tile_code_t> tiles, predicted;
+
+	size_t heap_allocs = arena ? (size_t)arena->heap_allocs : 0;
+	size_t allocs = 0;
+
+	for (size_t f = 0; f < path.size(); ++f) {
+		if (f == FRAME_BENCH_WARMUP) {
+			allocs = bench_alloc_count();
+			heap_allocs = arena ? (size_t)arena->heap_allocs : 0;
+		}
+
+		if (arena)
+			frame_arena_reset(arena);
+
+		select_tiles_params params = bench_camera_params(mmt, path[f], FRAME_BENCH_MAX_TILES);
+		params.arena = arena;
+		select_tiles_incremental(params, cut, tiles);
+
+		size_t ahead = std::min(f + FRAME_BENCH_PREDICT, path.size() - 1);
+		params = bench_camera_params(mmt, path[ahead], FRAME_BENCH_MAX_TILES);
+		params.arena = arena;
+		select_tiles_predict(params, cut, predicted);
+
+		frame_vector<tile_code_t> loaded (tiles.size(), TILE_CODE_NONE_U, arena);
+		frame_vector<tile_code_t> ideal (tiles.begin(), tiles.end(), arena);
+		bench_keep(loaded.data());
+		bench_keep(ideal.data());
+	}
+
+	size_t frames = path.size() - FRAME_BENCH_WARMUP;
+
+	return frame_bench_result{
+		.allocs_per_frame = (double)(bench_alloc_count() - allocs)/(double)frames,
+		.arena_heap_allocs = arena ? arena->heap_allocs - heap_allocs : 0,
+		.arena_bytes = arena ? arena->capacity : 0,
+	};
+}
+
+void bench_frame(void)
+{
+	mmt_tree *mmt;
+	if (mmt_create(&mmt, mmt_value_t{.min = -0.1f, .max = 0.1f})) {
+		printf("failed to create min/max tree\n");
+		return;
+	}
+
+	std::vector<bench_camera> descent = bench_descent_path(FRAME_BENCH_FRAMES);
+
+	// The camera holding still at the end of the descent
+	std::vector<bench_camera> still (FRAME_BENCH_FRAMES, descent.back());
+
+	static const struct {
+		const char *name;
+		const std::vector<bench_camera> *path;
+	} paths[] = {
+		{"still", &still},
+		{"descent", &descent},
+	};
+
+	printf("%12s %12s %16s %16s %12s\n", "", "", "new/frame", "arena mallocs", "arena KB");
+
+	for (const auto &p : paths) {
+		frame_bench_result heap = run_frames(mmt, *p.path, nullptr);
+
+		frame_arena arena;
+		frame_arena_init(&arena, 64*1024);
+		frame_bench_result res = run_frames(mmt, *p.path, &arena);
+		frame_arena_destroy(&arena);
+
+		printf("%12s %12s %16.1f\n", p.name, "heap", heap.allocs_per_frame);
+		printf("%12s %12s %16.1f %16zu %12zu\n", "", "arena", res.allocs_per_frame,
+			res.arena_heap_allocs, res.arena_bytes/1024);
+	}
+
+	mmt_destroy(mmt);
+}
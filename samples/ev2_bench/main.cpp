@@ -0,0 +1,32 @@
+#include "bench.h"
+
+#include <cstring>
+#include <cstdlib>
+
+static const bench_entry g_benches[] = {
+	{"morton", bench_morton},
+	{"select", bench_select},
+	{"alc", bench_alc},
+	{"replay", bench_replay},
+	{"quant", bench_quant},
+	{"upload", bench_upload},
+	{"disk", bench_disk},
+	{"frame", bench_frame},
+	{"terrain", bench_terrain},
+	{"sample", bench_sample},
+};
+
+int main(int argc, char *argv[])
+{
+	const char *filter = argc > 1 ? argv[1] : nullptr;
+
+	for (const bench_entry &ent : g_benches) {
+		if (filter && !strstr(ent.name, filter))
+			continue;
+
+		printf("== %s ==\n", ent.name);
+		ent.fn();
+	}
+
+	return EXIT_SUCCESS;
+}
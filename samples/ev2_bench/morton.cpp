@@ -0,0 +1,140 @@
+#include "bench.h"
+
+#include <ev2/utils/geometry.h>
+
+#include <vector>
+#include <random>
+
+static constexpr size_t MORTON_BENCH_COUNT = 1 << 20;
+
+// Bit-by-bit path that morton_u64_to_rect_f64 takes without BMI2
+static aabb2_t rect_reference(uint64_t index, uint8_t level)
+{
+	uint64_t px, py;
+	morton_u64_decode_bits(index, level, &px, &py);
+
+	double h = 1.0/(double)(1 << level);
+
+	aabb2_t box;
+	box.min = glm::dvec2((double)px*h, (double)py*h);
+	box.max = box.min + h;
+	return box;
+}
+
+static bool rect_equal(const aabb2_t &a, const aabb2_t &b)
+{
+	return a.min == b.min && a.max == b.max;
+}
+
+// @return Codes and rects from the BMI2 and batched paths that differ from
+// the bit-by-bit ones, with a mix of levels up to 28 for the batched decode
+static size_t morton_check(const std::vector<double> &x, const std::vector<double> &y,
+						   std::mt19937_64 &rng)
+{
+	size_t n = x.size();
+	size_t wrong = 0;
+
+	std::vector<uint64_t> ref (n), codes (n);
+	std::vector<uint8_t> levels (n);
+	std::vector<aabb2_t> rects (n);
+
+	for (int lvl = 0; lvl <= 28; ++lvl) {
+		double w = (double)(1 << lvl);
+
+		for (size_t i = 0; i < n; ++i) {
+			ref[i] = morton_u64_encode_bits((uint64_t)(x[i]*w), (uint64_t)(y[i]*w), lvl);
+			wrong += morton_u64(x[i], y[i], lvl) != ref[i];
+			wrong += !rect_equal(morton_u64_to_rect_f64(ref[i], lvl), 
+						 rect_reference(ref[i], (uint8_t)lvl));
+		}
+
+		morton_u64_batch(x.data(), y.data(), n, lvl, codes.data());
+		for (size_t i = 0; i < n; ++i)
+			wrong += codes[i] != ref[i];
+	}
+
+	std::uniform_int_distribution<int> level_dist (0, 28);
+	for (size_t i = 0; i < n; ++i) {
+		levels[i] = (uint8_t)level_dist(rng);
+		double w = (double)(1 << levels[i]);
+		codes[i] = morton_u64_encode_bits((uint64_t)(x[i]*w), (uint64_t)(y[i]*w), levels[i]);
+	}
+
+	morton_u64_to_rect_f64_batch(codes.data(), levels.data(), n, rects.data());
+	for (size_t i = 0; i < n; ++i)
+		wrong += !rect_equal(rects[i], rect_reference(codes[i], levels[i]));
+
+	return wrong;
+}
+
+template<typename F>
+static double ns_per_code(F &&fn)
+{
+	double t0 = bench_now();
+	fn();
+	double t1 = bench_now();
+	return 1e9*(t1 - t0)/(double)MORTON_BENCH_COUNT;
+}
+
+void bench_morton(void)
+{
+	std::mt19937_64 rng(1234);
+	std::uniform_real_distribution<double> dist(0.0, 1.0);
+
+	std::vector<double> x (MORTON_BENCH_COUNT);
+	std::vector<double> y (MORTON_BENCH_COUNT);
+	std::vector<uint64_t> codes (MORTON_BENCH_COUNT);
+	std::vector<uint8_t> levels (MORTON_BENCH_COUNT);
+	std::vector<aabb2_t> rects (MORTON_BENCH_COUNT);
+
+	for (size_t i = 0; i < MORTON_BENCH_COUNT; ++i) {
+		x[i] = dist(rng);
+		y[i] = dist(rng);
+	}
+
+	printf("%zu results differ from the reference\n", morton_check(x, y, rng));
+
+	printf("%4s | %10s %10s %10s | %10s %10s %10s  (ns/code)\n", "zoom",
+		"enc ref", "enc bmi2", "enc avx2", "dec ref", "dec bmi2", "dec avx2");
+
+	for (int lvl = 0; lvl < 24; ++lvl) {
+		double w = (double)(1 << lvl);
+
+		double enc_ref = ns_per_code([&]() {
+			for (size_t i = 0; i < MORTON_BENCH_COUNT; ++i) 
+				codes[i] = morton_u64_encode_bits(
+					(uint64_t)(x[i]*w), (uint64_t)(y[i]*w), lvl);
+			bench_keep(codes);
+		});
+		double enc_scalar = ns_per_code([&]() {
+			for (size_t i = 0; i < MORTON_BENCH_COUNT; ++i) 
+				codes[i] = morton_u64(x[i], y[i], lvl);
+			bench_keep(codes);
+		});
+		double enc_batch = ns_per_code([&]() {
+			morton_u64_batch(x.data(), y.data(), MORTON_BENCH_COUNT, lvl, codes.data());
+			bench_keep(codes);
+		});
+
+		std::fill(levels.begin(), levels.end(), (uint8_t)lvl);
+
+		double dec_ref = ns_per_code([&]() {
+			for (size_t i = 0; i < MORTON_BENCH_COUNT; ++i) 
+				rects[i] = rect_reference(codes[i], levels[i]);
+			bench_keep(rects);
+		});
+		double dec_scalar = ns_per_code([&]() {
+			for (size_t i = 0; i < MORTON_BENCH_COUNT; ++i) 
+				rects[i] = morton_u64_to_rect_f64(codes[i], levels[i]);
+			bench_keep(rects);
+		});
+		double dec_batch = ns_per_code([&]() {
+			morton_u64_to_rect_f64_batch(codes.data(), levels.data(), 
+								MORTON_BENCH_COUNT, rects.data());
+			bench_keep(rects);
+		});
+
+		printf("%4d | %10.3f %10.3f %10.3f | %10.3f %10.3f %10.3f\n", lvl, 
+		 enc_ref, enc_scalar, enc_batch, dec_ref, dec_scalar, dec_batch);
+	}
+}
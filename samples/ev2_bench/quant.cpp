@@ -0,0 +1,116 @@
+#include "bench.h"
+
+#include "globe/tile_quant.h"
+
+#include <ev2/globe/tiling.h>
+
+#include <vector>
+#include <random>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+static constexpr size_t QUANT_BENCH_TILES = 64;
+
+// Scalar path that tile_encode_u16 and tile_decode_u16 vectorize
+static void encode_reference(const float *src, size_t count, float min, float max, 
+							 uint16_t *dst)
+{
+	float step = tile_quant_step(min, max);
+	float scale = step > 0 ? 1.0f/step : 0;
+	for (size_t i = 0; i < count; ++i)
+		dst[i] = (uint16_t)lrintf(std::clamp((src[i] - min)*scale, 0.0f, 
+								(float)UINT16_MAX));
+}
+
+static void decode_reference(const uint16_t *src, size_t count, float min, float max, 
+							 float *dst)
+{
+	float step = tile_quant_step(min, max);
+	for (size_t i = 0; i < count; ++i)
+		dst[i] = min + (float)src[i]*step;
+}
+
+template<typename F>
+static double gb_per_s(size_t bytes, F &&fn)
+{
+	double t0 = bench_now();
+	fn();
+	double t1 = bench_now();
+	return 1e-9*(double)bytes/(t1 - t0);
+}
+
+void bench_quant(void)
+{
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+
+	// Smooth terrain with some noise, at different heights per tile
+	std::vector<float> heights (QUANT_BENCH_TILES*TILE_SIZE);
+	for (size_t t = 0; t < QUANT_BENCH_TILES; ++t) {
+		float base = 0.05f*noise(rng);
+		for (size_t i = 0; i < TILE_SIZE; ++i) {
+			float x = (float)(i % TILE_WIDTH)/(float)TILE_WIDTH;
+			float y = (float)(i / TILE_WIDTH)/(float)TILE_WIDTH;
+			heights[t*TILE_SIZE + i] = base + 1e-3f*sinf(9.0f*x)*cosf(7.0f*y) + 
+				1e-5f*noise(rng);
+		}
+	}
+
+	std::vector<float> min (QUANT_BENCH_TILES), max (QUANT_BENCH_TILES);
+	std::vector<uint16_t> packed (heights.size()), packed_ref (heights.size());
+	std::vector<float> decoded (heights.size()), decoded_ref (heights.size());
+
+	size_t f32_bytes = heights.size()*sizeof(float);
+
+	double mm = gb_per_s(f32_bytes, [&]() {
+		for (size_t t = 0; t < QUANT_BENCH_TILES; ++t)
+			tile_minmax_f32(&heights[t*TILE_SIZE], TILE_SIZE, &min[t], &max[t]);
+		bench_keep(min);
+	});
+
+	double enc_ref = gb_per_s(f32_bytes, [&]() {
+		for (size_t t = 0; t < QUANT_BENCH_TILES; ++t)
+			encode_reference(&heights[t*TILE_SIZE], TILE_SIZE, min[t], max[t], 
+					&packed_ref[t*TILE_SIZE]);
+		bench_keep(packed_ref);
+	});
+	double enc = gb_per_s(f32_bytes, [&]() {
+		for (size_t t = 0; t < QUANT_BENCH_TILES; ++t)
+			tile_encode_u16(&heights[t*TILE_SIZE], TILE_SIZE, min[t], max[t], 
+					&packed[t*TILE_SIZE]);
+		bench_keep(packed);
+	});
+
+	double dec_ref = gb_per_s(f32_bytes, [&]() {
+		for (size_t t = 0; t < QUANT_BENCH_TILES; ++t)
+			decode_reference(&packed[t*TILE_SIZE], TILE_SIZE, min[t], max[t], 
+					&decoded_ref[t*TILE_SIZE]);
+		bench_keep(decoded_ref);
+	});
+	double dec = gb_per_s(f32_bytes, [&]() {
+		for (size_t t = 0; t < QUANT_BENCH_TILES; ++t)
+			tile_decode_u16(&packed[t*TILE_SIZE], TILE_SIZE, min[t], max[t], 
+					&decoded[t*TILE_SIZE]);
+		bench_keep(decoded);
+	});
+
+	// Error relative to the half step bound
+	double worst = 0;
+	for (size_t t = 0; t < QUANT_BENCH_TILES; ++t) {
+		double half_step = 0.5*(double)tile_quant_step(min[t], max[t]);
+		for (size_t i = t*TILE_SIZE; i < (t + 1)*TILE_SIZE; ++i) {
+			double err = fabs((double)decoded[i] - (double)heights[i]);
+			worst = std::max(worst, err/half_step);
+		}
+	}
+
+	printf("%zu tiles, simd matches scalar: encode %s, decode %s, "
+		"worst error %.3f half steps\n", QUANT_BENCH_TILES, 
+		packed == packed_ref ? "yes" : "no", 
+		decoded == decoded_ref ? "yes" : "no", worst);
+	printf("%12s %10s %10s\n", "", "scalar", "simd");
+	printf("%12s %10s %10.2f  (GB/s of floats)\n", "min/max", "", mm);
+	printf("%12s %10.2f %10.2f\n", "encode", enc_ref, enc);
+	printf("%12s %10.2f %10.2f\n", "decode", dec_ref, dec);
+}
@@ -0,0 +1,223 @@
+#include "bench.h"
+#include "camera_path.h"
+
+#include "globe/async_lru_cache.h"
+#include "globe/tile_select.h"
+
+#include <vector>
+#include <unordered_set>
+
+static constexpr size_t REPLAY_FRAMES = 240;
+static constexpr size_t REPLAY_MAX_TILES = 512;
+static constexpr size_t REPLAY_CAPACITY = 1024;
+static constexpr size_t REPLAY_PAGE_SIZE = 32;
+// Frames between requesting a tile and it being ready
+static constexpr size_t REPLAY_LOAD_FRAMES = 3;
+static constexpr uint8_t REPLAY_PROTECTED_ZOOM = 4;
+// Holes are not counted while the first levels load
+static constexpr size_t REPLAY_WARMUP_FRAMES = 30;
+// One-off tiles requested on a few frames halfway along the path, like a 
+// query sweeping over terrain that is not drawn
+static constexpr size_t REPLAY_SCAN_TILES = 768;
+static constexpr size_t REPLAY_SCAN_FRAMES = 2;
+static constexpr uint8_t REPLAY_SCAN_ZOOM = 20;
+
+struct replay_stats
+{
+	size_t requests;
+	size_t hits;
+	size_t holes;
+	size_t loads;
+};
+
+struct replay_load
+{
+	alc_entry *ent;
+	tile_code_t key;
+	uint16_t gen;
+	size_t frame;
+};
+
+static int replay_page_create(void *, uint32_t, alc_page_handle_t *p_handle)
+{
+	*p_handle = 0;
+	return 0;
+}
+
+static int replay_page_destroy(void *, alc_page_handle_t)
+{
+	return 0;
+}
+
+static bool replay_is_protected(void *, uint64_t key)
+{
+	return tile_code_zoom(key) <= REPLAY_PROTECTED_ZOOM;
+}
+
+// Replays the tile requests tc_load makes for each frame.  Like the min/max
+// tree gating selection in globe_update, a tile is only requested once its
+// parent has been loaded at some point; until then its shallowest ancestor 
+// that has not is.  Tiles that are not ready fall back to a ready ancestor 
+// the same way find_best does, and count as holes if there is none.
+static replay_stats replay(
+	const std::vector<std::vector<tile_code_t>> &frames,
+	alc_policy policy,
+	bool protect,
+	bool scan
+)
+{
+	replay_stats stats = {};
+
+	alc_params params = {
+		.capacity = REPLAY_CAPACITY,
+		.page_size = REPLAY_PAGE_SIZE,
+		.shard_count = 1,
+		.usr = nullptr,
+		.page_create = replay_page_create,
+		.page_destroy = replay_page_destroy,
+		.policy = policy,
+		.is_protected = protect ? replay_is_protected : nullptr,
+	};
+
+	alc_table *alc;
+	if (alc_create(&alc, &params) < 0)
+		return stats;
+
+	std::vector<replay_load> loads;
+	// What the min/max tree would know about
+	std::unordered_set<tile_code_t> seen;
+
+	const size_t scan_first = frames.size()/2;
+
+	for (size_t f = 0; f < frames.size(); ++f) {
+		std::erase_if(loads, [&](const replay_load &load) {
+			if (load.frame + REPLAY_LOAD_FRAMES > f)
+				return false;
+
+			if (alc_state_set_loading(&load.ent->state, load.gen) &&
+				alc_state_set_ready(&load.ent->state, load.gen))
+				seen.insert(load.key);
+			return true;
+		});
+
+		for (size_t i = 0; scan && f >= scan_first && 
+			 f < scan_first + REPLAY_SCAN_FRAMES && i < REPLAY_SCAN_TILES; ++i) {
+			tile_code_t key = tile_code_pack(TileCode{
+				.face = 0, 
+				.zoom = REPLAY_SCAN_ZOOM, 
+				.idx = i
+			});
+			alc_result res = alc_get(alc, key);
+			if (res.needs_load && alc_state_set_queued(&res.p_ent->state, res.gen))
+				loads.push_back({res.p_ent, key, res.gen, f});
+		}
+
+		for (tile_code_t tile : frames[f]) {
+			TileCode code = tile_code_unpack(tile);
+
+			tile_code_t key = tile;
+			for (uint8_t zoom = 0; zoom < code.zoom; ++zoom) {
+				tile_code_t anc = tile_code_pack(TileCode{
+					.face = code.face,
+					.zoom = zoom,
+					.idx = code.idx >> 2*(code.zoom - zoom),
+				});
+				if (!seen.contains(anc)) {
+					key = anc;
+					break;
+				}
+			}
+
+			++stats.requests;
+
+			alc_result res = alc_get(alc, key);
+			if (res.needs_load && alc_state_set_queued(&res.p_ent->state, res.gen)) {
+				loads.push_back({res.p_ent, key, res.gen, f});
+				++stats.loads;
+			}
+
+			if (res.is_ready && key == tile) {
+				++stats.hits;
+				continue;
+			}
+
+			bool found = false;
+			while (!found && code.zoom > 0) {
+				code = tile_code_unpack(tile_code_coarsen(tile_code_pack(code)));
+				found = alc_touch_ready(alc, tile_code_pack(code));
+			}
+
+			stats.holes += !found && f >= REPLAY_WARMUP_FRAMES;
+		}
+	}
+
+	// Finish what is still queued, alc_destroy waits for it
+	for (const replay_load &load : loads) {
+		if (alc_state_set_loading(&load.ent->state, load.gen))
+			alc_state_set_ready(&load.ent->state, load.gen);
+	}
+
+	alc_destroy(alc);
+
+	return stats;
+}
+
+static void replay_path(
+	const mmt_tree *mmt,
+	const char *name,
+	const std::vector<bench_camera> &path
+)
+{
+	std::vector<std::vector<tile_code_t>> frames (path.size());
+
+	size_t total = 0;
+	for (size_t i = 0; i < path.size(); ++i) {
+		select_tiles_params params = bench_camera_params(mmt, path[i], REPLAY_MAX_TILES);
+		select_tiles(params, frames[i]);
+		total += frames[i].size();
+	}
+
+	printf("%s, %zu frames, %.1f tiles/frame, capacity %zu\n", name,
+		path.size(), (double)total/(double)path.size(), REPLAY_CAPACITY);
+	printf("%12s %10s %12s %12s %12s\n", "", "hits", "loads/frame", "holes/frame", 
+		"with scan");
+
+	static const struct {
+		const char *name;
+		alc_policy policy;
+		bool protect;
+	} policies[] = {
+		{"lru", ALC_POLICY_LRU, false},
+		{"clock", ALC_POLICY_CLOCK, false},
+		{"2q", ALC_POLICY_2Q, false},
+		{"lru+zoom", ALC_POLICY_LRU, true},
+		{"clock+zoom", ALC_POLICY_CLOCK, true},
+		{"2q+zoom", ALC_POLICY_2Q, true},
+	};
+
+	for (const auto &p : policies) {
+		replay_stats stats = replay(frames, p.policy, p.protect, false);
+		replay_stats scan = replay(frames, p.policy, p.protect, true);
+
+		double n = (double)path.size();
+		printf("%12s %9.1f%% %12.1f %12.2f %12.2f\n", p.name,
+			100.0*(double)stats.hits/(double)stats.requests,
+			(double)stats.loads/n, 
+			(double)stats.holes/(double)(path.size() - REPLAY_WARMUP_FRAMES),
+			(double)scan.holes/(double)(path.size() - REPLAY_WARMUP_FRAMES));
+	}
+}
+
+void bench_replay(void)
+{
+	mmt_tree *mmt;
+	if (mmt_create(&mmt, mmt_value_t{.min = -0.1f, .max = 0.1f})) {
+		printf("failed to create min/max tree\n");
+		return;
+	}
+
+	replay_path(mmt, "descent", bench_descent_path(REPLAY_FRAMES));
+	replay_path(mmt, "flyover", bench_flyover_path(REPLAY_FRAMES));
+
+	mmt_destroy(mmt);
+}
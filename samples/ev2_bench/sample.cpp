@@ -0,0 +1,177 @@
+#include "bench.h"
+
+#include "globe/terrain.h"
+#include "utils/page_alloc.h"
+
+#include <ev2/globe/test_source.h>
+#include <ev2/globe/tiling.h>
+
+#include <vector>
+#include <random>
+#include <cmath>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <cfloat>
+
+static constexpr size_t SAMPLE_BENCH_POINTS = 16384;
+
+struct sample_bench_points
+{
+	std::vector<double> x, y, z;
+};
+
+// Uniform over the sphere, or within about spread radians of a point, like
+// the queries of objects near the camera
+static sample_bench_points make_points(std::mt19937 &rng, glm::dvec3 center, double spread)
+{
+	std::normal_distribution<double> normal;
+
+	sample_bench_points pts;
+	for (size_t i = 0; i < SAMPLE_BENCH_POINTS; ++i) {
+		glm::dvec3 p = glm::dvec3(normal(rng), normal(rng), normal(rng));
+		p = spread > 0 ? center + spread*p : p;
+		p = glm::normalize(p);
+
+		pts.x.push_back(p.x);
+		pts.y.push_back(p.y);
+		pts.z.push_back(p.z);
+	}
+	return pts;
+}
+
+// Loads the tiles, which must be what the source finds for them, and waits
+// for all of them
+static bool load_all(CPUTileCache *cache, const std::vector<tile_code_t> &tiles)
+{
+	std::vector<tile_code_t> out (tiles.size());
+
+	for (int tries = 0; tries < 100000; ++tries) {
+		if (tc_load(cache->tc, cache->ds, nullptr, nullptr, tiles.size(), tiles.data(), 
+			  nullptr, out.data()) != TC_OK)
+			return false;
+
+		if (out == tiles)
+			return true;
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return false;
+}
+
+void bench_sample(void)
+{
+	// No min/max tree, only the source and the tiles
+	CPUTileCache cache = {};
+	if (test_data_source_init(&cache.ds)) {
+		printf("failed to create data source\n");
+		return;
+	}
+
+	tc_params params = {
+		.tile_size = TILE_SIZE*sizeof(float),
+		.capacity = (size_t)256*MEGABYTE,
+		.format = TC_FORMAT_U16,
+		.page_flags = 0,
+		.numa_node = PAGE_ALLOC_NODE_ANY,
+		.disk_path = nullptr,
+		.disk_capacity = 0,
+		.disk_version = 0,
+	};
+	if (tc_create(&cache.tc, &params)) {
+		printf("failed to create tile cache\n");
+		return;
+	}
+
+	std::mt19937 rng(11);
+
+	static const struct {
+		const char *name;
+		double spread;
+	} sets[] = {
+		{"sphere", 0},
+		{"local", 1e-3},
+	};
+
+	std::vector<sample_bench_points> points;
+	for (const auto &set : sets)
+		points.push_back(make_points(rng, glm::dvec3(0.3, 0.8, -0.5), set.spread));
+
+	// Coarse tiles everywhere, and the finest ones under the local points, 
+	// like a view looking down at them
+	std::vector<tile_code_t> tiles;
+	for (uint8_t f = 0; f < CUBE_FACES; ++f) {
+		for (uint8_t z = 0; z <= 2; ++z) {
+			for (uint64_t idx = 0; idx < (1ULL << 2*z); ++idx)
+				tiles.push_back(tile_code_pack(TileCode{.face = f, .zoom = z, .idx = idx}));
+		}
+	}
+
+	const sample_bench_points &local = points[1];
+	for (size_t i = 0; i < SAMPLE_BENCH_POINTS; ++i) {
+		glm::dvec2 uv;
+		uint8_t f;
+		globe_to_cube(glm::dvec3(local.x[i], local.y[i], local.z[i]), &uv, &f);
+		uv = glm::clamp(uv, 0.0, 1.0 - DBL_EPSILON);
+
+		uint64_t code = tile_code_pack(TileCode{
+			.face = f,
+			.zoom = TERRAIN_QUERY_ZOOM,
+			.idx = morton_u64(uv.x, uv.y, TERRAIN_QUERY_ZOOM),
+		});
+		tiles.push_back(cache.ds->vtbl.find(cache.ds->usr, code));
+	}
+	std::sort(tiles.begin(), tiles.end());
+	tiles.erase(std::unique(tiles.begin(), tiles.end()), tiles.end());
+
+	if (!load_all(&cache, tiles)) {
+		printf("failed to load %zu tiles\n", tiles.size());
+		return;
+	}
+
+	printf("%zu tiles loaded\n", tiles.size());
+	printf("%12s %14s %14s %14s %12s %12s %10s\n", "", "source pts/s", "query pts/s", 
+		"batch pts/s", "max diff", "mean bound", "exact");
+
+	for (size_t s = 0; s < points.size(); ++s) {
+		const sample_bench_points &pts = points[s];
+		std::vector<float> source (SAMPLE_BENCH_POINTS), batch (SAMPLE_BENCH_POINTS);
+		std::vector<terrain_sample> query (SAMPLE_BENCH_POINTS);
+
+		double t0 = bench_now();
+		for (size_t i = 0; i < SAMPLE_BENCH_POINTS; ++i) {
+			glm::dvec2 uv;
+			uint8_t f;
+			globe_to_cube(glm::dvec3(pts.x[i], pts.y[i], pts.z[i]), &uv, &f);
+			source[i] = cache.ds->vtbl.sample(cache.ds->usr, uv.x, uv.y, f);
+		}
+		double t1 = bench_now();
+		for (size_t i = 0; i < SAMPLE_BENCH_POINTS; ++i) {
+			glm::dvec2 uv;
+			uint8_t f;
+			globe_to_cube(glm::dvec3(pts.x[i], pts.y[i], pts.z[i]), &uv, &f);
+			query[i] = cache.query_elevation(uv, f, false);
+		}
+		double t2 = bench_now();
+		cache.sample_elevation_batch(SAMPLE_BENCH_POINTS, pts.x.data(), pts.y.data(), 
+							   pts.z.data(), batch.data());
+		double t3 = bench_now();
+
+		// Against the source where the finest tile was used, since the bound of
+		// the others is against that tile rather than the source
+		double diff = 0, bound = 0;
+		size_t exact = 0;
+		for (size_t i = 0; i < SAMPLE_BENCH_POINTS; ++i) {
+			if (query[i].exact) {
+				diff = std::max(diff, fabs((double)query[i].height - (double)source[i]));
+				++exact;
+			}
+			diff = std::max(diff, fabs((double)query[i].height - (double)batch[i]));
+			bound += query[i].error;
+		}
+
+		double n = (double)SAMPLE_BENCH_POINTS;
+		printf("%12s %14.0f %14.0f %14.0f %12.2e %12.2e %9.1f%%\n", sets[s].name, 
+			n/(t1 - t0), n/(t2 - t1), n/(t3 - t2), diff, bound/n, 100.0*(double)exact/n);
+	}
+}
@@ -0,0 +1,293 @@
+#include "bench.h"
+#include "camera_path.h"
+
+#include "globe/tile_select.h"
+
+#include <ev2/utils/camera.h>
+
+#include <vector>
+#include <unordered_set>
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+
+static constexpr size_t SELECT_BENCH_FRAMES = 240;
+static constexpr size_t SELECT_BENCH_MAX_TILES = 1024;
+static constexpr int SELECT_BENCH_REPEAT = 4;
+// The flyover is also run this many times slower, where the incremental 
+// selector has less to test again each frame
+static constexpr size_t SELECT_BENCH_SLOW = 10;
+
+std::vector<bench_camera> bench_descent_path(size_t frames)
+{
+	std::vector<bench_camera> path (frames);
+
+	for (size_t i = 0; i < frames; ++i) {
+		double t = (double)i/(double)(frames - 1);
+
+		double alt = 3.0*pow(1e-4/3.0, t);
+		double phi = 0.3 + 1.2*t;
+		double tht = 0.2 + 0.5*t;
+
+		glm::dvec3 n = glm::dvec3(cos(phi)*cos(tht), sin(phi)*cos(tht), sin(tht));
+		glm::dvec3 ahead = glm::dvec3(cos(phi + 0.2)*cos(tht),
+								sin(phi + 0.2)*cos(tht), sin(tht));
+
+		path[i].pos = n*(1.0 + alt);
+		path[i].target = ahead;
+	}
+
+	return path;
+}
+
+std::vector<bench_camera> bench_flyover_path(size_t frames)
+{
+	std::vector<bench_camera> path (frames);
+
+	for (size_t i = 0; i < frames; ++i) {
+		double t = (double)i/(double)(frames - 1);
+
+		double alt = 2e-3;
+		double phi = -0.6 + 2.4*t;
+		double tht = 0.1 + 0.3*t;
+
+		glm::dvec3 n = glm::dvec3(cos(phi)*cos(tht), sin(phi)*cos(tht), sin(tht));
+		glm::dvec3 ahead = glm::dvec3(cos(phi + 0.05)*cos(tht),
+								sin(phi + 0.05)*cos(tht), sin(tht));
+
+		path[i].pos = n*(1.0 + alt);
+		path[i].target = ahead;
+	}
+
+	return path;
+}
+
+static glm::dmat4 look_at(glm::dvec3 eye, glm::dvec3 target, glm::dvec3 up)
+{
+	glm::dvec3 f = normalize(target - eye);
+	glm::dvec3 r = normalize(cross(f, up));
+	glm::dvec3 u = cross(r, f);
+
+	return glm::dmat4(
+		glm::dvec4(r.x, u.x, -f.x, 0),
+		glm::dvec4(r.y, u.y, -f.y, 0),
+		glm::dvec4(r.z, u.z, -f.z, 0),
+		glm::dvec4(-dot(r, eye), -dot(u, eye), dot(f, eye), 1)
+	);
+}
+
+select_tiles_params bench_camera_params(
+	const mmt_tree *mmt, 
+	const bench_camera &cam,
+	size_t max_tiles
+)
+{
+	glm::dmat4 proj = glm::dmat4(camera_proj_3d(1.2f, 16.0f/9.0f, 10.0f, 1e-5f));
+	glm::dmat4 view = look_at(cam.pos, cam.target, cam.pos);
+
+	frustum_t frust = camera_frustum(proj*view);
+
+	double r_min = 1.0 + (double)mmt->defval.min;
+	double r_max = 1.0 + (double)mmt->defval.max;
+
+	double r_horizon = sqrt(std::max(dot(cam.pos,cam.pos) - r_min*r_min,0.));
+	double r_horizon_max  = sqrt(std::max(r_max * r_max - r_min*r_min,0.));
+
+	double r_cull = r_horizon + r_horizon_max;
+	frust.p.far.d = dot(cam.pos, frust.p.far.n) + r_cull;
+
+	return select_tiles_params{
+		.mmt = mmt,
+		.boxes = nullptr,
+		.max_tiles = max_tiles,
+		// As if all min/max values were loaded, so the tree is fully explored
+		.max_mmt_dist = INT_MAX,
+		.cull_radius = r_cull,
+		.occluder_radius = tile_occluder_radius(mmt),
+		.frust = frust,
+		.frust_box = frustum_aabb(frust),
+		.origin = cam.pos,
+		.res = tile_factor(6),
+	};
+}
+
+template<typename F>
+static double ms_per_frame(const std::vector<bench_camera> &path, F &&fn)
+{
+	double t0 = bench_now();
+	for (int r = 0; r < SELECT_BENCH_REPEAT; ++r) {
+		for (const bench_camera &cam : path)
+			fn(cam);
+	}
+	double t1 = bench_now();
+	return 1e3*(t1 - t0)/(double)(SELECT_BENCH_REPEAT*path.size());
+}
+
+/// @brief Checks an incremental selection against the unbudgeted one.  Under
+/// the budget they must be the same tiles.  Over it, the tiles must not 
+/// overlap and every unbudgeted tile must be in or below one of them.
+static bool incremental_matches(
+	const std::vector<tile_code_t> &unbudgeted, 
+	const std::vector<tile_code_t> &tiles,
+	size_t budget)
+{
+	if (unbudgeted.size() <= budget) {
+		std::vector<tile_code_t> a = unbudgeted, b = tiles;
+		std::sort(a.begin(), a.end());
+		std::sort(b.begin(), b.end());
+		return a == b;
+	}
+
+	if (tiles.size() > budget)
+		return false;
+
+	std::unordered_set<tile_code_t> set (tiles.begin(), tiles.end());
+	if (set.size() != tiles.size())
+		return false;
+
+	for (tile_code_t code : tiles) {
+		for (uint8_t z = tile_code_zoom(code); z > 0; --z) {
+			if (set.count(tile_code_ancestor(code, z - 1)))
+				return false;
+		}
+	}
+
+	for (tile_code_t code : unbudgeted) {
+		bool covered = false;
+		for (int z = tile_code_zoom(code); z >= 0 && !covered; --z)
+			covered = set.count(tile_code_ancestor(code, (uint8_t)z));
+		if (!covered)
+			return false;
+	}
+
+	return true;
+}
+
+// Budget of the second pass, which most frames of the descent go over
+static constexpr size_t SELECT_BENCH_TIGHT_TILES = 256;
+
+void bench_select(void)
+{
+	mmt_tree *mmt;
+	if (mmt_create(&mmt, mmt_value_t{.min = -0.1f, .max = 0.1f})) {
+		printf("failed to create min/max tree\n");
+		return;
+	}
+
+	std::vector<bench_camera> path = bench_descent_path(SELECT_BENCH_FRAMES);
+	std::vector<tile_code_t> ref, tiles;
+
+	static const size_t budgets[] = {SELECT_BENCH_MAX_TILES, SELECT_BENCH_TIGHT_TILES};
+
+	for (size_t budget : budgets) {
+		auto params_for = [&](const bench_camera &cam) {
+			return bench_camera_params(mmt, cam, budget);
+		};
+
+		size_t mismatches = 0;
+		size_t inc_mismatches = 0;
+		size_t inc_tests = 0;
+		size_t over_budget = 0;
+		size_t total = 0;
+
+		// Followed along the path, as it is used
+		SelectionCut check_cut = {};
+
+		for (const bench_camera &cam : path) {
+			select_tiles_params params = params_for(cam);
+			params.max_tiles = SIZE_MAX;
+			select_tiles_recursive(params, ref);
+			total += ref.size();
+
+			params = params_for(cam);
+			select_tiles_incremental(params, check_cut, tiles);
+			inc_mismatches += !incremental_matches(ref, tiles, budget);
+			inc_tests += check_cut.tests;
+
+			// Over the budget, the reference is the greedy selection from the 
+			// roots rather than the recursive one
+			if (ref.size() > budget) {
+				++over_budget;
+
+				params = params_for(cam);
+				select_tiles_greedy(params, ref);
+				mismatches += ref.size() > budget;
+			}
+
+			params = params_for(cam);
+			select_tiles_serial(params, tiles);
+			mismatches += ref != tiles;
+
+			params = params_for(cam);
+			select_tiles(params, tiles);
+			mismatches += ref != tiles;
+		}
+
+		double rec = ms_per_frame(path, [&](const bench_camera &cam) {
+			select_tiles_params params = params_for(cam);
+			select_tiles_recursive(params, tiles);
+			bench_keep(tiles);
+		});
+		double greedy = ms_per_frame(path, [&](const bench_camera &cam) {
+			select_tiles_params params = params_for(cam);
+			select_tiles_greedy(params, tiles);
+			bench_keep(tiles);
+		});
+		double bfs = ms_per_frame(path, [&](const bench_camera &cam) {
+			select_tiles_params params = params_for(cam);
+			select_tiles_serial(params, tiles);
+			bench_keep(tiles);
+		});
+		double par = ms_per_frame(path, [&](const bench_camera &cam) {
+			select_tiles_params params = params_for(cam);
+			select_tiles(params, tiles);
+			bench_keep(tiles);
+		});
+
+		SelectionCut cut = {};
+		double inc = ms_per_frame(path, [&](const bench_camera &cam) {
+			select_tiles_params params = params_for(cam);
+			select_tiles_incremental(params, cut, tiles);
+			bench_keep(tiles);
+		});
+
+		printf("max %zu tiles: %zu frames, %.1f tiles/frame unbudgeted, %zu over budget, "
+			"%zu results differ from the reference\n", budget, path.size(), 
+			(double)total/(double)path.size(), over_budget, mismatches);
+		printf("incremental: %zu frames differ from select_tiles, %.1f tests/frame\n",
+			inc_mismatches, (double)inc_tests/(double)path.size());
+		printf("%12s %10s\n", "", "ms/frame");
+		printf("%12s %10.3f\n", "recursive", rec);
+		printf("%12s %10.3f\n", "greedy", greedy);
+		printf("%12s %10.3f\n", "bfs simd", bfs);
+		printf("%12s %10.3f\n", "parallel", par);
+		printf("%12s %10.3f\n", "incremental", inc);
+	}
+
+	// Work per frame as the camera slows down
+	printf("%12s %10s %10s %12s\n", "flyover", "parallel", "inc", "tests/frame");
+
+	for (size_t slow = 1; slow <= SELECT_BENCH_SLOW; slow *= SELECT_BENCH_SLOW) {
+		std::vector<bench_camera> fly = bench_flyover_path(slow*SELECT_BENCH_FRAMES);
+
+		double par = ms_per_frame(fly, [&](const bench_camera &cam) {
+			select_tiles_params params = bench_camera_params(mmt, cam, SELECT_BENCH_MAX_TILES);
+			select_tiles(params, tiles);
+			bench_keep(tiles);
+		});
+
+		SelectionCut cut = {};
+		size_t tests = 0;
+		double inc = ms_per_frame(fly, [&](const bench_camera &cam) {
+			select_tiles_params params = bench_camera_params(mmt, cam, SELECT_BENCH_MAX_TILES);
+			select_tiles_incremental(params, cut, tiles);
+			tests += cut.tests;
+			bench_keep(tiles);
+		});
+
+		printf("%11zux %10.3f %10.3f %12.1f\n", slow, par, inc, 
+			(double)tests/(double)(SELECT_BENCH_REPEAT*fly.size()));
+	}
+
+	mmt_destroy(mmt);
+}
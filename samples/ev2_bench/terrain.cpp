@@ -0,0 +1,98 @@
+#include "bench.h"
+
+#include <ev2/globe/test_source.h>
+#include <ev2/globe/tiling.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+static constexpr size_t TERRAIN_BENCH_TILES = 6;
+// Slow enough that a few tiles are plenty
+static constexpr size_t TERRAIN_BENCH_REFERENCE_TILES = 2;
+
+static int never_cancelled(struct ds_token *)
+{
+	return 0;
+}
+
+// What test_loader_fn did before it was vectorized: one call to the scalar 
+// elevation function per texel.  That interpolated uv in float, which is off
+// by a good part of a texel at zoom 15, so this does it in double.
+static void load_reference(const ds_context *ds, uint64_t id, float *data)
+{
+	TileCode code = tile_code_unpack(id);
+	aabb2_t rect = morton_u64_to_rect_f64(code.idx, code.zoom);
+
+	double d = 1.0/(double)(TILE_WIDTH - 1);
+
+	size_t idx = 0;
+	for (size_t i = 0; i < TILE_WIDTH; ++i) {
+		for (size_t j = 0; j < TILE_WIDTH; ++j) {
+			glm::dvec2 uv = glm::dvec2((double)j*d, (double)i*d);
+			glm::dvec2 f = glm::mix(rect.ll(), rect.ur(), uv);
+
+			data[idx++] = ds->vtbl.sample(ds->usr, f.x, f.y, code.face);
+		}
+	}
+}
+
+// Tiles across zooms, where the highest octaves go from several cycles per
+// texel to well under one
+static uint64_t bench_tile(size_t i)
+{
+	static const uint8_t zooms[] = {0, 3, 6, 9, 12, 15};
+	uint8_t zoom = zooms[i % std::size(zooms)];
+
+	return tile_code_pack(TileCode{
+		.face = (uint8_t)(i % CUBE_FACES),
+		.zoom = zoom,
+		.idx = (0x9e3779b97f4a7c15ULL*(i + 1)) & (((uint64_t)1 << 2*zoom) - 1),
+	});
+}
+
+void bench_terrain(void)
+{
+	ds_context *ds;
+	if (test_data_source_init(&ds)) {
+		printf("failed to create data source\n");
+		return;
+	}
+
+	static const ds_token_vtbl vtbl = {.is_cancelled = never_cancelled};
+	ds_token tok = {.usr = nullptr, .vtbl = &vtbl};
+
+	std::vector<float> tile (TILE_SIZE), ref (TILE_SIZE);
+	ds_buf buf = {.dst = tile.data(), .size = TILE_SIZE*sizeof(float)};
+
+	double t0 = bench_now();
+	for (size_t i = 0; i < TERRAIN_BENCH_REFERENCE_TILES; ++i)
+		load_reference(ds, bench_tile(i), ref.data());
+	double t1 = bench_now();
+
+	for (size_t i = 0; i < TERRAIN_BENCH_TILES; ++i)
+		ds->vtbl.loader(ds->usr, bench_tile(i), &buf, &tok);
+	double t2 = bench_now();
+
+	// Against the scalar path.  Deep tiles are almost flat, so this is 
+	// relative to the range of the whole source rather than the tile.
+	double max_err = 0;
+	for (size_t i = 0; i < TERRAIN_BENCH_TILES; ++i) {
+		ds->vtbl.loader(ds->usr, bench_tile(i), &buf, &tok);
+		load_reference(ds, bench_tile(i), ref.data());
+
+		for (size_t k = 0; k < TILE_SIZE; ++k)
+			max_err = std::max(max_err, fabs((double)tile[k] - (double)ref[k]));
+	}
+
+	double range = (double)(ds->vtbl.max(ds->usr) - ds->vtbl.min(ds->usr));
+
+	ds_context_destroy(ds);
+
+	printf("%20s %12s\n", "", "tiles/s");
+	printf("%20s %12.1f\n", "scalar", (double)TERRAIN_BENCH_REFERENCE_TILES/(t1 - t0));
+	printf("%20s %12.1f\n", "batched", (double)TERRAIN_BENCH_TILES/(t2 - t1));
+	printf("max error %.2e, %.2e of the source's range\n", max_err, max_err/range);
+}
@@ -0,0 +1,131 @@
+#include "bench.h"
+
+#include "utils/page_alloc.h"
+
+#include <vector>
+#include <random>
+#include <cstring>
+#include <cinttypes>
+
+// Tiles as gpu_cache uploads them, copied out of the CPU cache into a
+// staging buffer one at a time
+static constexpr size_t UPLOAD_BENCH_TILE_SIZE = 256*1024;
+static constexpr size_t UPLOAD_BENCH_TILES = 1024;
+static constexpr size_t UPLOAD_BENCH_STAGING_TILES = 32;
+static constexpr size_t UPLOAD_BENCH_COPIES = 16*1024;
+
+// @return Kilobytes of the mapping at addr backed by transparent huge pages,
+// or -1 if unknown
+static long anon_huge_kb(const void *addr)
+{
+	FILE *f = fopen("/proc/self/smaps", "r");
+	if (!f)
+		return -1;
+
+	uintptr_t p = reinterpret_cast<uintptr_t>(addr);
+
+	char line[512];
+	bool inside = false;
+	long kb = -1;
+	while (fgets(line, sizeof(line), f)) {
+		uintptr_t lo, hi;
+		if (sscanf(line, "%" SCNxPTR "-%" SCNxPTR, &lo, &hi) == 2 &&
+			strchr(line, '-') < strchr(line, ' ')) {
+			inside = lo <= p && p < hi;
+			continue;
+		}
+
+		long val;
+		if (inside && sscanf(line, "AnonHugePages: %ld kB", &val) == 1)
+			kb = val;
+	}
+
+	fclose(f);
+	return kb;
+}
+
+static double copy_gbps(const uint8_t *src, uint8_t *staging,
+						const std::vector<uint32_t> &order)
+{
+	double t0 = bench_now();
+	for (size_t i = 0; i < order.size(); ++i) {
+		uint8_t *dst = staging + (i % UPLOAD_BENCH_STAGING_TILES)*UPLOAD_BENCH_TILE_SIZE;
+		memcpy(dst, src + (size_t)order[i]*UPLOAD_BENCH_TILE_SIZE, UPLOAD_BENCH_TILE_SIZE);
+		bench_keep(dst[0]);
+	}
+	double t1 = bench_now();
+
+	return (double)(order.size()*UPLOAD_BENCH_TILE_SIZE)/(t1 - t0)*1e-9;
+}
+
+static void bench_upload_source(const char *name, uint8_t *src, uint8_t *staging,
+								const std::vector<uint32_t> &order)
+{
+	// Written by the loader threads before any upload
+	memset(src, 1, UPLOAD_BENCH_TILES*UPLOAD_BENCH_TILE_SIZE);
+
+	double gbps = copy_gbps(src, staging, order);
+
+	long kb = anon_huge_kb(src);
+	if (kb >= 0)
+		printf("%20s %10.2f %14ld\n", name, gbps, kb/1024);
+	else
+		printf("%20s %10.2f %14s\n", name, gbps, "?");
+}
+
+void bench_upload(void)
+{
+	std::mt19937 rng(7);
+	std::uniform_int_distribution<uint32_t> dist(0, UPLOAD_BENCH_TILES - 1);
+
+	std::vector<uint32_t> order(UPLOAD_BENCH_COPIES);
+	for (uint32_t &tile : order)
+		tile = dist(rng);
+
+	std::vector<uint8_t> staging(UPLOAD_BENCH_STAGING_TILES*UPLOAD_BENCH_TILE_SIZE, 0);
+
+	size_t size = UPLOAD_BENCH_TILES*UPLOAD_BENCH_TILE_SIZE;
+
+	printf("%zu KB tiles, random order from %zu MB\n",
+		UPLOAD_BENCH_TILE_SIZE/1024, size/(1024*1024));
+	printf("%20s %10s %14s\n", "source", "GB/s", "huge pages MB");
+
+	{
+		uint8_t *src = new uint8_t[size];
+		bench_upload_source("new[]", src, staging.data(), order);
+		delete[] src;
+	}
+
+	static const struct {
+		const char *name;
+		uint32_t flags;
+	} sources[] = {
+		{"region", 0},
+		{"region thp", PAGE_ALLOC_THP},
+		{"region hugetlb", PAGE_ALLOC_HUGETLB},
+	};
+
+	for (const auto &s : sources) {
+		page_region_params params = {
+			.size = size,
+			.flags = s.flags,
+			.numa_node = PAGE_ALLOC_NODE_ANY,
+		};
+
+		page_region reg;
+		if (page_region_reserve(&reg, &params) < 0 ||
+			page_region_commit(&reg, 0, size) < 0) {
+			printf("%20s failed\n", s.name);
+			continue;
+		}
+
+		// Fell back to something else
+		if ((reg.flags & s.flags) != s.flags) {
+			printf("%20s unavailable\n", s.name);
+		} else {
+			bench_upload_source(s.name, reg.base, staging.data(), order);
+		}
+
+		page_region_release(&reg);
+	}
+}
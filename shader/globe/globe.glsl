@@ -29,6 +29,8 @@ struct metadata_t
 	uint tex_idx;
 	uint code_lower;
 	uint code_upper;
+
+	uint face;
 };
 
 const uint MAX_TILE_PAGES = 8;
@@ -10,10 +10,6 @@
 //------------------------------------------------------------------------------
 // Vert
 
-layout (location = 0) in vec3 pos;
-layout (location = 1) in vec2 in_uv;
-layout (location = 2) in vec3 normal;
-
 layout (location = 0) out vec3 out_pos;
 layout (location = 1) out vec2 out_uv;
 layout (location = 2) out vec3 out_normal;
@@ -61,11 +57,21 @@ tile_code_t from_input(uint left, uint right)
 
 tile_code_t get_code()
 {
-	uint tile_idx = gl_VertexIndex/TILE_VERT_COUNT;
+	uint tile_idx = uint(gl_VertexIndex)/TILE_VERT_COUNT;
 	metadata_t mdata = metadata[tile_idx];
 	return from_input(mdata.code_lower,mdata.code_upper);
 }
 
+// Tiles have no vertex buffer.  Every tile is the same TILE_VERT_WIDTH^2 grid,
+// so the local uv is recovered from the vertex index within the tile.
+vec2 grid_uv(uint vert_idx)
+{
+	uint i = vert_idx/TILE_VERT_WIDTH;
+	uint j = vert_idx%TILE_VERT_WIDTH;
+
+	return vec2(i,j)/float(TILE_VERT_WIDTH - 1);
+}
+
 vec2 adjust_uv_for_clamp(vec2 uv)
 {
 	return vec2(1.0/512.0) + uv*(1-1.0/256.0); 
@@ -176,19 +182,22 @@ void main()
 {
 	mat4 pv = u_view.pv;
 
-	vec4 wpos = vec4(pos, 1);
-
-	uint tile_idx = gl_VertexIndex/TILE_VERT_COUNT;
+	uint tile_idx = uint(gl_VertexIndex)/TILE_VERT_COUNT;
+	uint vert_idx = uint(gl_VertexIndex)%TILE_VERT_COUNT;
 
 	metadata_t mdata = metadata[tile_idx];
 	tex_idx_t tex_idx = decode_tex_idx(mdata.tex_idx);
 	tile_code_t code = from_input(mdata.code_lower,mdata.code_upper);
 
+	vec2 in_uv = grid_uv(vert_idx);
+
 	vec2 tex_uv = mix(mdata.tex_uv[0], mdata.tex_uv[1], in_uv);
 	vec2 face_uv = mix(mdata.globe_uv[0], mdata.globe_uv[1], in_uv);
 
 	vec2 uv = adjust_uv_for_clamp(tex_uv); 
-	vec3 n = normal;
+	vec3 n = cube_to_globe(mdata.face, face_uv);
+
+	vec4 wpos = vec4(n, 1);
 
 	vec3 N = vec3(0);
 	vec4 val = vec4(0);
@@ -199,7 +208,7 @@ void main()
 		f = sample_tex(tex_idx, uv);
 		df = tex_grad(tex_idx, uv, code.zoom);
 
-		N = globe_normal(n,f,df,2.0*face_uv - vec2(1.0),code.face,code.zoom);
+		N = globe_normal(n,f,df,2.0*face_uv - vec2(1.0),mdata.face,code.zoom);
 
 		wpos += vec4(n*f,0);
 	}